@@ -0,0 +1,258 @@
+#include <approx/convolution_pyramid.h>
+#include <approx/poisson.h>
+#include <fmt/std.h>
+#include <gdal_priv.h>
+#include <spdlog/spdlog.h>
+#include <utils/cloud_mask.h>
+#include <utils/geotiff.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+namespace fs = std::filesystem;
+using namespace approx;
+
+// Fits the membrane filters of the convolution pyramid (membrane_kernels): the analysis and synthesis filters are the
+// same symmetric 5-tap filter [c, b, a, b, c] and the skip filter is the identity. The filter is fitted the same way as
+// in the paper, by minimizing the difference between the normalized convolution of the boundary differences and the
+// exact membrane (a tightly converged solve of the blend), here with Nelder-Mead on a fixed set of synthetic scenes and
+// optionally the cloud mask of a folder of Sentinel-2 bands
+
+struct Scene {
+    MultiChannelImage replacement;
+    MatX<bool> invalid;
+    // The valid pixels next to the mask, and the differences between the images there
+    MatX<f64> boundary;
+    MatX<f64> differences;
+    // The exact membrane over the masked pixels
+    MatX<f64> membrane;
+};
+
+using Parameters = std::array<f64, 3>;
+
+static PyramidKernels kernels_from(Parameters const& p)
+{
+    std::vector<f64> filter = { p[2], p[1], p[0], p[1], p[2] };
+    return { .analysis = filter, .synthesis = filter, .skip = { 1.0 } };
+}
+
+// Solve the exact membrane of a scene, and find its boundary
+static Scene finish_scene(Scene scene, MultiChannelImage const& input)
+{
+    MultiChannelImage exact = input;
+    blend_images_poisson(exact, scene.replacement, scene.invalid, { .backend = SolverBackend::MultigridConjugateGradient, .tolerance = 1e-10 });
+    scene.membrane = scene.invalid.select(exact[0] - scene.replacement[0], 0.0);
+
+    // The same boundary as blend_images_poisson_pyramid
+    scene.boundary = MatX<f64>::Zero(input.rows(), input.cols());
+    for (Eigen::Index col = 0; col < input.cols(); ++col) {
+        for (Eigen::Index row = 0; row < input.rows(); ++row) {
+            if (!scene.invalid(row, col)) {
+                continue;
+            }
+            for (auto const& [nrow, ncol] : valid_neighbours(scene.invalid, { row, col })) {
+                if (!scene.invalid(nrow, ncol)) {
+                    scene.boundary(nrow, ncol) = 1.0;
+                }
+            }
+        }
+    }
+    scene.differences = (scene.boundary.array() > 0.0).select(input[0] - scene.replacement[0], 0.0);
+    return scene;
+}
+
+// A mask of rectangles and disks, and a difference between the images that is a sum of waves of the given frequency
+static Scene make_scene(Eigen::Index size, f64 frequency, int seed)
+{
+    Scene scene;
+    scene.invalid = MatX<bool>::Constant(size, size, false);
+    MultiChannelImage input(1, size, size);
+    scene.replacement = MultiChannelImage(1, size, size);
+    auto offset = (f64)seed;
+    for (Eigen::Index col = 0; col < size; ++col) {
+        for (Eigen::Index row = 0; row < size; ++row) {
+            auto r = (f64)row, c = (f64)col;
+            scene.replacement(0, row, col) = std::sin(0.21 * r + offset) * std::cos(0.17 * c);
+            input(0, row, col) = scene.replacement(0, row, col) + 1.0 + 0.004 * r - 0.003 * c
+                + std::sin(frequency * r + offset) * std::cos(0.7 * frequency * c + 2.0 * offset);
+        }
+    }
+
+    // A few rectangles and disks, placed deterministically from the seed
+    for (int shape = 0; shape < 4; ++shape) {
+        Eigen::Index row = (size / 8) + ((seed * 37 + shape * 53) % (size / 2));
+        Eigen::Index col = (size / 8) + ((seed * 29 + shape * 71) % (size / 2));
+        Eigen::Index extent = size / 10 + ((seed * 13 + shape * 19) % (size / 6));
+        if (shape % 2 == 0) {
+            scene.invalid.block(row, col, std::min(extent, size - row - 1), std::min(2 * extent, size - col - 1)).setConstant(true);
+        } else {
+            for (Eigen::Index y = std::max<Eigen::Index>(1, row - extent); y < std::min(size - 1, row + extent); ++y) {
+                for (Eigen::Index x = std::max<Eigen::Index>(1, col - extent); x < std::min(size - 1, col + extent); ++x) {
+                    if ((y - row) * (y - row) + (x - col) * (x - col) < extent * extent) {
+                        scene.invalid(y, x) = true;
+                    }
+                }
+            }
+        }
+    }
+
+    return finish_scene(std::move(scene), input);
+}
+
+// The cloud mask of a folder of bands, with the band with a different gain and offset as the replacement (the same
+// scenes as poisson_benchmark)
+static std::vector<Scene> read_scenes(fs::path const& folder, std::vector<std::string> const& bands)
+{
+    MatX<bool> invalid = utils::read_cloud_mask(folder);
+
+    std::vector<Scene> scenes;
+    for (auto const& band : bands) {
+        MultiChannelImage input;
+        input.images.push_back(utils::GeoTIFF<f64>(folder / fmt::format("{}.tif", band)).read(1));
+        Scene scene;
+        scene.invalid = invalid;
+        scene.replacement = input;
+        scene.replacement.images[0] = (0.8 * input[0].array() + 0.1 * input[0].mean()).matrix();
+        scenes.push_back(finish_scene(std::move(scene), input));
+    }
+    return scenes;
+}
+
+// The RMS error of the normalized convolution relative to the RMS of the exact membrane
+static f64 relative_error(Scene const& scene, PyramidKernels const& kernels)
+{
+    MatX<f64> weights = convolution_pyramid(scene.boundary, kernels);
+    MatX<f64> values = convolution_pyramid(scene.differences, kernels);
+    if ((scene.invalid.array() && (weights.array() <= 0.0)).any()) {
+        return std::numeric_limits<f64>::infinity();
+    }
+    MatX<f64> membrane = scene.invalid.select(values.array() / weights.array(), 0.0);
+    return (membrane - scene.membrane).norm() / scene.membrane.norm();
+}
+
+static f64 objective(std::vector<Scene> const& scenes, Parameters const& p)
+{
+    if (p[0] <= 0.0 || p[1] < 0.0 || p[2] < 0.0) {
+        return std::numeric_limits<f64>::infinity();
+    }
+    PyramidKernels kernels = kernels_from(p);
+    f64 total = 0.0;
+    for (auto const& scene : scenes) {
+        total += relative_error(scene, kernels);
+    }
+    return total / (f64)scenes.size();
+}
+
+// Nelder-Mead with the standard coefficients, from a simplex around the start
+static Parameters nelder_mead(std::vector<Scene> const& scenes, Parameters const& start, f64 step, int max_evaluations)
+{
+    constexpr size_t n = std::tuple_size_v<Parameters>;
+    std::array<std::pair<f64, Parameters>, n + 1> simplex;
+    simplex[0] = { objective(scenes, start), start };
+    for (size_t i = 0; i < n; ++i) {
+        Parameters vertex = start;
+        vertex[i] += step;
+        simplex[i + 1] = { objective(scenes, vertex), vertex };
+    }
+    int evaluations = (int)n + 1;
+
+    auto combine = [](Parameters const& a, Parameters const& b, f64 t) {
+        Parameters result;
+        for (size_t i = 0; i < n; ++i) {
+            result[i] = a[i] + t * (b[i] - a[i]);
+        }
+        return result;
+    };
+
+    while (evaluations < max_evaluations) {
+        std::sort(simplex.begin(), simplex.end(), [](auto const& a, auto const& b) { return a.first < b.first; });
+        if (simplex[n].first - simplex[0].first < 1e-10) {
+            break;
+        }
+        Parameters centroid {};
+        for (size_t v = 0; v < n; ++v) {
+            for (size_t i = 0; i < n; ++i) {
+                centroid[i] += simplex[v].second[i] / (f64)n;
+            }
+        }
+
+        Parameters reflected = combine(centroid, simplex[n].second, -1.0);
+        f64 reflected_value = objective(scenes, reflected);
+        ++evaluations;
+        if (reflected_value < simplex[0].first) {
+            Parameters expanded = combine(centroid, simplex[n].second, -2.0);
+            f64 expanded_value = objective(scenes, expanded);
+            ++evaluations;
+            simplex[n] = expanded_value < reflected_value ? std::pair { expanded_value, expanded } : std::pair { reflected_value, reflected };
+        } else if (reflected_value < simplex[n - 1].first) {
+            simplex[n] = { reflected_value, reflected };
+        } else {
+            Parameters contracted = combine(centroid, simplex[n].second, 0.5);
+            f64 contracted_value = objective(scenes, contracted);
+            ++evaluations;
+            if (contracted_value < simplex[n].first) {
+                simplex[n] = { contracted_value, contracted };
+            } else {
+                for (size_t v = 1; v <= n; ++v) {
+                    simplex[v].second = combine(simplex[0].second, simplex[v].second, 0.5);
+                    simplex[v].first = objective(scenes, simplex[v].second);
+                    ++evaluations;
+                }
+            }
+        }
+    }
+    std::sort(simplex.begin(), simplex.end(), [](auto const& a, auto const& b) { return a.first < b.first; });
+    spdlog::info("Nelder-Mead took {} evaluations", evaluations);
+    return simplex[0].second;
+}
+
+int main(int argc, char** argv)
+{
+    // Smooth and oscillating differences, on a few masks
+    std::vector<Scene> scenes;
+    for (int seed = 0; seed < 3; ++seed) {
+        for (f64 frequency : { 0.01, 0.05, 0.2 }) {
+            scenes.push_back(make_scene(256, frequency, seed));
+        }
+    }
+    size_t num_synthetic = scenes.size();
+    // Cloud masks break up into many small regions, which the synthetic masks do not have
+    if (argc > 1) {
+        fs::path folder(argv[1]);
+        std::vector<std::string> bands = { "B02", "B03", "B04", "B08" };
+        for (auto const& name : { "B02", "B03", "B04", "B08", "CLD", "SCL" }) {
+            if (!fs::exists(folder / fmt::format("{}.tif", name))) {
+                spdlog::error("{} does not exist", folder / fmt::format("{}.tif", name));
+                return -1;
+            }
+        }
+        GDALAllRegister();
+        for (auto& scene : read_scenes(folder, bands)) {
+            scenes.push_back(std::move(scene));
+        }
+    } else {
+        spdlog::info("Usage: {} [folder of Sentinel-2 bands (e.g. test_data/2019-05-22)]. Without a folder, only the synthetic scenes are used", argv[0]);
+    }
+
+    // Start from the binomial filter, which is a plain Gaussian pyramid
+    Parameters start = { 6.0 / 16.0, 4.0 / 16.0, 1.0 / 16.0 };
+    spdlog::info("Binomial filter: mean relative error {:.4f}", objective(scenes, start));
+    Parameters fitted = nelder_mead(scenes, start, 0.1, 2000);
+    spdlog::info("Fitted filter: mean relative error {:.4f}", objective(scenes, fitted));
+    spdlog::info("[{:.4f}, {:.4f}, {:.4f}, {:.4f}, {:.4f}]", fitted[2], fitted[1], fitted[0], fitted[1], fitted[2]);
+
+    // The synthetic scenes come first
+    for (auto const& [name, kernels] : { std::pair { "Fitted filter", kernels_from(fitted) }, std::pair { "membrane_kernels()", membrane_kernels() } }) {
+        std::vector<f64> errors;
+        for (auto const& scene : scenes) {
+            errors.push_back(relative_error(scene, kernels));
+        }
+        spdlog::info("{}: relative error {:.4f} to {:.4f} on the synthetic scenes, {:.4f} to {:.4f} on the bands", name,
+            *std::min_element(errors.begin(), errors.begin() + num_synthetic), *std::max_element(errors.begin(), errors.begin() + num_synthetic),
+            num_synthetic < errors.size() ? *std::min_element(errors.begin() + num_synthetic, errors.end()) : 0.0,
+            num_synthetic < errors.size() ? *std::max_element(errors.begin() + num_synthetic, errors.end()) : 0.0);
+    }
+    return 0;
+}
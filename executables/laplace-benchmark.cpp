@@ -0,0 +1,145 @@
+#include <approx/laplace.h>
+#include <fmt/std.h>
+#include <gdal_priv.h>
+#include <spdlog/spdlog.h>
+#include <spdlog/stopwatch.h>
+#include <utils/cloud_mask.h>
+#include <utils/geotiff.h>
+#include <utils/log.h>
+
+#include <algorithm>
+
+namespace fs = std::filesystem;
+using namespace approx;
+
+struct SystemStats {
+    long unknowns = 0;
+    long non_zeros = 0;
+    f64 seconds = 0.0;
+};
+
+// The original formulation: every pixel in the bounding box of the region gets its own row,
+// and the pixels that are known get an identity (dirichlet) row.
+SystemStats solve_bounding_box(MatX<f64> const& input, MatX<int> const& labels, int label, std::vector<index_t> const& pixels)
+{
+    spdlog::stopwatch sw;
+    auto [min_row_it, max_row_it] = std::minmax_element(pixels.begin(), pixels.end(), [](index_t a, index_t b) { return a.row < b.row; });
+    auto [min_col_it, max_col_it] = std::minmax_element(pixels.begin(), pixels.end(), [](index_t a, index_t b) { return a.col < b.col; });
+    Eigen::Index min_row = min_row_it->row, max_row = max_row_it->row;
+    Eigen::Index min_col = min_col_it->col, max_col = max_col_it->col;
+    Eigen::Index width = max_col - min_col + 1;
+    Eigen::Index matrix_size = (max_row - min_row + 1) * width;
+
+    auto index = [&](Eigen::Index row, Eigen::Index col) {
+        return (col - min_col) + (row - min_row) * width;
+    };
+    auto known = [&](Eigen::Index row, Eigen::Index col) {
+        return labels(row, col) != label || row == 0 || col == 0 || row == input.rows() - 1 || col == input.cols() - 1;
+    };
+
+    VecX<f64> b = VecX<f64>::Zero(matrix_size);
+    std::vector<triplet_t> coefficients;
+    for (Eigen::Index row = min_row; row <= max_row; ++row) {
+        for (Eigen::Index col = min_col; col <= max_col; ++col) {
+            auto i = index(row, col);
+            if (known(row, col)) {
+                coefficients.emplace_back(i, i, 1.0);
+                b[i] = input(row, col);
+                continue;
+            }
+            coefficients.emplace_back(i, i, 4.0);
+            for (auto const& [nrow, ncol] : valid_neighbours(input, { row, col })) {
+                if (known(nrow, ncol)) {
+                    b[i] += input(nrow, ncol);
+                } else {
+                    coefficients.emplace_back(i, index(nrow, ncol), -1.0);
+                }
+            }
+        }
+    }
+
+    sparse_t A(matrix_size, matrix_size);
+    A.setFromTriplets(coefficients.begin(), coefficients.end());
+    SparseSolver solver(A);
+    VecX<f64> values = solver.solve(b);
+
+    return { .unknowns = matrix_size, .non_zeros = A.nonZeros(), .seconds = sw.elapsed().count() };
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        spdlog::info("Usage: {} <folder (e.g. test_data/2019-05-22)> [band (default: B04)] [cloud probability threshold (default: 30)]", argv[0]);
+        return -1;
+    }
+    fs::path folder(argv[1]);
+    std::string band = argc > 2 ? argv[2] : "B04";
+    f64 threshold = argc > 3 ? std::stod(argv[3]) : 30.0;
+
+    for (auto const& name : { band, std::string("CLD"), std::string("SCL") }) {
+        if (!fs::exists(folder / fmt::format("{}.tif", name))) {
+            spdlog::error("{} does not exist", folder / fmt::format("{}.tif", name));
+            return -1;
+        }
+    }
+
+    GDALAllRegister();
+
+    MatX<f64> image = utils::GeoTIFF<f64>(folder / fmt::format("{}.tif", band)).read(1);
+
+    MatX<bool> invalid = utils::read_cloud_mask(folder, threshold);
+    auto components = find_connected_components(invalid);
+    spdlog::info("{}x{} image, {} invalid pixels in {} regions",
+        image.rows(), image.cols(), invalid.count(), components.region_map.size());
+
+    // The regions are solved concurrently in the library, so we do the same for the reference formulation
+    std::vector<int> labels = components.labels_by_size();
+    std::vector<SystemStats> region_stats(labels.size());
+    spdlog::stopwatch sw;
+#pragma omp parallel for schedule(dynamic)
+    for (long i = 0; i < (long)labels.size(); ++i) {
+        int label = labels[(size_t)i];
+        region_stats[(size_t)i] = solve_bounding_box(image, components.matrix, label, components.region_map.at(label));
+    }
+    SystemStats bounding_box { .seconds = sw.elapsed().count() };
+    for (auto const& stats : region_stats) {
+        bounding_box.unknowns += stats.unknowns;
+        bounding_box.non_zeros += stats.non_zeros;
+    }
+
+    // Unknown-only formulation: one row per invalid pixel that is not on the border of the image
+    SystemStats unknown_only;
+    for (Eigen::Index row = 1; row < invalid.rows() - 1; ++row) {
+        for (Eigen::Index col = 1; col < invalid.cols() - 1; ++col) {
+            if (!invalid(row, col)) {
+                continue;
+            }
+            unknown_only.unknowns += 1;
+            unknown_only.non_zeros += 1;
+            for (auto const& [nrow, ncol] : valid_neighbours(invalid, { row, col })) {
+                bool border = nrow == 0 || ncol == 0 || nrow == invalid.rows() - 1 || ncol == invalid.cols() - 1;
+                unknown_only.non_zeros += (invalid(nrow, ncol) && !border) ? 1 : 0;
+            }
+        }
+    }
+
+    MatX<f64> filled = image;
+    sw.reset();
+    fill_missing_portion_smooth_boundary(filled, invalid);
+    unknown_only.seconds = sw.elapsed().count();
+
+    // Pull-push does not build a system: every invalid pixel is filled from the pyramid
+    MatX<f64> pull_push_filled = image;
+    sw.reset();
+    fill_missing_portion_pull_push(pull_push_filled, invalid);
+    SystemStats pull_push { .unknowns = invalid.count(), .seconds = sw.elapsed().count() };
+
+    spdlog::info("{:>14} {:>14} {:>14} {:>10}", "formulation", "rows", "non-zeros", "seconds");
+    spdlog::info("{:>14} {:>14} {:>14} {:>10.3f}", "bounding box", bounding_box.unknowns, bounding_box.non_zeros, bounding_box.seconds);
+    spdlog::info("{:>14} {:>14} {:>14} {:>10.3f}", "unknown only", unknown_only.unknowns, unknown_only.non_zeros, unknown_only.seconds);
+    spdlog::info("{:>14} {:>14} {:>14} {:>10.3f}", "pull-push", pull_push.unknowns, pull_push.non_zeros, pull_push.seconds);
+    spdlog::info("RMS difference between the pull-push and the Laplace fill: {:.4e}",
+        std::sqrt(invalid.select(pull_push_filled - filled, 0.0).squaredNorm() / (f64)std::max<long>(pull_push.unknowns, 1)));
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <approx/laplace.h>
+#include <approx/ordering.h>
+#include <fmt/std.h>
+#include <gdal_priv.h>
+#include <spdlog/spdlog.h>
+#include <spdlog/stopwatch.h>
+#include <utils/cloud_mask.h>
+
+#include <magic_enum.hpp>
+
+namespace fs = std::filesystem;
+using namespace approx;
+
+// A large blob and a tall, thin strip, which is the worst case for the raster order
+static MatX<bool> synthetic_mask(Eigen::Index size)
+{
+    MatX<bool> invalid = MatX<bool>::Constant(size, size, false);
+    for (Eigen::Index col = 1; col < size - 1; ++col) {
+        for (Eigen::Index row = 1; row < size - 1; ++row) {
+            f64 x = (f64)col / (f64)size - 0.4;
+            f64 y = (f64)row / (f64)size - 0.5;
+            bool blob = x * x + 2.0 * y * y + 0.05 * std::sin(40.0 * x) < 0.08;
+            bool strip = col >= size - size / 8 && col < size - size / 16;
+            invalid(row, col) = blob || strip;
+        }
+    }
+    return invalid;
+}
+
+struct OrderingStats {
+    Eigen::Index bandwidth = 0;
+    // The average distance (in f64 values) between the off-diagonal entries and the diagonal
+    f64 mean_distance = 0.0;
+    // The part of the off-diagonal entries that are not in the same cache line as the diagonal. These are the accesses
+    // of the matrix-vector product that can miss the cache
+    f64 far_entries = 0.0;
+    f64 product_seconds = 0.0;
+    f64 solve_seconds = 0.0;
+    long iterations = 0;
+};
+
+static OrderingStats measure(StencilSystem const& region, UnknownOrdering ordering, int products)
+{
+    OrderingStats stats;
+    std::vector<Eigen::Index> order = unknown_order(region, ordering);
+    sparse_t A = reorder(region, order).assemble();
+
+    stats.bandwidth = bandwidth(A);
+    Eigen::Index off_diagonal = 0, far = 0;
+    for (Eigen::Index col = 0; col < A.outerSize(); ++col) {
+        for (sparse_t::InnerIterator it(A, col); it; ++it) {
+            Eigen::Index distance = std::abs(it.index() - col);
+            if (distance == 0) {
+                continue;
+            }
+            off_diagonal += 1;
+            stats.mean_distance += (f64)distance;
+            far += distance * (Eigen::Index)sizeof(f64) >= 64 ? 1 : 0;
+        }
+    }
+    stats.mean_distance /= (f64)std::max<Eigen::Index>(off_diagonal, 1);
+    stats.far_entries = (f64)far / (f64)std::max<Eigen::Index>(off_diagonal, 1);
+
+    VecX<f64> x = VecX<f64>::Ones(A.rows());
+    VecX<f64> y(A.rows());
+    spdlog::stopwatch sw;
+    for (int i = 0; i < products; ++i) {
+        y.noalias() = row_major_view(A) * x;
+        x.swap(y);
+    }
+    stats.product_seconds = sw.elapsed().count();
+
+    VecX<f64> b = VecX<f64>::Ones(region.size());
+    LinearSolver solver(region, { .ordering = ordering });
+    sw.reset();
+    solver.solveWithGuess(b, VecX<f64>::Zero(region.size()));
+    stats.solve_seconds = sw.elapsed().count();
+    stats.iterations = solver.iterations();
+    return stats;
+}
+
+int main(int argc, char** argv)
+{
+    MatX<bool> invalid;
+    if (argc > 1) {
+        fs::path folder(argv[1]);
+        f64 threshold = argc > 2 ? std::stod(argv[2]) : 30.0;
+        for (auto const& name : { "CLD", "SCL" }) {
+            if (!fs::exists(folder / fmt::format("{}.tif", name))) {
+                spdlog::error("{} does not exist", folder / fmt::format("{}.tif", name));
+                return -1;
+            }
+        }
+
+        GDALAllRegister();
+        invalid = utils::read_cloud_mask(folder, threshold);
+    } else {
+        spdlog::info("Usage: {} [folder (e.g. test_data/2019-05-22)] [cloud probability threshold (default: 30)]", argv[0]);
+        spdlog::info("Without a folder, a synthetic 2000x2000 mask is used");
+        invalid = synthetic_mask(2000);
+    }
+
+    // The largest region of the mask, with the same system as the Laplace fill
+    auto components = find_connected_components(invalid);
+    std::vector<int> labels = components.labels_by_size();
+    if (labels.empty()) {
+        spdlog::error("The mask does not have any invalid pixels");
+        return -1;
+    }
+    StencilSystem region { .unknowns = components.region_map.at(labels[0]) };
+    region.diagonal = VecX<f64>::Constant(region.size(), 4.0);
+    spdlog::info("{}x{} mask, largest region has {} unknowns", invalid.rows(), invalid.cols(), region.size());
+    spdlog::info("Hardware cache misses can be counted by running the benchmark under `perf stat -e cache-misses`");
+
+    spdlog::info("{:>20} {:>10} {:>14} {:>12} {:>14} {:>10} {:>10}",
+        "ordering", "bandwidth", "mean distance", "far entries", "100 products", "solve", "iterations");
+    for (auto ordering : magic_enum::enum_values<UnknownOrdering>()) {
+        OrderingStats stats = measure(region, ordering, 100);
+        spdlog::info("{:>20} {:>10} {:>14.1f} {:>11.1f}% {:>13.3f}s {:>9.3f}s {:>10}",
+            magic_enum::enum_name(ordering), stats.bandwidth, stats.mean_distance, 100.0 * stats.far_entries,
+            stats.product_seconds, stats.solve_seconds, stats.iterations);
+    }
+
+    return 0;
+}
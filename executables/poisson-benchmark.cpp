@@ -0,0 +1,120 @@
+#include <approx/poisson.h>
+#include <fmt/std.h>
+#include <gdal_priv.h>
+#include <spdlog/spdlog.h>
+#include <spdlog/stopwatch.h>
+#include <utils/cloud_mask.h>
+#include <utils/geotiff.h>
+
+namespace fs = std::filesystem;
+using namespace approx;
+
+static MultiChannelImage read_bands(fs::path const& folder, std::vector<std::string> const& bands)
+{
+    MultiChannelImage images;
+    for (auto const& band : bands) {
+        images.images.push_back(utils::GeoTIFF<f64>(folder / fmt::format("{}.tif", band)).read(1));
+    }
+    return images;
+}
+
+struct BlendStats {
+    f64 seconds = 0.0;
+    // The RMS and largest difference to the reference blend over the masked pixels, and the RMS relative to the
+    // difference between the reference and the replacement image
+    f64 rms = 0.0;
+    f64 max = 0.0;
+    f64 relative = 0.0;
+};
+
+static BlendStats compare(MultiChannelImage const& result, MultiChannelImage const& reference, MultiChannelImage const& replacement, MatX<bool> const& invalid)
+{
+    BlendStats stats;
+    f64 error = 0.0, membrane = 0.0;
+    for (size_t c = 0; c < result.images.size(); ++c) {
+        error += invalid.select(result.images[c] - reference.images[c], 0.0).squaredNorm();
+        membrane += invalid.select(reference.images[c] - replacement.images[c], 0.0).squaredNorm();
+        stats.max = std::max(stats.max, invalid.select((result.images[c] - reference.images[c]).cwiseAbs(), 0.0).maxCoeff());
+    }
+    auto num_values = (f64)(invalid.count() * (Eigen::Index)result.images.size());
+    stats.rms = std::sqrt(error / std::max(num_values, 1.0));
+    stats.relative = membrane > 0.0 ? std::sqrt(error / membrane) : 0.0;
+    return stats;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        spdlog::info("Usage: {} <folder (e.g. test_data/2019-05-22)> [replacement folder] [cloud probability threshold (default: 30)]", argv[0]);
+        spdlog::info("Without a replacement folder, the input bands with a different gain and offset are used as the replacement");
+        return -1;
+    }
+    fs::path folder(argv[1]);
+    std::optional<fs::path> replacement_folder;
+    if (argc > 2) {
+        replacement_folder = argv[2];
+    }
+    f64 threshold = argc > 3 ? std::stod(argv[3]) : 30.0;
+
+    std::vector<std::string> bands = { "B02", "B03", "B04", "B08" };
+    for (auto const& name : { "B02", "B03", "B04", "B08", "CLD", "SCL" }) {
+        if (!fs::exists(folder / fmt::format("{}.tif", name))) {
+            spdlog::error("{} does not exist", folder / fmt::format("{}.tif", name));
+            return -1;
+        }
+    }
+
+    GDALAllRegister();
+    MultiChannelImage input = read_bands(folder, bands);
+    MultiChannelImage replacement;
+    if (replacement_folder.has_value()) {
+        replacement = read_bands(*replacement_folder, bands);
+    } else {
+        replacement = input;
+        for (auto& image : replacement.images) {
+            image = (0.8 * image.array() + 0.1 * image.mean()).matrix();
+        }
+    }
+
+    MatX<bool> invalid = utils::read_cloud_mask(folder, threshold);
+    if (invalid.rows() != input.rows() || invalid.cols() != input.cols()) {
+        spdlog::error("The mask is {}x{}, but the bands are {}x{}", invalid.rows(), invalid.cols(), input.rows(), input.cols());
+        return -1;
+    }
+    spdlog::info("{}x{} image with {} bands, {} invalid pixels", input.rows(), input.cols(), bands.size(), invalid.count());
+
+    // The reference is solved far beyond the default tolerance
+    MultiChannelImage reference = input;
+    spdlog::stopwatch sw;
+    blend_images_poisson(reference, replacement, invalid, { .backend = SolverBackend::MultigridConjugateGradient, .tolerance = 1e-10 });
+    f64 reference_seconds = sw.elapsed().count();
+
+    MultiChannelImage conjugate_gradient = input;
+    sw.reset();
+    blend_images_poisson(conjugate_gradient, replacement, invalid, SolverOptions {});
+    f64 seconds = sw.elapsed().count();
+    BlendStats cg_stats = compare(conjugate_gradient, reference, replacement, invalid);
+    cg_stats.seconds = seconds;
+
+    MultiChannelImage pyramid = input;
+    sw.reset();
+    blend_images_poisson_pyramid(pyramid, replacement, invalid);
+    seconds = sw.elapsed().count();
+    BlendStats pyramid_stats = compare(pyramid, reference, replacement, invalid);
+    pyramid_stats.seconds = seconds;
+
+    MultiChannelImage quadtree = input;
+    sw.reset();
+    blend_images_poisson(quadtree, replacement, invalid, { .quadtree = QuadtreeOptions {} });
+    seconds = sw.elapsed().count();
+    BlendStats quadtree_stats = compare(quadtree, reference, replacement, invalid);
+    quadtree_stats.seconds = seconds;
+
+    spdlog::info("{:>22} {:>10} {:>14} {:>14} {:>10}", "blend", "seconds", "RMS error", "max error", "relative");
+    spdlog::info("{:>22} {:>10.3f} {:>14} {:>14} {:>10}", "reference (1e-10)", reference_seconds, "-", "-", "-");
+    spdlog::info("{:>22} {:>10.3f} {:>14.4e} {:>14.4e} {:>9.2f}%", "conjugate gradient", cg_stats.seconds, cg_stats.rms, cg_stats.max, 100.0 * cg_stats.relative);
+    spdlog::info("{:>22} {:>10.3f} {:>14.4e} {:>14.4e} {:>9.2f}%", "convolution pyramid", pyramid_stats.seconds, pyramid_stats.rms, pyramid_stats.max, 100.0 * pyramid_stats.relative);
+    spdlog::info("{:>22} {:>10.3f} {:>14.4e} {:>14.4e} {:>9.2f}%", "quadtree", quadtree_stats.seconds, quadtree_stats.rms, quadtree_stats.max, 100.0 * quadtree_stats.relative);
+
+    return 0;
+}
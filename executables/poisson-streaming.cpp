@@ -0,0 +1,54 @@
+#include <approx/streaming.h>
+#include <fmt/std.h>
+#include <gdal_priv.h>
+#include <spdlog/spdlog.h>
+#include <utils/geotiff.h>
+#include <utils/log.h>
+
+int main(int argc, char** argv)
+{
+    spdlog::set_level(spdlog::level::debug);
+    spdlog::info("Log folder: {}", utils::log_location());
+
+    if (argc < 5) {
+        spdlog::info("Usage: {} input_path replacement_path mask_path output_path [band rows (default: 256)]", argv[0]);
+        return -1;
+    }
+    fs::path input(argv[1]);
+    fs::path replacement(argv[2]);
+    fs::path mask(argv[3]);
+    fs::path output(argv[4]);
+
+    for (auto const& path : { input, replacement, mask }) {
+        if (!fs::exists(path)) {
+            spdlog::error("{} does not exist", path);
+            return -1;
+        }
+    }
+
+    GDALAllRegister();
+
+    // Only a band of rows of every image is kept in memory, so this works for scenes that do not fit in memory
+    approx::StreamingOptions options;
+    if (argc > 5) {
+        options.band_rows = std::stol(argv[5]);
+    }
+    // Every band of the input is blended
+    std::vector<int> bands;
+    {
+        utils::GeoTIFF<f64> tiff(input);
+        for (int band = 1; band <= tiff.band_count(); ++band) {
+            bands.push_back(band);
+        }
+    }
+    if (bands.empty()) {
+        spdlog::error("{} does not have any bands", input);
+        return -1;
+    }
+
+    spdlog::info("Starting streaming solver...");
+    auto result = approx::blend_images_poisson_streaming(input, replacement, mask, 1, bands, output, options);
+    spdlog::info("Finished: {} coarse unknowns, at most {} rows in memory, last pass changed pixels by at most {:.4e}",
+        result.coarse_unknowns, result.peak_rows, result.last_change);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "utils.h"
+
+namespace approx {
+/**
+ * Block conjugate gradient: solves A X = B for all the columns of B at the same time.
+ *
+ * Every iteration multiplies A with a block of search directions (one per column), so the matrix is streamed from
+ * memory once for all the columns instead of once per column. The columns share a Krylov space, which usually also
+ * reduces the number of iterations compared to solving each column separately.
+ * A diagonal (Jacobi) preconditioner is used, the same as Eigen's conjugate gradient.
+ *
+ * Each column has its own convergence criteria (|r| / |b| <= tolerance). Converged columns are removed from the block,
+ * and the block is restarted with the remaining columns. Columns that stop improving, or that make the block
+ * (numerically) rank deficient, are also removed and reported through needs_fallback(), so that the caller can solve
+ * them on their own.
+ */
+class BlockConjugateGradient {
+public:
+    BlockConjugateGradient() = default;
+    // The matrix is not copied, and must outlive the solver
+    explicit BlockConjugateGradient(sparse_t const& A);
+    void compute(sparse_t const& A);
+
+    /**
+     * @param B: The right hand sides (one per column)
+     * @param guesses: The initial guesses (one per column)
+     */
+    MatX<f64> solveWithGuess(MatX<f64> const& B, MatX<f64> const& guesses);
+
+    void setTolerance(f64 tolerance) { m_tolerance = tolerance; }
+    void setMaxIterations(long max_iterations) { m_max_iterations = max_iterations; }
+    // A column is removed from the block when its error has not improved for this many iterations
+    void setStagnationIterations(long iterations) { m_stagnation_iterations = iterations; }
+
+    // Success if every column converged
+    [[nodiscard]] Eigen::ComputationInfo info() const { return m_info; }
+    // Number of block iterations (each one multiplies A with all the active columns)
+    [[nodiscard]] long iterations() const { return m_iterations; }
+    // The relative error of each column
+    [[nodiscard]] VecX<f64> const& errors() const { return m_errors; }
+    // The columns that were removed from the block before they converged
+    [[nodiscard]] std::vector<Eigen::Index> const& needs_fallback() const { return m_fallback; }
+
+private:
+    sparse_t const* m_matrix = nullptr;
+    VecX<f64> m_inverse_diagonal;
+
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;
+    f64 m_tolerance = 1e-6;
+    long m_max_iterations = 100;
+    long m_stagnation_iterations = 50;
+    long m_iterations = 0;
+    VecX<f64> m_errors;
+    std::vector<Eigen::Index> m_fallback;
+};
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "stencil.h"
+#include "utils.h"
+
+#include <Eigen/SparseCholesky>
+#include <memory>
+
+namespace approx {
+using Factorization = Eigen::SimplicialLDLT<sparse_t>;
+
+/**
+ * Sparse direct solver (LDL^T) for the system of a region.
+ *
+ * The system only depends on the shape of the region (and the diagonal, which differs between the laplace and the
+ * poisson fills), so the factorization is cached, keyed by a hash of the unknowns and the diagonal. Filling the same
+ * mask again (the other bands of an image, or a different replacement image) reuses the factorization, and does not
+ * even assemble the matrix.
+ */
+class CholeskySolver {
+public:
+    explicit CholeskySolver(StencilSystem const& system);
+
+    // The guess is ignored: the solution is computed directly
+    VecX<f64> solveWithGuess(VecX<f64> const& b, VecX<f64> const& guess) const;
+    // Solve for all the columns at once
+    MatX<f64> solve(MatX<f64> const& B) const;
+
+    [[nodiscard]] Eigen::ComputationInfo info() const { return m_info; }
+    [[nodiscard]] long iterations() const { return 0; }
+    [[nodiscard]] f64 error() const { return 0.0; }
+    // True if the factorization was found in the cache
+    [[nodiscard]] bool cached() const { return m_cached; }
+
+private:
+    std::shared_ptr<Factorization const> m_factorization;
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;
+    bool m_cached = false;
+};
+
+std::size_t hash_system(StencilSystem const& system);
+
+// The memory (in bytes) that the cached factorizations may take by default
+inline constexpr std::size_t default_factorization_cache_capacity = std::size_t(1) << 30;
+
+// Remove all the cached factorizations
+void clear_factorization_cache();
+// The memory (in bytes) that the cached factorizations may take. The least recently used factorizations are removed
+// first, and a factorization that is larger than the whole capacity is not cached
+void set_factorization_cache_capacity(std::size_t bytes);
+// The number of cached factorizations, and the memory they take (in bytes)
+std::size_t factorization_cache_size();
+std::size_t factorization_cache_bytes();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "utils.h"
+
+#include <vector>
+
+namespace approx {
+/**
+ * The filters of a convolution pyramid (Farbman, Fattal and Lischinski, "Convolution Pyramids", 2011).
+ * Every filter is separable and symmetric, so only one dimension is stored
+ */
+struct PyramidKernels {
+    // Applied to a level before it is downsampled
+    std::vector<f64> analysis;
+    // Applied to a coarser level after it is upsampled (with zeros)
+    std::vector<f64> synthesis;
+    // Applied to every level, and added to the upsampled coarser level
+    std::vector<f64> skip;
+};
+
+// 5x5 filters for membrane (boundary) interpolation: the normalized convolution of the values on the boundary of a
+// region (divided by the convolution of the boundary itself) approximates the harmonic interpolation of the values
+PyramidKernels membrane_kernels();
+
+/**
+ * Approximate the convolution of an image with a large kernel (the image is zero outside of its bounds).
+ * Every level is filtered with the small kernels and downsampled, and the levels are then upsampled, filtered and added
+ * back together. This takes linear time in the number of pixels
+ */
+MatX<f64> convolution_pyramid(MatX<f64> const& image, PyramidKernels const& kernels);
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <boost/date_time/gregorian/gregorian.hpp>
+#include <optional>
 #include <utils/date.h>
 #include <utils/db.h>
 #include <utils/types.h>
@@ -21,18 +22,27 @@ enum class ApproxMethod {
     Poisson
 };
 
+// A band that was written by the approximation of a date
+struct ApproxResult {
+    date_time::date date;
+    int id = 0;
+};
+
 class DataBase : public utils::DataBase {
 public:
     explicit DataBase(fs::path base_path);
 
     int write_approx_results(std::string const& date_string, std::string const &band_name, ApproxMethod method);
     std::unordered_map<std::string, int> get_approx_status(std::string const& date_string, ApproxMethod method);
+    // The most recent approximation of the band that is older than the date
+    std::optional<ApproxResult> select_previous_approx(std::string const& date_string, std::string const& band_name, ApproxMethod method);
     std::vector<DayInfo> select_close_images(std::string const& date_string);
     DayInfo select_info_about_date(std::string const& date_string);
 
 private:
     std::unique_ptr<SQLite::Statement> stmt_select = nullptr;
     std::unique_ptr<SQLite::Statement> stmt_insert = nullptr;
+    std::unique_ptr<SQLite::Statement> stmt_select_previous = nullptr;
 
     void create_approx_table();
 };
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "solver.h"
+#include "stencil.h"
+#include "utils.h"
+
+namespace approx {
+/**
+ * Time the direct solver against multigrid preconditioned conjugate gradient (solving to the tolerance) on synthetic
+ * square and thin regions, and put the thresholds where multigrid becomes faster. Takes around a second
+ */
+DispatchThresholds calibrate_dispatch(f64 tolerance = 1e-6);
+
+// The thresholds used by SolverBackend::Automatic for fills with this tolerance. They are calibrated the first time
+// for every tolerance, unless they were set. The fills look them up once, and hand them to the solver of every region
+// in SolverOptions::dispatch
+DispatchThresholds dispatch_thresholds(f64 tolerance);
+// Use these thresholds for every tolerance
+void set_dispatch_thresholds(DispatchThresholds const& thresholds);
+
+// The backend for the system of a single region
+SolverBackend select_backend(StencilSystem const& system, DispatchThresholds const& thresholds);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "utils.h"
+
+#include <vector>
+
+namespace approx {
+/**
+ * Solves the Poisson equation on a rectangle with zero values outside of it in O(N log N). The sine transform
+ * (DST-I) of the rows and the columns diagonalizes the 5-point Laplacian of the rectangle (4 on the diagonal, -1 for
+ * every neighbour inside of the rectangle), so the solve is two transforms and a division by the eigenvalues.
+ */
+class SineTransformSolver {
+public:
+    SineTransformSolver() = default;
+    SineTransformSolver(Eigen::Index rows, Eigen::Index cols);
+
+    // b and the result are rows x cols
+    [[nodiscard]] MatX<f64> solve(MatX<f64> const& b) const;
+
+    [[nodiscard]] Eigen::Index rows() const { return m_eigenvalues.rows(); }
+    [[nodiscard]] Eigen::Index cols() const { return m_eigenvalues.cols(); }
+
+private:
+    MatX<f64> m_eigenvalues;
+};
+
+// The smallest size of at least `size` with a fast sine transform. The transform of n values is a Fourier transform of
+// 2 (n + 1) values, which is only fast if n + 1 has small prime factors (2, 3 and 5)
+Eigen::Index fast_sine_transform_size(Eigen::Index size);
+
+/**
+ * The sine transform solver as a preconditioner for Eigen's iterative solvers, for regions of any shape: the residual
+ * is placed on the bounding rectangle of the region (zero outside of the region), solved on the rectangle, and the
+ * solution is read back at the unknowns. The rectangle is grown to a fast transform size. The closer the region is to
+ * its bounding rectangle, the fewer iterations conjugate gradient needs.
+ */
+class SineTransformPreconditioner {
+public:
+    using Scalar = f64;
+    using StorageIndex = sparse_t::StorageIndex;
+    enum {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic
+    };
+
+    SineTransformPreconditioner() = default;
+
+    // The pixel of every unknown, in the order of the matrix
+    void set_unknowns(std::vector<index_t> unknowns) { m_unknowns = std::move(unknowns); }
+
+    template<typename MatType>
+    SineTransformPreconditioner& analyzePattern(MatType const&)
+    {
+        return *this;
+    }
+
+    template<typename MatType>
+    SineTransformPreconditioner& factorize(MatType const& mat)
+    {
+        setup(mat.rows());
+        return *this;
+    }
+
+    template<typename MatType>
+    SineTransformPreconditioner& compute(MatType const& mat)
+    {
+        return factorize(mat);
+    }
+
+    template<typename Rhs>
+    VecX<f64> solve(Eigen::MatrixBase<Rhs> const& b) const
+    {
+        return apply(VecX<f64>(b));
+    }
+
+    [[nodiscard]] Eigen::ComputationInfo info() const { return m_info; }
+    [[nodiscard]] Eigen::Index rows() const { return (Eigen::Index)m_unknowns.size(); }
+    [[nodiscard]] Eigen::Index cols() const { return (Eigen::Index)m_unknowns.size(); }
+
+private:
+    std::vector<index_t> m_unknowns;
+    // The top-left corner of the bounding rectangle
+    index_t m_origin = { 0, 0 };
+    SineTransformSolver m_solver;
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;
+
+    void setup(Eigen::Index rows);
+    VecX<f64> apply(VecX<f64> const& b) const;
+};
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "solver.h"
 #include "utils.h"
 
 #include <filesystem>
@@ -11,21 +12,89 @@ namespace approx {
 struct ConnectedComponents {
     MatX<int> matrix;
     std::unordered_map<int, std::vector<index_t>> region_map;
+
+    // Region labels, ordered from the largest region to the smallest
+    [[nodiscard]] std::vector<int> labels_by_size() const;
 };
 
+/**
+ * Find all the invalid pixels that are connected (4-neighbourhood) to a starting pixel
+ * @param invalid: a binary image with true == pixel is invalid
+ * @param row: The row of the starting pixel
+ * @param col: The column of the starting pixel
+ * @returns: The connected pixels, or an empty list if the starting pixel is valid
+ */
+std::vector<index_t> flood(MatX<bool> const& invalid, Eigen::Index row, Eigen::Index col);
+
 /**
  * Find the portions of an image that are connected to each other
  * @param image: a binary image with true == pixel is invalid
+ * @returns: A label for each pixel (0 == valid, 1..n == region number) and the pixels of each region in raster order
  */
 ConnectedComponents find_connected_components(MatX<bool> const& invalid);
 
 /** Fill a missing region of an image, assuming that boundary of the image is smooth
  * (Laplace equation with dirichlet boundary conditions)
+ * Each connected region is solved as a separate system, and the regions are solved concurrently.
  * @param input_image: The input image
  * @param invalid_mask: A mask identifying what portions of the image are invalid
- * @returns: A matrix representing approximation status for each region
+ * @param options: Which solver to use for each region, and when to stop iterating (or the time budget)
+ * @returns: Whether every region converged (or the time budget ran out), and the largest residual
+ */
+FillResult fill_missing_portion_smooth_boundary(MatX<f64>& input_image, MatX<bool> const& invalid_pixels, SolverOptions const& options = {});
+// Single precision images. The system is still solved in f64, unless a lower precision is selected in the options
+FillResult fill_missing_portion_smooth_boundary(MatX<f32>& input_image, MatX<bool> const& invalid_pixels, SolverOptions const& options = {});
+
+/** Fill the same missing region in every channel of a multi-band image
+ * The system of each region only depends on the mask, so it is set up once and then solved for every channel
+ * @param input_images: The channels of the input image. The values are replaced in place
+ * @param invalid_mask: A mask identifying what portions of the image are invalid (shared by all channels)
+ * @param options: Which solver to use for each region, and when to stop iterating (or the time budget)
+ */
+FillResult fill_missing_portion_smooth_boundary(MultiChannelImage& input_images, MatX<bool> const& invalid_pixels, SolverOptions const& options = {});
+FillResult fill_missing_portion_smooth_boundary(MultiChannelImageF32& input_images, MatX<bool> const& invalid_pixels, SolverOptions const& options = {});
+std::vector<MatX<f64>> fill_missing_portion_smooth_boundary(std::vector<MatX<f64>> const& input_images, MatX<bool> const& invalid_pixels, SolverOptions const& options = {});
+std::vector<MatX<f32>> fill_missing_portion_smooth_boundary(std::vector<MatX<f32>> const& input_images, MatX<bool> const& invalid_pixels, SolverOptions const& options = {});
+
+struct SORFillOptions {
+    // Over-relaxation factor, between 0 and 2. By default, the optimal factor for the bounding box of the region
+    std::optional<f64> omega;
+    // Stop once the relative residual |b - Ax| / |b| is below the tolerance (the same criteria as the sparse solvers)
+    f64 tolerance = 1e-6;
+    long max_sweeps = 2000;
+    // Computing the residual costs about as much as a sweep, so it is only checked every few sweeps
+    long check_every = 10;
+};
+
+struct SORFillResult {
+    long sweeps = 0;
+    f64 error = 0.0;
+    bool converged = false;
+};
+
+/** Fill a missing region of an image with red-black successive over-relaxation, directly on the image grid
+ * Solves the same equations as fill_missing_portion_smooth_boundary (the pixels on the border of the image are
+ * treated as known), but never builds a system. This is faster for thin regions (cloud edges, shadow slivers), where
+ * only a few hundred sweeps are needed. The invalid pixels start from their current values (zero if not finite).
+ * @param input_image: The input image
+ * @param invalid_pixels: A mask identifying what portions of the image are invalid
+ * @param options: Relaxation factor and stopping criteria
+ */
+SORFillResult fill_missing_portion_sor(MatX<f64>& input_image, MatX<bool> const& invalid_pixels, SORFillOptions const& options = {});
+
+/** Fill the missing regions of an image with pull-push pyramid interpolation
+ * The known pixels are averaged (weighted by how much of each pixel is known) into levels of half the resolution, and
+ * the holes are filled from the coarser levels on the way back up. The result is smooth but not harmonic. It takes
+ * linear time and no linear solve, so it is meant for quick looks at whole scenes, or as the starting point of the
+ * solvers (SolverOptions::pull_push_guess). Unlike the other fills, invalid pixels on the border of the image are filled
+ * @param input_image: The input image. The invalid pixels are replaced in place
+ * @param invalid_pixels: A mask identifying what portions of the image are invalid (shared by all channels)
  */
-void fill_missing_portion_smooth_boundary(MatX<f64>& input_image, MatX<bool> const& invalid_pixels);
+void fill_missing_portion_pull_push(MatX<f64>& input_image, MatX<bool> const& invalid_pixels);
+void fill_missing_portion_pull_push(MatX<f32>& input_image, MatX<bool> const& invalid_pixels);
+void fill_missing_portion_pull_push(MultiChannelImage& input_images, MatX<bool> const& invalid_pixels);
+void fill_missing_portion_pull_push(MultiChannelImageF32& input_images, MatX<bool> const& invalid_pixels);
+std::vector<MatX<f64>> fill_missing_portion_pull_push(std::vector<MatX<f64>> const& input_images, MatX<bool> const& invalid_pixels);
 
 // Apply the laplace equation to an image.
 cv::Mat apply_laplace(cv::Mat const &image, cv::Mat const &invalid_region, f64 red_threshold);
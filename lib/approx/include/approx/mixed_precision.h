@@ -0,0 +1,77 @@
+#pragma once
+
+#include "stencil.h"
+#include "utils.h"
+
+#include <Eigen/IterativeLinearSolvers>
+#include <memory>
+
+namespace approx {
+enum class Precision {
+    // Everything in f64
+    Double,
+    // The matrix and the conjugate gradient iterations are f32. The f32 iterations stall at a relative residual of
+    // about 1e-5, so tighter tolerances are loosened to single_precision_tolerance
+    Single,
+    // f32 conjugate gradient, corrected with f64 iterative refinement until the tolerance is reached
+    Mixed
+};
+
+// The tightest tolerance of a single precision solve
+inline constexpr f64 single_precision_tolerance = 1e-4;
+
+/**
+ * Conjugate gradient (with a diagonal preconditioner) in single precision, which halves the memory traffic of every
+ * iteration. The regions that fit the matrix-free solver iterate on f32 grids (StencilConjugateGradientF32), without
+ * a matrix. The others (see fits_matrix_free) iterate on a single precision copy of the matrix.
+ *
+ * The f32 solver only has to reduce the error by a few orders of magnitude at a time: the residual b - A x is computed
+ * in f64, the correction is solved for in f32, and the two steps are repeated until the f64 residual is below the
+ * tolerance. With single precision this usually takes a single correction, with mixed precision a few.
+ */
+class MixedPrecisionSolver {
+public:
+    using sparse_f32_t = Eigen::SparseMatrix<f32>;
+
+    // The f64 residuals are computed with the f64 kernels, or with the f32 copy of the matrix. The stencils only have
+    // small integer coefficients, which are exact in f32, and an f64 copy is only kept if some coefficient is not exact
+    MixedPrecisionSolver(StencilSystem const& system, Precision precision);
+
+    VecX<f64> solveWithGuess(VecX<f64> const& b, VecX<f64> const& guess);
+
+    void setTolerance(f64 tolerance) { m_tolerance = tolerance; }
+    void setMaxIterations(long max_iterations) { m_max_iterations = max_iterations; }
+
+    [[nodiscard]] Eigen::ComputationInfo info() const { return m_info; }
+    // The total number of (f32) conjugate gradient iterations
+    [[nodiscard]] long iterations() const { return m_iterations; }
+    [[nodiscard]] f64 error() const { return m_error; }
+    // The number of f64 corrections of the last solve
+    [[nodiscard]] long refinements() const { return m_refinements; }
+
+    // b - A x, in f64
+    [[nodiscard]] VecX<f64> residual(VecX<f64> const& b, VecX<f64> const& x) const;
+
+private:
+    // Solve A correction = r in f32, to a relative residual of tolerance
+    VecX<f64> solve_correction(VecX<f64> const& r, f64 tolerance, long max_iterations, long& iterations);
+
+    // Null for the regions that iterate on the matrix
+    std::unique_ptr<StencilConjugateGradientF32> m_stencil_solver;
+    StencilKernels<f64, Boundary::Neumann> m_kernels;
+
+    sparse_f32_t m_matrix_f32;
+    bool m_exact = false;
+    // Empty if the f32 copy is exact
+    sparse_t m_matrix;
+    Eigen::ConjugateGradient<sparse_f32_t, Eigen::Lower | Eigen::Upper> m_solver;
+    Precision m_precision;
+
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;
+    f64 m_tolerance = 1e-6;
+    long m_max_iterations = 100;
+    long m_iterations = 0;
+    long m_refinements = 0;
+    f64 m_error = 0.0;
+};
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "utils.h"
+
+#include <Eigen/SparseCholesky>
+#include <algorithm>
+
+namespace approx {
+enum class MultigridCycle {
+    V,
+    W
+};
+
+struct MultigridOptions {
+    MultigridCycle cycle = MultigridCycle::V;
+    int pre_smoothing = 2;
+    int post_smoothing = 2;
+    // Coarsening stops once a level has fewer unknowns than this, and that level is solved directly
+    long coarsest_size = 256;
+};
+
+/**
+ * Geometric multigrid for the masked systems created by the laplace and poisson fills.
+ *
+ * Every level halves the resolution of the image grid. A coarse cell is only an unknown if one of its (2x2) fine
+ * pixels is an unknown, and the interpolation between levels only uses coarse cells that are unknowns, so the
+ * restriction (the transpose of the interpolation) never mixes values from outside of the mask.
+ * The coarse operators are computed as P^T A P, so every level stays symmetric positive definite.
+ * Gauss-Seidel is used as the smoother (forward before and backward after the coarse grid correction). The cycle is
+ * only symmetric if there are as many pre-smoothing as post-smoothing sweeps, which MultigridPreconditioner enforces.
+ */
+class Multigrid {
+public:
+    Multigrid() = default;
+
+    /**
+     * Build the multigrid hierarchy
+     * @param A: The system matrix (symmetric positive definite)
+     * @param unknowns: The pixel that each unknown (row/column of A) belongs to
+     */
+    Multigrid(sparse_t const& A, std::vector<index_t> const& unknowns, MultigridOptions options = {});
+    void compute(sparse_t const& A, std::vector<index_t> const& unknowns, MultigridOptions options = {});
+
+    // Apply a single cycle to improve the solution x of Ax = b
+    void cycle(VecX<f64> const& b, VecX<f64>& x) const;
+
+    // Solve Ax = b by repeating cycles until the relative residual is below the tolerance
+    VecX<f64> solveWithGuess(VecX<f64> const& b, VecX<f64> const& guess);
+
+    void setTolerance(f64 tolerance) { m_tolerance = tolerance; }
+    void setMaxIterations(long max_iterations) { m_max_iterations = max_iterations; }
+
+    [[nodiscard]] Eigen::ComputationInfo info() const { return m_info; }
+    [[nodiscard]] long iterations() const { return m_iterations; }
+    [[nodiscard]] f64 error() const { return m_error; }
+    [[nodiscard]] size_t levels() const { return m_levels.size(); }
+    [[nodiscard]] Eigen::Index rows() const { return m_levels.empty() ? 0 : m_levels.front().A.rows(); }
+    [[nodiscard]] Eigen::Index cols() const { return rows(); }
+
+private:
+    struct Level {
+        sparse_t A;
+        VecX<f64> inverse_diagonal;
+        // Interpolation from the next (coarser) level into this level
+        sparse_t prolongation;
+    };
+
+    std::vector<Level> m_levels;
+    Eigen::SimplicialLDLT<sparse_t> m_coarse_solver;
+    MultigridOptions m_options;
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;
+
+    f64 m_tolerance = 1e-6;
+    long m_max_iterations = 100;
+    long m_iterations = 0;
+    f64 m_error = 0.0;
+
+    void cycle(size_t level, VecX<f64> const& b, VecX<f64>& x) const;
+    void smooth(Level const& level, VecX<f64> const& b, VecX<f64>& x, bool forward) const;
+};
+
+/**
+ * A single multigrid cycle as a preconditioner for Eigen's iterative solvers. Conjugate gradient needs a symmetric
+ * preconditioner, so both smoothing counts are set to the larger of the two. E.g.:
+ *     Eigen::ConjugateGradient<sparse_t, Eigen::Lower | Eigen::Upper, MultigridPreconditioner> solver;
+ *     solver.preconditioner().set_unknowns(unknowns);
+ *     solver.compute(A);
+ */
+class MultigridPreconditioner {
+public:
+    using Scalar = f64;
+    using StorageIndex = sparse_t::StorageIndex;
+    enum {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic
+    };
+
+    MultigridPreconditioner() = default;
+
+    void set_unknowns(std::vector<index_t> unknowns, MultigridOptions options = {})
+    {
+        m_unknowns = std::move(unknowns);
+        m_options = options;
+        m_options.pre_smoothing = m_options.post_smoothing = std::max(options.pre_smoothing, options.post_smoothing);
+    }
+
+    template<typename MatType>
+    MultigridPreconditioner& analyzePattern(MatType const&)
+    {
+        return *this;
+    }
+
+    template<typename MatType>
+    MultigridPreconditioner& factorize(MatType const& mat)
+    {
+        m_multigrid.compute(sparse_t(mat), m_unknowns, m_options);
+        return *this;
+    }
+
+    template<typename MatType>
+    MultigridPreconditioner& compute(MatType const& mat)
+    {
+        return factorize(mat);
+    }
+
+    template<typename Rhs>
+    VecX<f64> solve(Eigen::MatrixBase<Rhs> const& b) const
+    {
+        VecX<f64> x = VecX<f64>::Zero(b.rows());
+        m_multigrid.cycle(b, x);
+        return x;
+    }
+
+    [[nodiscard]] Eigen::ComputationInfo info() const { return m_multigrid.info(); }
+    [[nodiscard]] Eigen::Index rows() const { return m_multigrid.rows(); }
+    [[nodiscard]] Eigen::Index cols() const { return m_multigrid.cols(); }
+
+private:
+    std::vector<index_t> m_unknowns;
+    MultigridOptions m_options;
+    Multigrid m_multigrid;
+};
+}
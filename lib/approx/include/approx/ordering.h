@@ -0,0 +1,29 @@
+#pragma once
+
+#include "stencil.h"
+#include "utils.h"
+
+#include <vector>
+
+namespace approx {
+enum class UnknownOrdering {
+    // The order of the pixels of the region (the order the unknowns were found in)
+    Raster,
+    // Z-order over the pixels, so unknowns that are close in the image are (mostly) close in the vector
+    Morton,
+    // Reverse Cuthill-McKee on the graph of the matrix, which minimizes the bandwidth of the matrix
+    ReverseCuthillMcKee
+};
+
+/**
+ * The new order of the unknowns of a system: the unknown at position i of the reordered system is order[i] of the
+ * original system.
+ */
+std::vector<Eigen::Index> unknown_order(StencilSystem const& system, UnknownOrdering ordering);
+
+// The system with its unknowns (and diagonal) in the given order
+StencilSystem reorder(StencilSystem const& system, std::vector<Eigen::Index> const& order);
+
+// The largest distance between a non-zero entry and the diagonal of the matrix
+Eigen::Index bandwidth(sparse_t const& A);
+}
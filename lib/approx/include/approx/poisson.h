@@ -1,6 +1,8 @@
 #pragma once
 
 #include "db.h"
+#include "solver.h"
+#include "tuning.h"
 #include "utils.h"
 
 #include <utils/types.h>
@@ -9,41 +11,65 @@ namespace date_time = boost::gregorian;
 using namespace utils;
 
 namespace approx {
-struct PerfInfo {
-    long region_size = 0;
-    f64 tolerance = 0.0;
-    long max_iterations = 0;
-    long iterations = 0;
-    f64 error = 0.0;
-    f64 solve_time = 0.0;
-
-    void write(fs::path const& output) const;
-};
-
 /**
  * Blend two images together using the poisson equation.
  * @param input_images: The original image(s)
  * @param replacement_images: New image(s) that we want to blend with the original image(s).
  * @param start_row: An offset into the original image, representing the row where replacement should start
  * @param start_column: An offset into the original image, representing the column where replacement should start
+ * @param options: The tolerance and the maximum number of iterations of the solve. A replacement region that is a
+ * rectangle surrounded by the original image is solved directly (with the sine transform), any other region with
+ * conjugate gradient, preconditioned with the sine transform
  */
 void blend_images_poisson(
     MultiChannelImage& input_images,
     MultiChannelImage const& replacement_images,
-    int start_row, int start_column);
+    int start_row, int start_column,
+    SolverOptions const& options = {});
 
 /**
  * Blend two images together using the poisson equation.
  * @param input_images: The original image(s)
  * @param replacement_images: New image(s) that we want to blend with the original image(s).
  * @param invalid_mask: A mask with true at places where the pixels in the original image are invalid, and false where the pixels are determined to be valid
+ * @param options: Which solver to use for each region, and when to stop iterating (or the time budget)
+ * @returns: Whether every region converged (or the time budget ran out), and the largest residual
  */
+FillResult blend_images_poisson(
+    MultiChannelImage& input_images,
+    MultiChannelImage const& replacement_images,
+    MatX<bool> const& invalid_mask,
+    SolverOptions const& options);
+// Start the iterative solvers from warm_start (e.g. an earlier result for the same area) instead of the replacement image.
+// The direct solver does not use a guess
+FillResult blend_images_poisson(
+    MultiChannelImage& input_images,
+    MultiChannelImage const& replacement_images,
+    MatX<bool> const& invalid_mask,
+    MultiChannelImage const& warm_start,
+    SolverOptions const& options);
+// Single precision images. The system is still solved in f64, unless a lower precision is selected in the options
+FillResult blend_images_poisson(
+    MultiChannelImageF32& input_images,
+    MultiChannelImageF32 const& replacement_images,
+    MatX<bool> const& invalid_mask,
+    SolverOptions const& options);
 void blend_images_poisson(
     MultiChannelImage& input_images,
     MultiChannelImage const& replacement_images,
     MatX<bool> const& invalid_mask,
     f64 tolerance = 1e-6,
     std::optional<int> max_iterations = {});
+std::vector<MatX<f64>> blend_images_poisson(
+    std::vector<MatX<f64>> const& input_images,
+    std::vector<MatX<f64>> const& replacement_images,
+    MatX<bool> const& invalid_mask,
+    SolverOptions const& options);
+std::vector<MatX<f32>> blend_images_poisson(
+    std::vector<MatX<f32>> const& input_images,
+    std::vector<MatX<f32>> const& replacement_images,
+    MatX<bool> const& invalid_mask,
+    SolverOptions const& options);
 std::vector<MatX<f64>> blend_images_poisson(
     std::vector<MatX<f64>> const& input_images,
     std::vector<MatX<f64>> const& replacement_images,
@@ -51,8 +77,56 @@ std::vector<MatX<f64>> blend_images_poisson(
     f64 tolerance = 1e-6,
     std::optional<int> max_iterations = {});
 
+
+/**
+ * Approximate blend_images_poisson without a linear solve, for bulk runs where a small error is acceptable.
+ * The differences between the images on the boundary of the mask are interpolated into the mask with a convolution
+ * pyramid (Farbman et al. 2011, see convolution_pyramid.h), and added to the replacement image. Takes linear time
+ * @param input_images: The original image(s). The masked pixels are replaced in place
+ * @param replacement_images: The image(s) that the gradients inside of the mask come from
+ * @param invalid_mask: The pixels to replace (shared by all channels)
+ */
+void blend_images_poisson_pyramid(MultiChannelImage& input_images, MultiChannelImage const& replacement_images, MatX<bool> const& invalid_mask);
+void blend_images_poisson_pyramid(MultiChannelImageF32& input_images, MultiChannelImageF32 const& replacement_images, MatX<bool> const& invalid_mask);
+std::vector<MatX<f64>> blend_images_poisson_pyramid(
+    std::vector<MatX<f64>> const& input_images,
+    std::vector<MatX<f64>> const& replacement_images,
+    MatX<bool> const& invalid_mask);
+
 void highlight_area_replaced(MultiChannelImage& input_images, MultiChannelImage const& replacement_images, int start_row, int start_col, Vec3<f64> const& color);
 
+// Where the approximation of a folder writes a band: <base_folder>/<date>/approximated_data/<band>_<id>.tif
+fs::path approximated_band_path(fs::path const& base_folder, date_time::date const& date, std::string const& band_name, int id);
+
+/**
+ * Record an approximated band in the approximated_data table, and write it to its approximated_band_path, where
+ * find_warm_start looks for it when a later date is approximated
+ * @param template_path: The input band, whose size and georeferencing are copied
+ * @return The path of the written band
+ */
+fs::path write_approximated_band(
+    DataBase& db,
+    fs::path const& base_folder,
+    std::string const& date_string,
+    std::string const& band_name,
+    MatX<f64> const& values,
+    fs::path const& template_path,
+    ApproxMethod method = ApproxMethod::Poisson);
+
+/**
+ * The most recent approximated result (older than the date) of every band, to warm start the blend of the date with.
+ * Nothing is returned unless every band has an earlier result (see write_approximated_band), and all the results are
+ * the same size
+ * @param db: The approximated_data table of the database tells which results exist
+ * @param base_folder: The folder with a sub-folder for every date
+ */
+std::optional<MultiChannelImage> find_warm_start(
+    DataBase& db,
+    fs::path const& base_folder,
+    std::string const& date_string,
+    std::vector<std::string> const& band_names,
+    ApproxMethod method = ApproxMethod::Poisson);
+
 /**
  * Find a good image that is close to the current image, but
  * @param date_string
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "utils.h"
+
+#include <Eigen/SparseCholesky>
+#include <memory>
+#include <vector>
+
+namespace approx {
+enum class Preconditioner {
+    // The inverse of the diagonal (Eigen's default)
+    Jacobi,
+    // Incomplete Cholesky factorization without fill-in (Eigen::IncompleteCholesky)
+    IncompleteCholesky,
+    // Symmetric successive over-relaxation
+    SSOR,
+    // Exact solves over blocks of consecutive unknowns
+    BlockJacobi,
+    // Exact solves over overlapping tiles of the region, in parallel, with a coarse correction
+    AdditiveSchwarz,
+    // An exact solve on the bounding rectangle of the region with the sine transform (see fast_poisson.h)
+    SineTransform
+};
+
+struct PreconditionerOptions {
+    Preconditioner type = Preconditioner::Jacobi;
+    // Relaxation factor of SSOR, between 0 and 2
+    f64 omega = 1.0;
+    // The number of consecutive unknowns in each block of block-Jacobi. The unknowns are in raster order, so a block
+    // covers a few rows of the region
+    long block_size = 256;
+    // The size of the tiles of additive Schwarz (in pixels), and the number of pixels every tile is extended by on
+    // each side. Regions with more unknowns than a tile are solved one at a time, so the tiles can use all the threads
+    long tile_size = 128;
+    long overlap = 8;
+};
+
+/**
+ * Symmetric successive over-relaxation as a preconditioner for Eigen's iterative solvers, e.g.:
+ *     Eigen::ConjugateGradient<sparse_t, Eigen::Lower | Eigen::Upper, SSORPreconditioner> solver;
+ *     solver.preconditioner().set_omega(1.2);
+ *     solver.compute(A);
+ * With A = L + D + L^T, the preconditioner is M = (D + w L) D^-1 (D + w L^T) / (w (2 - w)), which is applied as
+ *     M^-1 = (2 - w) (D / w + L^T)^-1 (D / w) (D / w + L)^-1
+ * The factor w (2 - w) scales M so that it is A itself for w = 1 when L is zero.
+ */
+class SSORPreconditioner {
+public:
+    using Scalar = f64;
+    using StorageIndex = sparse_t::StorageIndex;
+    enum {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic
+    };
+
+    SSORPreconditioner() = default;
+
+    void set_omega(f64 omega) { m_omega = omega; }
+
+    template<typename MatType>
+    SSORPreconditioner& analyzePattern(MatType const&)
+    {
+        return *this;
+    }
+
+    template<typename MatType>
+    SSORPreconditioner& factorize(MatType const& mat)
+    {
+        setup(sparse_t(mat));
+        return *this;
+    }
+
+    template<typename MatType>
+    SSORPreconditioner& compute(MatType const& mat)
+    {
+        return factorize(mat);
+    }
+
+    template<typename Rhs>
+    VecX<f64> solve(Eigen::MatrixBase<Rhs> const& b) const
+    {
+        return apply(VecX<f64>(b));
+    }
+
+    [[nodiscard]] Eigen::ComputationInfo info() const { return m_info; }
+    [[nodiscard]] Eigen::Index rows() const { return m_lower.rows(); }
+    [[nodiscard]] Eigen::Index cols() const { return m_lower.cols(); }
+
+private:
+    f64 m_omega = 1.0;
+    // D / w + L
+    sparse_t m_lower;
+    VecX<f64> m_diagonal;
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;
+
+    void setup(sparse_t const& A);
+    VecX<f64> apply(VecX<f64> const& b) const;
+};
+
+/**
+ * Block-Jacobi as a preconditioner for Eigen's iterative solvers. The unknowns are split into blocks of consecutive
+ * unknowns, every coefficient that couples two different blocks is dropped, and the resulting block diagonal matrix
+ * is factorized (LDL^T) once. Applying the preconditioner solves every block exactly.
+ */
+class BlockJacobiPreconditioner {
+public:
+    using Scalar = f64;
+    using StorageIndex = sparse_t::StorageIndex;
+    enum {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic
+    };
+
+    BlockJacobiPreconditioner() = default;
+
+    void set_block_size(long block_size) { m_block_size = block_size; }
+
+    template<typename MatType>
+    BlockJacobiPreconditioner& analyzePattern(MatType const&)
+    {
+        return *this;
+    }
+
+    template<typename MatType>
+    BlockJacobiPreconditioner& factorize(MatType const& mat)
+    {
+        setup(sparse_t(mat));
+        return *this;
+    }
+
+    template<typename MatType>
+    BlockJacobiPreconditioner& compute(MatType const& mat)
+    {
+        return factorize(mat);
+    }
+
+    template<typename Rhs>
+    VecX<f64> solve(Eigen::MatrixBase<Rhs> const& b) const
+    {
+        return m_blocks.solve(b);
+    }
+
+    [[nodiscard]] Eigen::ComputationInfo info() const { return m_blocks.info(); }
+    [[nodiscard]] Eigen::Index rows() const { return m_blocks.rows(); }
+    [[nodiscard]] Eigen::Index cols() const { return m_blocks.cols(); }
+
+private:
+    long m_block_size = 256;
+    Eigen::SimplicialLDLT<sparse_t> m_blocks;
+
+    void setup(sparse_t const& A);
+};
+
+/**
+ * Two-level additive Schwarz as a preconditioner for Eigen's iterative solvers. The region is split into square tiles
+ * of the image, and every tile is extended by the overlap on each side. Applying the preconditioner solves every
+ * extended tile exactly (with zero boundary values), in parallel, and adds up the solutions. A coarse correction with
+ * one value per tile spreads the solution between the tiles, so the number of iterations does not grow much with the
+ * number of tiles. Both parts are symmetric, so it can be used by conjugate gradient.
+ */
+class SchwarzPreconditioner {
+public:
+    using Scalar = f64;
+    using StorageIndex = sparse_t::StorageIndex;
+    enum {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic
+    };
+
+    SchwarzPreconditioner() = default;
+
+    // The pixel of every unknown, in the order of the matrix
+    void set_unknowns(std::vector<index_t> unknowns, long tile_size, long overlap)
+    {
+        m_unknowns = std::move(unknowns);
+        m_tile_size = tile_size;
+        m_overlap = overlap;
+    }
+
+    template<typename MatType>
+    SchwarzPreconditioner& analyzePattern(MatType const&)
+    {
+        return *this;
+    }
+
+    template<typename MatType>
+    SchwarzPreconditioner& factorize(MatType const& mat)
+    {
+        setup(sparse_t(mat));
+        return *this;
+    }
+
+    template<typename MatType>
+    SchwarzPreconditioner& compute(MatType const& mat)
+    {
+        return factorize(mat);
+    }
+
+    template<typename Rhs>
+    VecX<f64> solve(Eigen::MatrixBase<Rhs> const& b) const
+    {
+        return apply(VecX<f64>(b));
+    }
+
+    [[nodiscard]] Eigen::ComputationInfo info() const { return m_info; }
+    [[nodiscard]] Eigen::Index rows() const { return m_rows; }
+    [[nodiscard]] Eigen::Index cols() const { return m_rows; }
+    [[nodiscard]] size_t num_subdomains() const { return m_subdomains.size(); }
+
+private:
+    struct Subdomain {
+        // The unknowns of the extended tile
+        std::vector<Eigen::Index> unknowns;
+        std::unique_ptr<Eigen::SimplicialLDLT<sparse_t>> factorization;
+    };
+
+    std::vector<index_t> m_unknowns;
+    long m_tile_size = 128;
+    long m_overlap = 8;
+    Eigen::Index m_rows = 0;
+    std::vector<Subdomain> m_subdomains;
+    // The tile (without the overlap) of every unknown, and the system restricted to one value per tile
+    std::vector<Eigen::Index> m_tiles;
+    std::unique_ptr<Eigen::SimplicialLDLT<sparse_t>> m_coarse;
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;
+
+    void setup(sparse_t const& A);
+    VecX<f64> apply(VecX<f64> const& b) const;
+};
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "solver.h"
+#include "utils.h"
+
+#include <vector>
+
+namespace approx {
+/**
+ * An adaptive discretization of a region (Agarwala, "Efficient gradient-domain compositing using quadtrees", 2007).
+ * The region is covered with square cells that are aligned to multiples of their size. The cells are single pixels
+ * next to the boundary of the region, and grow with the distance to the boundary. The top-left pixel of every cell is
+ * a node, and the other pixels are interpolated bilinearly from the corners of their cell. A corner that is not a
+ * node itself (on the side of a larger cell) is interpolated from the corners of the cell it falls in
+ */
+struct Quadtree {
+    // The top-left pixels of the cells
+    std::vector<index_t> nodes;
+    // The size of every cell, in the same order as the nodes
+    std::vector<long> cell_sizes;
+    // Pixels x nodes: the interpolation of every pixel of the region (in the order of the pixels) from the nodes
+    sparse_t interpolation;
+};
+
+/**
+ * Build the quadtree of a region
+ * @param pixels: The pixels of the region
+ * @param labels: The label of every pixel of the image (the pixels with a different label are not part of the region)
+ * @param label: The label of the region
+ */
+Quadtree build_quadtree(std::vector<index_t> const& pixels, MatX<int> const& labels, int label, QuadtreeOptions const& options);
+}
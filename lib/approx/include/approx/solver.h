@@ -0,0 +1,300 @@
+#pragma once
+
+#include "block_cg.h"
+#include "cholesky.h"
+#include "fast_poisson.h"
+#include "mixed_precision.h"
+#include "multigrid.h"
+#include "ordering.h"
+#include "preconditioner.h"
+#include "stencil.h"
+#include "utils.h"
+
+#include <Eigen/IterativeLinearSolvers>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <variant>
+
+namespace approx {
+enum class SolverBackend {
+    // Conjugate gradient, with the preconditioner selected in the options
+    ConjugateGradient,
+    // Geometric multigrid cycles on their own
+    Multigrid,
+    // Conjugate gradient, preconditioned with a single multigrid cycle
+    MultigridConjugateGradient,
+    // Conjugate gradient that applies the stencil on the image grid, without assembling a sparse matrix. Regions that
+    // fill little of their bounding box use ConjugateGradient instead (see fits_matrix_free)
+    MatrixFreeConjugateGradient,
+    // Sparse direct LDL^T factorization, cached for every region so the same mask is only factorized once
+    Cholesky,
+    // Cholesky or MultigridConjugateGradient, picked for every region from its size and shape (see dispatch.h)
+    Automatic
+};
+
+// Where SolverBackend::Automatic switches from the direct solver to multigrid preconditioned conjugate gradient (see
+// dispatch.h)
+struct DispatchThresholds {
+    // Regions with up to this many unknowns are factorized
+    long direct_size = 40000;
+    // Larger regions are also factorized if they are thin: the fill of the factorization grows with the thickness of
+    // the region (the unknowns divided by the longest side of its bounding box), not with the number of unknowns
+    f64 thin_width = 24.0;
+    // Thin regions are only factorized while the estimated fill of the factorization (unknowns x thickness) stays
+    // below this, which keeps very long regions from taking all the memory
+    f64 max_thin_fill = 2e7;
+};
+
+// Picks the tolerance of every region from the earlier solves recorded in the approximation database (see tuning.h)
+struct TuningOptions {
+    // The largest acceptable RMS error of the filled pixels, in the units of the image
+    f64 visual_error = 1e-4;
+    // Regions are grouped by their number of unknowns, in buckets that are this factor apart
+    f64 bucket_factor = 4.0;
+    // Until a bucket has this many solves with a measured visual error, its regions use the tolerance of the options
+    long min_records = 5;
+    // The tolerance is only loosened if the iteration model of the bucket predicts that it saves at least this part of
+    // the iterations (a looser tolerance that saves nothing only makes the result worse)
+    f64 min_savings = 0.1;
+    // The tuned tolerances are never looser than this, and never tighter than the tolerance of the options
+    f64 loosest_tolerance = 1e-2;
+};
+
+// Solves the Poisson blend of large regions on a quadtree, with fewer unknowns than pixels (see quadtree.h)
+struct QuadtreeOptions {
+    // Smaller regions are solved for every pixel
+    long min_region_size = 10000;
+    // The size of the largest cells (rounded down to a power of two)
+    long max_cell_size = 32;
+    // Every cell is at least this many times its size away from the boundary of the region. Larger values keep more
+    // pixels next to the boundary at full resolution
+    f64 grading = 1.0;
+};
+
+struct SolverOptions {
+    SolverBackend backend = SolverBackend::ConjugateGradient;
+    f64 tolerance = 1e-6;
+    // Defaults to the number of unknowns, but at least 100 (conjugate gradient), or 100 cycles (multigrid). The same
+    // default is used by both fills. Not used by the direct solver
+    std::optional<int> max_iterations = {};
+    MultigridOptions multigrid = {};
+    // Only used by the ConjugateGradient backend
+    PreconditionerOptions preconditioner = {};
+    // Only used by the MatrixFreeConjugateGradient backend, and by the ConjugateGradient backend with the Jacobi
+    // preconditioner. With Precision::Single, the tolerance is at least single_precision_tolerance
+    Precision precision = Precision::Double;
+    // Solve all the channels of a region together with block conjugate gradient (only used by the ConjugateGradient
+    // backend with the Jacobi preconditioner)
+    bool block_channels = false;
+    // The order of the unknowns in the matrix. Not used by the matrix-free and the direct backends, which do not
+    // depend on the order (the direct solver computes its own fill-reducing ordering)
+    UnknownOrdering ordering = UnknownOrdering::Raster;
+    // Wall-clock budget (in seconds) for the whole fill, including the setup of the solvers. When it runs out, the
+    // iterative solvers stop between iterations (or cycles), and the best solution so far is used. The regions whose
+    // setup starts after it ran out keep their guess. The direct solver cannot be stopped early
+    std::optional<f64> time_budget = {};
+    // Start the Laplace fill from a pull-push fill of the image (see laplace.h) instead of zero. Not used by the direct
+    // solver, and by the Poisson blend, which starts from the replacement image
+    bool pull_push_guess = false;
+    // The folder with the approximation database. When it is set, the solve of every region of the Laplace fill and
+    // the Poisson blend is recorded in it (see PerfInfo)
+    std::optional<fs::path> perf_database = {};
+    // Measure the visual error of every recorded solve against a reference solve, which the tolerance tuning needs (see
+    // measure_visual_error). The reference solves take more iterations, so this is meant for calibration runs, which
+    // should go up to the loosest tolerance that the tuning may pick
+    bool measure_visual_error = false;
+    // Use the tolerance tuned from the solves recorded in perf_database (by the same fill), instead of `tolerance`
+    std::optional<TuningOptions> tuning = {};
+    // The thresholds of SolverBackend::Automatic. When they are not set, the solver looks them up itself (see
+    // dispatch_thresholds)
+    std::optional<DispatchThresholds> dispatch = {};
+    // Only used by the masked Poisson blend: solve large regions on a quadtree. The reduced system is solved with the
+    // direct solver by the Cholesky backend, and with conjugate gradient by the others, which stops at the time budget
+    // and starts from the warm start of the blend. The Automatic backend factorizes reduced systems of up to
+    // DispatchThresholds::direct_size nodes
+    std::optional<QuadtreeOptions> quadtree = {};
+};
+
+enum class FillStatus {
+    // Every region was solved to the tolerance
+    Converged,
+    // At least one region did not reach the tolerance within the maximum number of iterations
+    NotConverged,
+    // The time budget ran out before every region was solved to the tolerance
+    DeadlineReached
+};
+
+// The outcome of filling all the regions of a mask
+struct FillResult {
+    FillStatus status = FillStatus::Converged;
+    // The largest relative residual of any region and channel
+    f64 error = 0.0;
+    // The total number of iterations of all the regions
+    long iterations = 0;
+
+    void merge(FillResult const& other);
+};
+
+// The point in time when the time budget of the options runs out, counted from now
+deadline_t start_deadline(SolverOptions const& options);
+
+// True if the solver splits a region of this size into subdomains that are solved in parallel (additive Schwarz).
+// Those regions are solved one at a time instead of next to the other regions, so the subdomains get all the threads
+bool decomposes_region(SolverOptions const& options, long num_unknowns);
+
+/**
+ * Preconditioned conjugate gradient with the same iterations as Eigen's, which checks the deadline before every
+ * iteration. Stopping early keeps the solution so far, and the solve never has to be restarted
+ * @param iterations, error: The iterations and the relative residual of the solve
+ * @param deadline_reached: Set to true if the solve was stopped by the deadline (and left as it is otherwise)
+ */
+template<typename Matrix, typename PreconditionerT>
+VecX<f64> conjugate_gradient_until_deadline(Matrix const& A, PreconditionerT const& preconditioner, VecX<f64> const& b,
+    VecX<f64> const& guess, long max_iterations, f64 tolerance, std::chrono::steady_clock::time_point deadline,
+    long& iterations, f64& error, bool& deadline_reached)
+{
+    iterations = 0;
+    error = 0.0;
+    f64 b_norm2 = b.squaredNorm();
+    if (b_norm2 == 0.0) {
+        return VecX<f64>::Zero(b.size());
+    }
+    f64 threshold = std::max(tolerance * tolerance * b_norm2, std::numeric_limits<f64>::min());
+
+    VecX<f64> x = guess;
+    VecX<f64> residual = b - A * x;
+    f64 residual_norm2 = residual.squaredNorm();
+    VecX<f64> p = preconditioner.solve(residual);
+    VecX<f64> z(b.size());
+    VecX<f64> q(b.size());
+    f64 rz = residual.dot(p);
+    // Counted the same way as Eigen: the iteration that converges is not counted
+    while (residual_norm2 >= threshold && iterations < max_iterations) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            deadline_reached = true;
+            break;
+        }
+        q.noalias() = A * p;
+        f64 alpha = rz / p.dot(q);
+        x += alpha * p;
+        residual -= alpha * q;
+        residual_norm2 = residual.squaredNorm();
+        if (residual_norm2 < threshold) {
+            break;
+        }
+        z = preconditioner.solve(residual);
+        f64 rz_new = residual.dot(z);
+        p = z + (rz_new / rz) * p;
+        rz = rz_new;
+        iterations += 1;
+    }
+    error = std::sqrt(residual_norm2 / b_norm2);
+    return x;
+}
+
+/**
+ * Solves the system of a single region with the backend selected in the options.
+ * The matrix is set up once, and can then be used to solve for any number of right hand sides.
+ */
+class LinearSolver {
+public:
+    /**
+     * @param system: The unknowns and the diagonal of the system. The sparse matrix is only assembled for the backends that need it
+     * @param options: Solver configuration
+     * @param deadline: Stop iterating at the deadline. The setup counts against it: if it has already passed, the solver
+     * is not set up (only the matrix is assembled, for the residuals), and the solves return the guess
+     */
+    LinearSolver(StencilSystem const& system, SolverOptions const& options, deadline_t deadline = {});
+    ~LinearSolver();
+
+    VecX<f64> solveWithGuess(VecX<f64> const& b, VecX<f64> const& guess);
+
+    /**
+     * Solve for several right hand sides (one per column). Block conjugate gradient is used if it was enabled in the options,
+     * and any column that does not converge in the block is solved separately. Otherwise the columns are solved one at a time.
+     * Afterwards, iterations() is the total number of iterations and error() is the largest error of all the columns
+     */
+    MatX<f64> solveWithGuess(MatX<f64> const& B, MatX<f64> const& guesses);
+
+    // The result of the last solve
+    [[nodiscard]] Eigen::ComputationInfo info() const { return m_info; }
+    [[nodiscard]] long iterations() const { return m_iterations; }
+    // The separate solves that iterations() is summed over: one for every column, or with block conjugate gradient, one
+    // for the block and one for every column that was solved again
+    [[nodiscard]] long solves() const { return m_solves; }
+    [[nodiscard]] f64 error() const { return m_error; }
+    [[nodiscard]] long max_iterations() const { return m_max_iterations; }
+    [[nodiscard]] f64 tolerance() const { return m_tolerance; }
+    // The tolerance of the following solves (not used by the direct solver)
+    void set_tolerance(f64 tolerance);
+    // The backend that is used, which is only different from the options with SolverBackend::Automatic, or for a
+    // region that does not fit the matrix-free solver
+    [[nodiscard]] SolverBackend backend() const { return m_backend; }
+    // The preconditioner of the ConjugateGradient backend, which is only different from the options for a region that
+    // does not fit the matrix-free solver
+    [[nodiscard]] Preconditioner preconditioner() const { return m_preconditioner; }
+    // The time it took to assemble the matrix and set up the solver (including the preconditioner), in milliseconds
+    [[nodiscard]] f64 setup_time() const { return m_setup_time; }
+
+    // True if the last solve was stopped by the deadline (or skipped, because the deadline passed before the setup)
+    [[nodiscard]] bool deadline_reached() const { return m_deadline_reached; }
+    // The outcome of the last solve
+    [[nodiscard]] FillResult result() const;
+
+    // The largest relative residual |b - A x| / |b| of the columns, with the matrix (or the stencil) that was set up for
+    // the solves, so nothing is assembled again. The direct solver does not keep the matrix, and always reports 0
+    [[nodiscard]] f64 relative_residual(MatX<f64> const& B, MatX<f64> const& X) const;
+
+private:
+    // The solves in the order of the unknowns of the matrix
+    VecX<f64> solve_column(VecX<f64> const& b, VecX<f64> const& guess);
+    VecX<f64> solve_column_until_deadline(VecX<f64> const& b, VecX<f64> const& guess);
+    MatX<f64> solve_columns(MatX<f64> const& B, MatX<f64> const& guesses);
+    VecX<f64> residual(VecX<f64> const& b, VecX<f64> const& x) const;
+
+    using MultigridCG = Eigen::ConjugateGradient<sparse_t, Eigen::Lower | Eigen::Upper, MultigridPreconditioner>;
+    using IncompleteCholeskyCG = Eigen::ConjugateGradient<sparse_t, Eigen::Lower | Eigen::Upper, Eigen::IncompleteCholesky<f64>>;
+    using SSORCG = Eigen::ConjugateGradient<sparse_t, Eigen::Lower | Eigen::Upper, SSORPreconditioner>;
+    using BlockJacobiCG = Eigen::ConjugateGradient<sparse_t, Eigen::Lower | Eigen::Upper, BlockJacobiPreconditioner>;
+    using SchwarzCG = Eigen::ConjugateGradient<sparse_row_t, Eigen::Lower | Eigen::Upper, SchwarzPreconditioner>;
+    using SineTransformCG = Eigen::ConjugateGradient<sparse_row_t, Eigen::Lower | Eigen::Upper, SineTransformPreconditioner>;
+
+    SolverBackend m_backend = SolverBackend::ConjugateGradient;
+    Preconditioner m_preconditioner = Preconditioner::Jacobi;
+    long m_max_iterations = 0;
+    f64 m_setup_time = 0.0;
+    // Solving is skipped if the setup failed
+    Eigen::ComputationInfo m_setup_info = Eigen::InvalidInput;
+    // The deadline passed before the setup, so the solves return the guess
+    bool m_setup_skipped = false;
+    f64 m_tolerance = 0.0;
+    bool m_block = false;
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;
+    long m_iterations = 0;
+    long m_solves = 0;
+    f64 m_error = 0.0;
+    deadline_t m_deadline = {};
+    bool m_deadline_reached = false;
+    // The unknowns of the system in the order of the matrix (empty if the unknowns were not reordered)
+    std::vector<Eigen::Index> m_order;
+    // Eigen's iterative solvers only keep a reference to the matrix, so it has to outlive them (empty for the solvers
+    // that keep their own copy)
+    sparse_t m_matrix;
+    std::variant<std::unique_ptr<SparseSolver>,
+        std::unique_ptr<IncompleteCholeskyCG>,
+        std::unique_ptr<SSORCG>,
+        std::unique_ptr<BlockJacobiCG>,
+        std::unique_ptr<SchwarzCG>,
+        std::unique_ptr<SineTransformCG>,
+        std::unique_ptr<Multigrid>,
+        std::unique_ptr<MultigridCG>,
+        std::unique_ptr<StencilConjugateGradient>,
+        std::unique_ptr<CholeskySolver>,
+        std::unique_ptr<MixedPrecisionSolver>>
+        m_solver;
+};
+}
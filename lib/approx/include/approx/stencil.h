@@ -0,0 +1,89 @@
+#pragma once
+
+#include "stencil_kernels.h"
+#include "utils.h"
+
+namespace approx {
+/**
+ * The system of a single region of unknown pixels. Both the laplace and the poisson fills create systems of the form
+ *     diagonal[i] * x_i - (sum of x_j for the 4-neighbours j of pixel i that are also unknowns) = b_i
+ * The values of the neighbours that are known are part of the right hand side.
+ */
+struct StencilSystem {
+    // The pixel of each unknown
+    std::vector<index_t> unknowns;
+    VecX<f64> diagonal;
+
+    [[nodiscard]] Eigen::Index size() const { return (Eigen::Index)unknowns.size(); }
+
+    // Create the (symmetric positive definite) sparse matrix of the system. Large systems are assembled in parallel
+    [[nodiscard]] sparse_t assemble() const;
+};
+
+// The same matrix as a row-major matrix, without copying it. Only valid for symmetric matrices (the compressed columns
+// are also the compressed rows), and only as long as the matrix exists
+inline Eigen::Map<sparse_row_t const> row_major_view(sparse_t const& A)
+{
+    return { A.rows(), A.cols(), A.nonZeros(), A.outerIndexPtr(), A.innerIndexPtr(), A.valuePtr() };
+}
+
+// The grids of StencilConjugateGradient cover the bounding box of the unknowns, so their memory and the work of every
+// iteration grow with the box rather than with the unknowns. Regions that fill less than this part of their bounding
+// box (thin diagonal slivers, rings) are solved with the sparse matrix instead
+inline constexpr f64 min_matrix_free_fill = 0.25;
+
+// True if the unknowns fill enough of their bounding box for the matrix-free solver
+[[nodiscard]] bool fits_matrix_free(StencilSystem const& system);
+
+/**
+ * Conjugate gradient that never assembles a matrix: the 5-point stencil is applied directly on a padded grid
+ * covering the bounding box of the unknowns (see StencilKernels).
+ * A diagonal (Jacobi) preconditioner is used, the same as Eigen's conjugate gradient.
+ * @tparam Scalar: The type of the grids and of the iterations. The f32 solver is used for the corrections of
+ * MixedPrecisionSolver, and only reaches a relative residual of about single_precision_tolerance
+ */
+template<typename Scalar>
+class BasicStencilConjugateGradient {
+public:
+    using grid_t = MatX<Scalar>;
+
+    BasicStencilConjugateGradient() = default;
+    explicit BasicStencilConjugateGradient(StencilSystem const& system);
+    void compute(StencilSystem const& system);
+
+    // The right hand side and the guess are ordered the same way as the unknowns of the system
+    VecX<f64> solveWithGuess(VecX<f64> const& b, VecX<f64> const& guess);
+
+    void setTolerance(f64 tolerance) { m_tolerance = tolerance; }
+    void setMaxIterations(long max_iterations) { m_max_iterations = max_iterations; }
+    // The deadline is checked before every iteration
+    void setDeadline(deadline_t deadline) { m_deadline = deadline; }
+
+    [[nodiscard]] Eigen::ComputationInfo info() const { return m_info; }
+    [[nodiscard]] long iterations() const { return m_iterations; }
+    [[nodiscard]] f64 error() const { return m_error; }
+    // True if the last solve was stopped by the deadline
+    [[nodiscard]] bool deadline_reached() const { return m_deadline_reached; }
+
+    // y = A x, where x and y are grids of the same size as the padded bounding box
+    void apply(grid_t const& x, grid_t& y) const;
+    // b - A x, in the order of the unknowns (computed in Scalar)
+    [[nodiscard]] VecX<f64> residual(VecX<f64> const& b, VecX<f64> const& x) const;
+
+private:
+    // The diagonal comes from the system, so the boundary of the kernels is not used
+    StencilKernels<Scalar, Boundary::Neumann> m_kernels;
+    grid_t m_inverse_diagonal;
+
+    Eigen::ComputationInfo m_info = Eigen::InvalidInput;
+    f64 m_tolerance = 1e-6;
+    long m_max_iterations = 100;
+    deadline_t m_deadline = {};
+    bool m_deadline_reached = false;
+    long m_iterations = 0;
+    f64 m_error = 0.0;
+};
+
+using StencilConjugateGradient = BasicStencilConjugateGradient<f64>;
+using StencilConjugateGradientF32 = BasicStencilConjugateGradient<f32>;
+}
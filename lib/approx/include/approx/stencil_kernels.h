@@ -0,0 +1,224 @@
+#pragma once
+
+#include "utils.h"
+
+#include <array>
+#include <utility>
+#include <vector>
+
+namespace approx {
+enum class Connectivity {
+    // The 5-point stencil of the Laplace and the Poisson systems (stencil_offsets)
+    Four,
+    // The 9-point stencil, with the diagonal neighbours weighted the same as the others
+    Eight
+};
+
+enum class Boundary {
+    // The region never touches the border of the image, so every neighbour of the stencil exists (the Laplace fill)
+    Interior,
+    // The neighbours outside of the image are left out of the stencil (the Poisson blend)
+    Neumann
+};
+
+/**
+ * The stencil of a region, applied on a grid that covers the bounding box of the unknowns, padded by one pixel on
+ * every side. The grid cells that are not unknowns are zero, so every kernel works on whole columns at once: the
+ * neighbours are shifted columns, and the offsets of the stencil are unrolled at compile time, which gives Eigen fixed
+ * loops to vectorize without checking the neighbours of every pixel.
+ *     y = A x: diagonal * x - (sum of the neighbours that are unknowns)
+ *     b: the sum of the neighbours that are known (inside of the image for the Neumann boundary)
+ * @tparam Scalar: The type of the grids: f64, or f32 for the single precision iterations (see MixedPrecisionSolver)
+ * @tparam connectivity: The fills and StencilSystem::assemble only use the 5-point stencil, the 9-point stencil is
+ * there for other operators on the same grids
+ */
+template<typename Scalar, Boundary boundary, Connectivity connectivity = Connectivity::Four>
+class StencilKernels {
+public:
+    using grid_t = MatX<Scalar>;
+
+    static constexpr auto offsets = [] {
+        if constexpr (connectivity == Connectivity::Four) {
+            return stencil_offsets;
+        } else {
+            return std::array<index_t, 8> { { { -1, -1 }, { 0, -1 }, { 1, -1 }, { -1, 0 }, { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } } };
+        }
+    }();
+
+    StencilKernels() = default;
+
+    // The unknowns of a region of an image. The diagonal is the number of neighbours of the stencil (inside of the
+    // image for the Neumann boundary)
+    StencilKernels(std::vector<index_t> const& unknowns, Eigen::Index image_rows, Eigen::Index image_cols)
+    {
+        setup(unknowns);
+        if constexpr (boundary == Boundary::Interior) {
+            m_diagonal = m_mask * (Scalar)offsets.size();
+        } else {
+            grid_t inside = grid_t::Zero(m_mask.rows(), m_mask.cols());
+            auto [first_row, first_col, rows, cols] = image_block(image_rows, image_cols);
+            inside.block(first_row - m_origin.row, first_col - m_origin.col, rows, cols).setOnes();
+            m_diagonal = m_mask.cwiseProduct(neighbour_sum(inside));
+        }
+    }
+
+    // The unknowns of a system with its own diagonal (in the order of the unknowns)
+    StencilKernels(std::vector<index_t> const& unknowns, VecX<f64> const& diagonal)
+    {
+        setup(unknowns);
+        m_diagonal = scatter(diagonal.template cast<Scalar>());
+    }
+
+    [[nodiscard]] Eigen::Index size() const { return (Eigen::Index)m_offsets.size(); }
+    [[nodiscard]] Eigen::Index grid_rows() const { return m_mask.rows(); }
+    [[nodiscard]] Eigen::Index grid_cols() const { return m_mask.cols(); }
+    // The diagonal on the grid (zero outside of the unknowns)
+    [[nodiscard]] grid_t const& diagonal_grid() const { return m_diagonal; }
+    [[nodiscard]] VecX<f64> diagonal() const { return gather(m_diagonal).template cast<f64>(); }
+
+    // y = A x, where x and y are grids (x is zero outside of the unknowns, and so is y)
+    void apply(grid_t const& x, grid_t& y) const
+    {
+        Eigen::Index rows = x.rows() - 2;
+        Eigen::Index cols = x.cols() - 2;
+        y.resize(x.rows(), x.cols());
+        y.col(0).setZero();
+        y.col(cols + 1).setZero();
+        y.row(0).setZero();
+        y.row(rows + 1).setZero();
+#pragma omp parallel for if (cols > 256)
+        for (Eigen::Index col = 1; col <= cols; ++col) {
+            auto result = y.col(col).segment(1, rows).array();
+            result = m_diagonal.col(col).segment(1, rows).array() * x.col(col).segment(1, rows).array();
+            for_each_offset([&](index_t offset) {
+                result -= x.col(col + offset.col).segment(1 + offset.row, rows).array();
+            });
+            result *= m_mask.col(col).segment(1, rows).array();
+        }
+    }
+
+    // r = b - A x, on grids
+    void residual(grid_t const& b, grid_t const& x, grid_t& r) const
+    {
+        apply(x, r);
+        r = b - r;
+    }
+
+    // The sum of the known neighbours of every unknown, in the order of the unknowns. For the Neumann boundary the
+    // neighbours outside of the image are left out
+    template<typename T>
+    [[nodiscard]] VecX<f64> right_hand_side(MatX<T> const& image) const
+    {
+        grid_t known = grid_t::Zero(m_mask.rows(), m_mask.cols());
+        if constexpr (boundary == Boundary::Interior) {
+            known = image.block(m_origin.row, m_origin.col, known.rows(), known.cols()).template cast<Scalar>();
+        } else {
+            auto [first_row, first_col, rows, cols] = image_block(image.rows(), image.cols());
+            known.block(first_row - m_origin.row, first_col - m_origin.col, rows, cols) = image.block(first_row, first_col, rows, cols).template cast<Scalar>();
+        }
+        // The unknowns may hold anything (e.g. NaN), so they are replaced instead of multiplied by zero
+        known = (m_mask.array() > Scalar(0)).select(Scalar(0), known);
+        return gather(neighbour_sum(known)).template cast<f64>();
+    }
+
+    // The values of an image at the unknowns
+    template<typename T>
+    [[nodiscard]] VecX<f64> values(MatX<T> const& image) const
+    {
+        VecX<f64> result(size());
+        Eigen::Index grid_rows = m_mask.rows();
+        for (Eigen::Index i = 0; i < size(); ++i) {
+            Eigen::Index offset = m_offsets[(size_t)i];
+            result[i] = static_cast<f64>(image(m_origin.row + offset % grid_rows, m_origin.col + offset / grid_rows));
+        }
+        return result;
+    }
+
+    [[nodiscard]] grid_t scatter(VecX<Scalar> const& values) const
+    {
+        grid_t grid = grid_t::Zero(m_mask.rows(), m_mask.cols());
+        for (size_t i = 0; i < m_offsets.size(); ++i) {
+            grid.data()[m_offsets[i]] = values[(Eigen::Index)i];
+        }
+        return grid;
+    }
+
+    [[nodiscard]] VecX<Scalar> gather(grid_t const& grid) const
+    {
+        VecX<Scalar> values(m_offsets.size());
+        for (size_t i = 0; i < m_offsets.size(); ++i) {
+            values[(Eigen::Index)i] = grid.data()[m_offsets[i]];
+        }
+        return values;
+    }
+
+private:
+    // The image coordinates of the top-left cell of the grid
+    index_t m_origin = { 0, 0 };
+    // Offset of each unknown in the grid
+    std::vector<Eigen::Index> m_offsets;
+    // 1 for the unknowns, 0 everywhere else
+    grid_t m_mask;
+    grid_t m_diagonal;
+
+    struct Block {
+        Eigen::Index first_row, first_col, rows, cols;
+    };
+
+    // The part of the grid that is inside of the image, in image coordinates
+    [[nodiscard]] Block image_block(Eigen::Index image_rows, Eigen::Index image_cols) const
+    {
+        Eigen::Index first_row = std::max<Eigen::Index>(m_origin.row, 0);
+        Eigen::Index first_col = std::max<Eigen::Index>(m_origin.col, 0);
+        Eigen::Index last_row = std::min(m_origin.row + m_mask.rows(), image_rows);
+        Eigen::Index last_col = std::min(m_origin.col + m_mask.cols(), image_cols);
+        return { first_row, first_col, std::max<Eigen::Index>(last_row - first_row, 0), std::max<Eigen::Index>(last_col - first_col, 0) };
+    }
+
+    void setup(std::vector<index_t> const& unknowns)
+    {
+        if (unknowns.empty()) {
+            m_mask = grid_t::Zero(2, 2);
+            return;
+        }
+        index_t first = unknowns.front(), last = first;
+        for (auto const& [row, col] : unknowns) {
+            first = { std::min(first.row, row), std::min(first.col, col) };
+            last = { std::max(last.row, row), std::max(last.col, col) };
+        }
+        m_origin = { first.row - 1, first.col - 1 };
+        m_mask = grid_t::Zero(last.row - first.row + 3, last.col - first.col + 3);
+        m_offsets.resize(unknowns.size());
+        for (size_t i = 0; i < unknowns.size(); ++i) {
+            Eigen::Index row = unknowns[i].row - m_origin.row;
+            Eigen::Index col = unknowns[i].col - m_origin.col;
+            m_offsets[i] = row + col * m_mask.rows();
+            m_mask(row, col) = Scalar(1);
+        }
+    }
+
+    template<typename F>
+    static void for_each_offset(F&& f)
+    {
+        [&]<size_t... k>(std::index_sequence<k...>) {
+            (f(offsets[k]), ...);
+        }(std::make_index_sequence<offsets.size()>());
+    }
+
+    // The sum of the neighbours of every cell of the grid (except the padding)
+    static grid_t neighbour_sum(grid_t const& grid)
+    {
+        Eigen::Index rows = grid.rows() - 2;
+        Eigen::Index cols = grid.cols() - 2;
+        grid_t sum = grid_t::Zero(grid.rows(), grid.cols());
+#pragma omp parallel for if (cols > 256)
+        for (Eigen::Index col = 1; col <= cols; ++col) {
+            auto result = sum.col(col).segment(1, rows).array();
+            for_each_offset([&](index_t offset) {
+                result += grid.col(col + offset.col).segment(1 + offset.row, rows).array();
+            });
+        }
+        return sum;
+    }
+};
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "solver.h"
+#include "utils.h"
+
+#include <filesystem>
+#include <functional>
+
+namespace fs = std::filesystem;
+
+namespace approx {
+struct StreamingOptions {
+    // The number of full-width rows that are solved and written at a time
+    Eigen::Index band_rows = 256;
+    // Rows that are read (and solved) above and below every band, but not written. The band is cut out of the hole
+    // with the current values as the boundary, so the halo keeps the cut away from the rows that are kept. At least 1
+    Eigen::Index halo_rows = 32;
+    // The coarse solve works on blocks of coarse_factor x coarse_factor pixels
+    int coarse_factor = 8;
+    // The largest number of pixels of the coarse grid. The factor is doubled until the coarse grid of the scene fits
+    Eigen::Index max_coarse_pixels = 4096 * 4096;
+    // The number of streaming passes over the full resolution rows, after the coarse solve. The passes alternate
+    // between going down and going up the image
+    int passes = 3;
+    // Used for the coarse solve and for the solve of every band
+    SolverOptions solver = {};
+};
+
+struct StreamingResult {
+    // The unknowns of the coarse system
+    long coarse_unknowns = 0;
+    // The largest change to a pixel during the last pass. Small values mean that more passes will not help
+    f64 last_change = 0.0;
+    // The largest number of rows held in memory at once
+    Eigen::Index peak_rows = 0;
+};
+
+/**
+ * Full-width rows of rasters that are too large to keep in memory. Every function reads (or writes) the rows
+ * [first_row, first_row + rows) of all the channels.
+ */
+struct RowStreams {
+    Eigen::Index rows = 0;
+    Eigen::Index cols = 0;
+
+    std::function<MultiChannelImage(Eigen::Index first_row, Eigen::Index rows)> read_input;
+    std::function<MultiChannelImage(Eigen::Index first_row, Eigen::Index rows)> read_replacement;
+    // True at places where the pixels of the input are invalid
+    std::function<MatX<bool>(Eigen::Index first_row, Eigen::Index rows)> read_mask;
+    // Rows of the output that were already written
+    std::function<MultiChannelImage(Eigen::Index first_row, Eigen::Index rows)> read_output;
+    std::function<void(Eigen::Index first_row, MultiChannelImage const& values)> write_output;
+};
+
+/**
+ * Out-of-core version of the masked blend_images_poisson, in the style of Kazhdan and Hoppe's streaming multigrid.
+ *
+ * The blend is the replacement image plus a correction that is harmonic inside the holes and matches the input
+ * on their boundary. The correction is first solved on a coarse grid (built in one streaming pass over the rows),
+ * and interpolated into the output. Each following pass walks over the image in bands of rows: the band and its halo
+ * are read back from the output, the holes in them are solved with the rows where the halo ends as known values,
+ * and the band is written back. Only the coarse grid and a single band (with its halo) are in memory at once, so the
+ * memory does not depend on the number of rows of the scene.
+ */
+StreamingResult blend_images_poisson_streaming(RowStreams const& streams, StreamingOptions const& options = {});
+
+/**
+ * Stream GeoTIFF files through blend_images_poisson_streaming
+ * @param input_path: The original image
+ * @param replacement_path: New image that we want to blend with the original image (same size and bands)
+ * @param mask_path: Raster with a non-zero value where the pixels of the original image are invalid
+ * @param mask_band: The band of the mask raster to use
+ * @param bands: The bands of the input and replacement images to blend (starting at 1). Throws if a band does not exist
+ * @param output_path: A copy of the input image, with the blended bands replaced
+ */
+StreamingResult blend_images_poisson_streaming(
+    fs::path const& input_path,
+    fs::path const& replacement_path,
+    fs::path const& mask_path,
+    int mask_band,
+    std::vector<int> const& bands,
+    fs::path const& output_path,
+    StreamingOptions const& options = {});
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "db.h"
+#include "solver.h"
+#include "utils.h"
+
+#include <map>
+#include <tuple>
+#include <utils/db.h>
+#include <vector>
+
+namespace approx {
+// The solve of a single region, recorded in the approximation database when SolverOptions::perf_database is set (by
+// the Laplace fill and the Poisson blend)
+struct PerfInfo {
+    // The fill that solved the region
+    ApproxMethod method = ApproxMethod::Poisson;
+    long region_size = 0;
+    f64 tolerance = 0.0;
+    long max_iterations = 0;
+    // Summed over the separate solves of the region
+    long iterations = 0;
+    // The separate solves that `iterations` is summed over: one for every channel, or with block conjugate gradient,
+    // one for the block and one for every channel that was solved again (see LinearSolver::solves)
+    long solves = 1;
+    f64 error = 0.0;
+    // The RMS error of the filled pixels (in the units of the image), measured against a reference solve (see
+    // measure_visual_error). Zero unless SolverOptions::measure_visual_error is set
+    f64 visual_error = 0.0;
+    f64 solve_time = 0.0;
+    // The backend that solved the region
+    SolverBackend backend = SolverBackend::ConjugateGradient;
+    // True if the backend was picked by SolverBackend::Automatic
+    bool automatic = false;
+    Preconditioner preconditioner = Preconditioner::Jacobi;
+    // Assembling the matrix and setting up the solver/preconditioner (milliseconds)
+    f64 setup_time = 0.0;
+    // The guess was an earlier result instead of the replacement image
+    bool warm_start = false;
+    // The relative residuals of the guess, and of the replacement image (only computed with a warm start)
+    f64 guess_error = 0.0;
+    f64 replacement_error = 0.0;
+    // An estimate of the iterations the warm start saved, from the rate the error went down during the solve
+    long iterations_saved = 0;
+    // The solve was stopped by the time budget of the options
+    bool deadline_reached = false;
+    // The region was solved on a quadtree (see QuadtreeOptions): the iterations are those of the reduced system
+    bool quadtree = false;
+};
+
+// The reference solve of measure_visual_error is this many times tighter than the tolerance of the solver
+inline constexpr f64 reference_tolerance_factor = 1e-3;
+
+/**
+ * Measure the RMS error of a solve (in the units of the image): the largest RMS difference of the columns of X from a
+ * reference solution, which the same solver computes from X with a tighter tolerance (see reference_tolerance_factor).
+ * Returns 0 if the reference solve did not converge. Afterwards, the solver reports the reference solve
+ */
+f64 measure_visual_error(LinearSolver& solver, MatX<f64> const& B, MatX<f64> const& X);
+
+// The fit of the recorded solves of regions of about the same size, by the same solver
+struct BucketFit {
+    SolverBackend backend = SolverBackend::ConjugateGradient;
+    // Only different between the buckets of the ConjugateGradient backend
+    Preconditioner preconditioner = Preconditioner::Jacobi;
+    // The regions in the bucket have [min_size, max_size) unknowns
+    long min_size = 0;
+    long max_size = 0;
+    // The iterative solves recorded for the bucket, and how many of them have a measured visual error
+    long records = 0;
+    long measured_records = 0;
+    // The visual error of a solve per unit of relative residual (a high percentile of the measured records, to be
+    // conservative)
+    f64 error_per_residual = 0.0;
+    // The iterations-versus-quality curve of a single solve: iterations = intercept + slope * digits, with
+    // digits = -log10(residual)
+    f64 intercept = 0.0;
+    f64 slope = 0.0;
+    // The loosest tolerance that still meets the visual error target (at most TuningOptions::loosest_tolerance, and at
+    // most the tolerance of the loosest measured solve)
+    f64 tolerance = 0.0;
+
+    [[nodiscard]] long predicted_iterations(f64 tolerance) const;
+};
+
+// Picks the tolerance of every region from the recorded solves of regions of the same size, by the same fill and the
+// same solver. The warm started solves and the quadtree solves converge differently, so they are not used
+class ToleranceTuner {
+public:
+    ToleranceTuner(std::vector<PerfInfo> const& history, TuningOptions const& options, ApproxMethod method);
+
+    /**
+     * The tuned tolerance for a region with this many unknowns, solved by this backend and preconditioner (see
+     * LinearSolver::backend and LinearSolver::preconditioner). The fallback (the tolerance of the options) is used if
+     * the bucket of the region has too few measured records, or if the iteration model of the bucket predicts that the
+     * tuned tolerance does not save enough iterations (see TuningOptions::min_savings). The tuned tolerance is never
+     * tighter than the fallback
+     */
+    [[nodiscard]] f64 tolerance(long region_size, SolverBackend backend, Preconditioner preconditioner, f64 fallback) const;
+    [[nodiscard]] std::vector<BucketFit> buckets() const;
+
+private:
+    // The solver and the size bucket of a region
+    using key_t = std::tuple<SolverBackend, Preconditioner, long>;
+    [[nodiscard]] key_t bucket(long region_size, SolverBackend backend, Preconditioner preconditioner) const;
+
+    TuningOptions m_options;
+    std::map<key_t, BucketFit> m_buckets;
+};
+
+// The solves recorded in the approximation database (in the same file as the approximated bands)
+class PerfDataBase : public utils::DataBase {
+public:
+    explicit PerfDataBase(fs::path base_path);
+
+    void write_perf_info(std::vector<PerfInfo> const& records);
+    std::vector<PerfInfo> select_perf_info();
+
+private:
+    void create_perf_table();
+};
+}
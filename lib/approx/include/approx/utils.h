@@ -1,10 +1,11 @@
 #pragma once
 
 #include <Eigen/Sparse>
+#include <array>
+#include <chrono>
 #include <filesystem>
 #include <opencv2/core/mat.hpp>
 #include <optional>
-#include <range/v3/all.hpp>
 
 #include "utils/types.h"
 
@@ -14,7 +15,11 @@ using namespace utils;
 namespace approx {
 using triplet_t = Eigen::Triplet<f64>;
 using sparse_t = Eigen::SparseMatrix<f64>;
-using SparseSolver = Eigen::ConjugateGradient<sparse_t, Eigen::Lower | Eigen::Upper>;
+using sparse_row_t = Eigen::SparseMatrix<f64, Eigen::RowMajor>;
+// Eigen only runs the sparse matrix-vector product on multiple threads for row-major matrices
+using SparseSolver = Eigen::ConjugateGradient<sparse_row_t, Eigen::Lower | Eigen::Upper>;
+// When the iterative solvers have to stop (no deadline if empty)
+using deadline_t = std::optional<std::chrono::steady_clock::time_point>;
 
 struct index_t {
     Eigen::Index row;
@@ -32,53 +37,67 @@ bool within_bounds(MatX<T> const& image, index_t index)
     return index.row >= 0 && index.row < image.rows() && index.col >= 0 && index.col < image.cols();
 }
 
+// Offsets of the 4-neighbours of a pixel (the 5-point stencil without its center)
+inline constexpr std::array<index_t, 4> stencil_offsets = { { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } } };
+
+// The neighbours of a pixel that are inside of the image. They are stored inline, so finding them never allocates
+struct Neighbours {
+    std::array<index_t, 4> pixels;
+    size_t count = 0;
+
+    [[nodiscard]] size_t size() const { return count; }
+    [[nodiscard]] index_t const* begin() const { return pixels.data(); }
+    [[nodiscard]] index_t const* end() const { return pixels.data() + count; }
+};
+
 template<typename T>
-std::vector<index_t> valid_neighbours(MatX<T> const& image, index_t index)
+Neighbours valid_neighbours(MatX<T> const& image, index_t index)
 {
-    // clang-format off
-    std::vector<index_t> retVal = {
-        { -1, 0 },
-        { 1,  0 },
-        { 0, -1 },
-        { 0,  1 }
-    };
-    // clang-format on
-    return retVal
-        | ranges::views::transform([&index](index_t i) { return index_t { i.row + index.row, i.col + index.col }; })
-        | ranges::views::remove_if([&image](index_t i) { return !within_bounds(image, i); })
-        | ranges::to<std::vector>();
+    Neighbours neighbours;
+    for (auto [row_offset, col_offset] : stencil_offsets) {
+        index_t neighbour { index.row + row_offset, index.col + col_offset };
+        if (within_bounds(image, neighbour)) {
+            neighbours.pixels[neighbours.count++] = neighbour;
+        }
+    }
+    return neighbours;
 }
 
-struct MultiChannelImage {
-    explicit MultiChannelImage(std::vector<MatX<f64>> images)
+// The channels of an image, all of the same size. Stored as f64, or as f32 to halve the memory of large images
+template<typename T>
+struct BasicMultiChannelImage {
+    explicit BasicMultiChannelImage(std::vector<MatX<T>> images)
         : images(std::move(images))
     {
     }
-    MultiChannelImage(std::initializer_list<MatX<f64>> images)
+    BasicMultiChannelImage(std::initializer_list<MatX<T>> images)
         : images(images)
     {
     }
-    MultiChannelImage(size_t channels, Eigen::Index rows, Eigen::Index cols);
-    MultiChannelImage() = default;
+    BasicMultiChannelImage(size_t channels, Eigen::Index rows, Eigen::Index cols)
+    {
+        images.insert(images.end(), channels, MatX<T>::Zero(rows, cols));
+    }
+    BasicMultiChannelImage() = default;
 
-    std::vector<MatX<f64>> images;
+    std::vector<MatX<T>> images;
 
-    f64 const& operator()(size_t c, Eigen::Index row, Eigen::Index col) const
+    T const& operator()(size_t c, Eigen::Index row, Eigen::Index col) const
     {
         return images.at(c)(row, col);
     }
 
-    f64& operator()(size_t c, Eigen::Index row, Eigen::Index col)
+    T& operator()(size_t c, Eigen::Index row, Eigen::Index col)
     {
         return images.at(c)(row, col);
     }
 
-    MatX<f64> const& operator[](size_t c) const
+    MatX<T> const& operator[](size_t c) const
     {
         return images[c];
     }
 
-    MatX<f64>& operator[](size_t c)
+    MatX<T>& operator[](size_t c)
     {
         return images[c];
     }
@@ -103,8 +122,21 @@ struct MultiChannelImage {
         bool invalid = static_cast<int>(images[0](row, col)) == 1 && static_cast<int>(images[1](row, col)) == 1 && static_cast<int>(images[2](row, col)) == 1;
         return !invalid;
     }
+
+    template<typename U>
+    [[nodiscard]] BasicMultiChannelImage<U> cast() const
+    {
+        BasicMultiChannelImage<U> output;
+        for (auto const& image : images) {
+            output.images.push_back(image.template cast<U>());
+        }
+        return output;
+    }
 };
 
+using MultiChannelImage = BasicMultiChannelImage<f64>;
+using MultiChannelImageF32 = BasicMultiChannelImage<f32>;
+
 MultiChannelImage read_image(fs::path path);
 std::optional<cv::Mat> image_list_to_cv(std::vector<MatX<f64>> const& channels);
 void write_image(std::vector<MatX<f64>> const& channels, fs::path const& output_path);
@@ -0,0 +1,132 @@
+#include "approx/block_cg.h"
+
+#include <Eigen/Dense>
+#include <utils/log.h>
+
+namespace approx {
+static auto logger = utils::create_logger("approx::block_cg");
+
+using Eigen::placeholders::all;
+
+BlockConjugateGradient::BlockConjugateGradient(sparse_t const& A)
+{
+    compute(A);
+}
+
+void BlockConjugateGradient::compute(sparse_t const& A)
+{
+    m_matrix = &A;
+    m_inverse_diagonal = VecX<f64>::Ones(A.rows());
+    VecX<f64> diagonal = A.diagonal();
+    for (Eigen::Index i = 0; i < diagonal.size(); ++i) {
+        if (diagonal[i] != 0.0) {
+            m_inverse_diagonal[i] = 1.0 / diagonal[i];
+        }
+    }
+    m_info = Eigen::Success;
+}
+
+MatX<f64> BlockConjugateGradient::solveWithGuess(MatX<f64> const& B, MatX<f64> const& guesses)
+{
+    m_iterations = 0;
+    m_fallback.clear();
+    m_errors = VecX<f64>::Zero(B.cols());
+    if (m_matrix == nullptr) {
+        m_info = Eigen::InvalidInput;
+        return guesses;
+    }
+    auto const& A = *m_matrix;
+
+    MatX<f64> X = guesses;
+    MatX<f64> R = B - A * X;
+    VecX<f64> b_norms = B.colwise().norm().transpose();
+
+    // The columns that are still being solved
+    std::vector<Eigen::Index> active;
+    for (Eigen::Index c = 0; c < B.cols(); ++c) {
+        if (b_norms[c] == 0.0) {
+            X.col(c).setZero();
+            continue;
+        }
+        m_errors[c] = R.col(c).norm() / b_norms[c];
+        if (m_errors[c] > m_tolerance) {
+            active.push_back(c);
+        }
+    }
+
+    std::vector<f64> best_errors(B.cols());
+    std::vector<long> last_improvement(B.cols(), 0);
+    for (auto c : active) {
+        best_errors[(size_t)c] = m_errors[c];
+    }
+
+    // The active columns of X and R are kept together in compact matrices, and are only copied back into X
+    // when the set of active columns changes
+    MatX<f64> X_active, R_active, Z, P, Q, ZR;
+    bool restart = true;
+    while (!active.empty() && m_iterations < m_max_iterations) {
+        if (restart) {
+            X_active = X(all, active);
+            R_active = R(all, active);
+            Z.noalias() = m_inverse_diagonal.asDiagonal() * R_active;
+            P = Z;
+            ZR.noalias() = Z.transpose() * R_active;
+            restart = false;
+        }
+
+        Q.noalias() = A * P;
+        Eigen::LDLT<MatX<f64>> ldlt(P.transpose() * Q);
+        if (ldlt.info() != Eigen::Success || !ldlt.isPositive() || ldlt.rcond() < 1e-12) {
+            // The search directions are (close to) linearly dependent, so the block cannot continue
+            logger->debug("Block conjugate gradient broke down after {} iterations with {} active columns", m_iterations, active.size());
+            break;
+        }
+
+        MatX<f64> alpha = ldlt.solve(ZR);
+        X_active.noalias() += P * alpha;
+        R_active.noalias() -= Q * alpha;
+        m_iterations += 1;
+
+        // Remove the columns that converged or stopped improving
+        std::vector<Eigen::Index> remaining;
+        for (size_t a = 0; a < active.size(); ++a) {
+            auto c = active[a];
+            m_errors[c] = R_active.col((Eigen::Index)a).norm() / b_norms[c];
+            if (m_errors[c] <= m_tolerance) {
+                continue;
+            }
+            if (m_errors[c] < 0.999 * best_errors[(size_t)c]) {
+                best_errors[(size_t)c] = m_errors[c];
+                last_improvement[(size_t)c] = m_iterations;
+            } else if (m_iterations - last_improvement[(size_t)c] >= m_stagnation_iterations) {
+                logger->debug("Column {} stagnated at {:.4e} error after {} iterations", c, m_errors[c], m_iterations);
+                m_fallback.push_back(c);
+                continue;
+            }
+            remaining.push_back(c);
+        }
+        if (remaining.size() != active.size()) {
+            X(all, active) = X_active;
+            R(all, active) = R_active;
+            active = std::move(remaining);
+            restart = true;
+            continue;
+        }
+
+        Z.noalias() = m_inverse_diagonal.asDiagonal() * R_active;
+        MatX<f64> ZR_next = Z.transpose() * R_active;
+        MatX<f64> beta = ZR.ldlt().solve(ZR_next);
+        Z.noalias() += P * beta;
+        P.swap(Z);
+        ZR = std::move(ZR_next);
+    }
+    if (!restart) {
+        X(all, active) = X_active;
+    }
+
+    // Columns that ran out of iterations have not converged either
+    m_fallback.insert(m_fallback.end(), active.begin(), active.end());
+    m_info = m_fallback.empty() ? Eigen::Success : Eigen::NoConvergence;
+    return X;
+}
+}
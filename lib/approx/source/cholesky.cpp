@@ -0,0 +1,159 @@
+#include "approx/cholesky.h"
+
+#include <boost/functional/hash.hpp>
+#include <list>
+#include <mutex>
+#include <utils/log.h>
+
+namespace approx {
+static auto logger = utils::create_logger("approx::cholesky");
+
+struct CacheEntry {
+    std::size_t hash;
+    // Kept to tell apart systems with the same hash
+    std::vector<index_t> unknowns;
+    VecX<f64> diagonal;
+    std::shared_ptr<Factorization const> factorization;
+    // The memory held by the entry
+    std::size_t bytes;
+};
+
+// The regions are solved concurrently, so every access to the cache is guarded by the mutex.
+// The most recently used entry is at the front of the list
+static std::mutex cache_mutex;
+static std::list<CacheEntry> cache;
+static std::size_t cache_capacity = default_factorization_cache_capacity;
+static std::size_t cache_bytes = 0;
+
+std::size_t hash_system(StencilSystem const& system)
+{
+    std::size_t seed = 0;
+    boost::hash_combine(seed, system.unknowns.size());
+    for (auto const& [row, col] : system.unknowns) {
+        boost::hash_combine(seed, row);
+        boost::hash_combine(seed, col);
+    }
+    for (Eigen::Index i = 0; i < system.diagonal.size(); ++i) {
+        boost::hash_combine(seed, system.diagonal[i]);
+    }
+    return seed;
+}
+
+// The factor, the permutation, and the key of the entry
+static std::size_t entry_bytes(StencilSystem const& system, Factorization const& factorization)
+{
+    auto const& factor = factorization.matrixL().nestedExpression();
+    auto nonzeros = (std::size_t)factor.nonZeros();
+    auto size = (std::size_t)factor.cols();
+    return nonzeros * (sizeof(f64) + sizeof(sparse_t::StorageIndex))
+        + size * (2 * sizeof(f64) + 3 * sizeof(sparse_t::StorageIndex))
+        + system.unknowns.size() * sizeof(index_t) + (std::size_t)system.diagonal.size() * sizeof(f64);
+}
+
+// Remove the least recently used entries until the cache fits in its capacity (the cache mutex is held)
+static void evict_factorizations()
+{
+    while (cache_bytes > cache_capacity) {
+        cache_bytes -= cache.back().bytes;
+        cache.pop_back();
+    }
+}
+
+// Move the entry of the system to the front and return its factorization, or nullptr (the cache mutex is held)
+static std::shared_ptr<Factorization const> touch_factorization(std::size_t hash, StencilSystem const& system)
+{
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->hash == hash && it->unknowns == system.unknowns && it->diagonal == system.diagonal) {
+            cache.splice(cache.begin(), cache, it);
+            return cache.front().factorization;
+        }
+    }
+    return nullptr;
+}
+
+static std::shared_ptr<Factorization const> find_factorization(std::size_t hash, StencilSystem const& system)
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return touch_factorization(hash, system);
+}
+
+// Returns the factorization to use: another thread may have factorized the same system since the lookup missed, in
+// which case its entry is kept and the new factorization is dropped
+static std::shared_ptr<Factorization const> store_factorization(std::size_t hash, StencilSystem const& system, std::shared_ptr<Factorization const> factorization)
+{
+    std::size_t bytes = entry_bytes(system, *factorization);
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (auto existing = touch_factorization(hash, system)) {
+        return existing;
+    }
+    if (bytes > cache_capacity) {
+        logger->debug("The factorization of a region with {} unknowns ({} MB) does not fit in the cache", system.size(), bytes >> 20);
+        return factorization;
+    }
+    cache.push_front({ hash, system.unknowns, system.diagonal, factorization, bytes });
+    cache_bytes += bytes;
+    evict_factorizations();
+    return factorization;
+}
+
+CholeskySolver::CholeskySolver(StencilSystem const& system)
+{
+    std::size_t hash = hash_system(system);
+    m_factorization = find_factorization(hash, system);
+    if (m_factorization) {
+        m_cached = true;
+        m_info = m_factorization->info();
+        return;
+    }
+
+    auto factorization = std::make_shared<Factorization>(system.assemble());
+    m_info = factorization->info();
+    if (m_info != Eigen::Success) {
+        logger->warn("Failed to factorize a system with {} unknowns", system.size());
+        return;
+    }
+    m_factorization = store_factorization(hash, system, std::move(factorization));
+}
+
+VecX<f64> CholeskySolver::solveWithGuess(VecX<f64> const& b, VecX<f64> const& guess) const
+{
+    if (m_info != Eigen::Success) {
+        return guess;
+    }
+    return m_factorization->solve(b);
+}
+
+MatX<f64> CholeskySolver::solve(MatX<f64> const& B) const
+{
+    if (m_info != Eigen::Success) {
+        return MatX<f64>::Zero(B.rows(), B.cols());
+    }
+    return m_factorization->solve(B);
+}
+
+void clear_factorization_cache()
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    cache.clear();
+    cache_bytes = 0;
+}
+
+void set_factorization_cache_capacity(std::size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    cache_capacity = bytes;
+    evict_factorizations();
+}
+
+std::size_t factorization_cache_size()
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return cache.size();
+}
+
+std::size_t factorization_cache_bytes()
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return cache_bytes;
+}
+}
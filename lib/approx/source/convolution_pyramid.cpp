@@ -0,0 +1,105 @@
+#include "approx/convolution_pyramid.h"
+
+namespace approx {
+// The columns are filtered in chunks, which are processed in parallel
+static constexpr Eigen::Index chunk_cols = 64;
+
+using strided_t = Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>;
+
+// Fitted the same way as in the paper: by minimizing the difference between the normalized convolution of the boundary
+// values and the exact membrane (the direct solve of the blend), which executables/fit-pyramid-kernels reproduces. The
+// result does not depend on the scale of the skip filter, and the fit did not improve on the identity for it
+PyramidKernels membrane_kernels()
+{
+    return {
+        .analysis = { 0.035, 0.315, 0.7, 0.315, 0.035 },
+        .synthesis = { 0.035, 0.315, 0.7, 0.315, 0.035 },
+        .skip = { 1.0 },
+    };
+}
+
+// Convolve with a separable kernel, with zeros outside of the image. Both passes add shifted blocks of whole columns,
+// which Eigen vectorizes
+static MatX<f64> convolve(MatX<f64> const& image, std::vector<f64> const& kernel)
+{
+    Eigen::Index rows = image.rows();
+    Eigen::Index cols = image.cols();
+    auto radius = (Eigen::Index)kernel.size() / 2;
+    long num_chunks = (long)((cols + chunk_cols - 1) / chunk_cols);
+
+    MatX<f64> vertical = MatX<f64>::Zero(rows, cols);
+#pragma omp parallel for if (cols > 4 * chunk_cols)
+    for (long chunk = 0; chunk < num_chunks; ++chunk) {
+        Eigen::Index begin = chunk * chunk_cols;
+        Eigen::Index n = std::min(chunk_cols, cols - begin);
+        for (size_t k = 0; k < kernel.size(); ++k) {
+            Eigen::Index shift = (Eigen::Index)k - radius;
+            Eigen::Index length = rows - std::abs(shift);
+            if (length > 0) {
+                vertical.block(std::max<Eigen::Index>(0, -shift), begin, length, n) += kernel[k] * image.block(std::max<Eigen::Index>(0, shift), begin, length, n);
+            }
+        }
+    }
+
+    MatX<f64> result = MatX<f64>::Zero(rows, cols);
+#pragma omp parallel for if (cols > 4 * chunk_cols)
+    for (long chunk = 0; chunk < num_chunks; ++chunk) {
+        Eigen::Index begin = chunk * chunk_cols;
+        Eigen::Index end = std::min(begin + chunk_cols, cols);
+        for (size_t k = 0; k < kernel.size(); ++k) {
+            Eigen::Index shift = (Eigen::Index)k - radius;
+            Eigen::Index first = std::max(begin, -shift);
+            Eigen::Index length = std::min(end, cols - shift) - first;
+            if (length > 0) {
+                result.middleCols(first, length) += kernel[k] * vertical.middleCols(first + shift, length);
+            }
+        }
+    }
+    return result;
+}
+
+static MatX<f64> pad(MatX<f64> const& image, Eigen::Index padding)
+{
+    MatX<f64> padded = MatX<f64>::Zero(image.rows() + 2 * padding, image.cols() + 2 * padding);
+    padded.block(padding, padding, image.rows(), image.cols()) = image;
+    return padded;
+}
+
+// Keep every other pixel, starting from the first one
+static MatX<f64> downsample(MatX<f64> const& image)
+{
+    return Eigen::Map<MatX<f64> const, 0, strided_t>(image.data(), (image.rows() + 1) / 2, (image.cols() + 1) / 2,
+        strided_t(2 * image.rows(), 2));
+}
+
+// The inverse of downsample, with zeros for the pixels that were left out
+static MatX<f64> upsample(MatX<f64> const& image, Eigen::Index rows, Eigen::Index cols)
+{
+    MatX<f64> result = MatX<f64>::Zero(rows, cols);
+    Eigen::Map<MatX<f64>, 0, strided_t>(result.data(), image.rows(), image.cols(), strided_t(2 * rows, 2)) = image;
+    return result;
+}
+
+MatX<f64> convolution_pyramid(MatX<f64> const& image, PyramidKernels const& kernels)
+{
+    // Every level is padded before it is filtered, so the filtered signal that spills over the border is not lost
+    auto padding = (Eigen::Index)kernels.analysis.size() / 2;
+
+    // Analysis: filter and downsample, until the coarsest level covers the image with a few pixels. The padding keeps
+    // the levels from getting smaller than about twice the padding
+    std::vector<MatX<f64>> levels;
+    levels.push_back(image);
+    while (std::max(levels.back().rows(), levels.back().cols()) > 4 * padding + 2) {
+        levels.push_back(downsample(convolve(pad(levels.back(), padding), kernels.analysis)));
+    }
+
+    // Synthesis: upsample, filter and add the filtered level, from the coarsest level back up
+    MatX<f64> result = convolve(levels.back(), kernels.skip);
+    for (size_t level = levels.size() - 1; level-- > 0;) {
+        MatX<f64> const& current = levels[level];
+        MatX<f64> upsampled = convolve(upsample(result, current.rows() + 2 * padding, current.cols() + 2 * padding), kernels.synthesis);
+        result = upsampled.block(padding, padding, current.rows(), current.cols()) + convolve(current, kernels.skip);
+    }
+    return result;
+}
+}
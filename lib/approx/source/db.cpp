@@ -51,13 +51,16 @@ RETURNING id;
     if (stmt_insert == nullptr) {
         stmt_insert = std::make_unique<SQLite::Statement>(db, sql_string);
     }
+    stmt_insert->reset();
     stmt_insert->bind(1, band_name);
     stmt_insert->bind(2, method_string.data());
-    date.bind_sql(*stmt_insert, 4);
+    date.bind_sql(*stmt_insert, 3);
 
+    int id = -1;
     while (stmt_insert->executeStep()) {
-        return stmt_insert->getColumn(0);
+        id = stmt_insert->getColumn(0);
     }
+    return id;
 }
 
 std::unordered_map<std::string, int> DataBase::get_approx_status(std::string const& date_string, ApproxMethod method)
@@ -74,6 +77,7 @@ WHERE method = ? AND year = ? AND month = ? AND day = ?;
     if (stmt_select == nullptr) {
         stmt_select = std::make_unique<SQLite::Statement>(db, sql_string);
     }
+    stmt_select->reset();
 
     auto method_string = magic_enum::enum_name(method);
     stmt_select->bind(1, method_string.data());
@@ -89,6 +93,42 @@ WHERE method = ? AND year = ? AND month = ? AND day = ?;
     return output;
 }
 
+std::optional<ApproxResult> DataBase::select_previous_approx(std::string const& date_string, std::string const& band_name, ApproxMethod method)
+{
+    create_approx_table();
+
+    utils::Date date(date_string);
+    std::string sql_string = R"sql(
+SELECT id, year, month, day
+FROM approximated_data
+WHERE band_name = ? AND method = ? AND (year < ? OR (year = ? AND (month < ? OR (month = ? AND day < ?))))
+ORDER BY year DESC, month DESC, day DESC
+LIMIT 1;
+)sql";
+    if (stmt_select_previous == nullptr) {
+        stmt_select_previous = std::make_unique<SQLite::Statement>(db, sql_string);
+    }
+    stmt_select_previous->reset();
+
+    auto method_string = magic_enum::enum_name(method);
+    stmt_select_previous->bind(1, band_name);
+    stmt_select_previous->bind(2, method_string.data());
+    stmt_select_previous->bind(3, date.year);
+    stmt_select_previous->bind(4, date.year);
+    stmt_select_previous->bind(5, date.month);
+    stmt_select_previous->bind(6, date.month);
+    stmt_select_previous->bind(7, date.day);
+
+    std::optional<ApproxResult> result;
+    while (stmt_select_previous->executeStep()) {
+        int year = stmt_select_previous->getColumn(1);
+        int month = stmt_select_previous->getColumn(2);
+        int day = stmt_select_previous->getColumn(3);
+        result = ApproxResult { date_time::date(year, month, day), stmt_select_previous->getColumn(0) };
+    }
+    return result;
+}
+
 std::vector<DayInfo> DataBase::select_close_images(std::string const& date_string)
 {
     auto date = date_time::from_simple_string(date_string);
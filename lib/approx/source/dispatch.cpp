@@ -0,0 +1,147 @@
+#include "approx/dispatch.h"
+
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <utils/log.h>
+
+namespace approx {
+static auto logger = utils::create_logger("approx::dispatch");
+
+static std::mutex thresholds_mutex;
+// The thresholds that were set, which are used for every tolerance, or else the ones calibrated for every tolerance
+static std::optional<DispatchThresholds> fixed_thresholds;
+static std::map<f64, DispatchThresholds> calibrated_thresholds;
+
+// The (laplace) system of a rows x cols rectangle of unknowns
+static StencilSystem rectangle(Eigen::Index rows, Eigen::Index cols)
+{
+    StencilSystem system;
+    for (Eigen::Index col = 0; col < cols; ++col) {
+        for (Eigen::Index row = 0; row < rows; ++row) {
+            system.unknowns.push_back({ row, col });
+        }
+    }
+    system.diagonal = VecX<f64>::Constant(system.size(), 4.0);
+    return system;
+}
+
+// Milliseconds to set up the solver and solve a single right hand side
+static f64 time_direct(StencilSystem const& system)
+{
+    // The factorization is computed here instead of with CholeskySolver, so the synthetic systems do not end up in the cache
+    auto start = std::chrono::steady_clock::now();
+    Factorization factorization(system.assemble());
+    VecX<f64> x = factorization.solve(VecX<f64>::Ones(system.size()));
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<f64, std::milli>(end - start).count();
+}
+
+static f64 time_multigrid(StencilSystem const& system, f64 tolerance)
+{
+    auto start = std::chrono::steady_clock::now();
+    LinearSolver solver(system, { .backend = SolverBackend::MultigridConjugateGradient, .tolerance = tolerance });
+    VecX<f64> b = VecX<f64>::Ones(system.size());
+    VecX<f64> guess = VecX<f64>::Zero(system.size());
+    VecX<f64> x = solver.solveWithGuess(b, guess);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<f64, std::milli>(end - start).count();
+}
+
+// The point between the largest value where the direct solver was faster and the smallest value where it was slower
+template<typename T>
+static T crossover(std::vector<T> const& values, std::vector<bool> const& direct_faster)
+{
+    size_t first_slower = 0;
+    while (first_slower < values.size() && direct_faster[first_slower]) {
+        first_slower += 1;
+    }
+    if (first_slower == 0) {
+        return values.front() / 2;
+    }
+    if (first_slower == values.size()) {
+        return values.back() * 2;
+    }
+    return (T)std::sqrt((f64)values[first_slower - 1] * (f64)values[first_slower]);
+}
+
+DispatchThresholds calibrate_dispatch(f64 tolerance)
+{
+    DispatchThresholds thresholds;
+
+    // Squares: the number of unknowns where the factorization stops being worth it
+    std::vector<long> sizes;
+    std::vector<bool> direct_faster;
+    for (Eigen::Index side : { 32, 64, 128, 256 }) {
+        StencilSystem system = rectangle(side, side);
+        f64 direct = time_direct(system);
+        f64 multigrid = time_multigrid(system, tolerance);
+        logger->debug("{}x{} square: {:.2f} ms direct, {:.2f} ms multigrid", side, side, direct, multigrid);
+        sizes.push_back((long)system.size());
+        direct_faster.push_back(direct <= multigrid);
+    }
+    thresholds.direct_size = crossover(sizes, direct_faster);
+
+    // Long strips, that are larger than the size threshold: the thickness where the factorization stops being worth it
+    std::vector<f64> widths;
+    direct_faster.clear();
+    for (Eigen::Index width : { 8, 16, 32, 64 }) {
+        StencilSystem system = rectangle(2048, width);
+        f64 direct = time_direct(system);
+        f64 multigrid = time_multigrid(system, tolerance);
+        logger->debug("2048x{} strip: {:.2f} ms direct, {:.2f} ms multigrid", width, direct, multigrid);
+        widths.push_back((f64)width);
+        direct_faster.push_back(direct <= multigrid);
+    }
+    thresholds.thin_width = crossover(widths, direct_faster);
+
+    logger->info("Calibrated the automatic backend: direct solver up to {} unknowns, or up to {:.1f} pixels thick",
+        thresholds.direct_size, thresholds.thin_width);
+    return thresholds;
+}
+
+DispatchThresholds dispatch_thresholds(f64 tolerance)
+{
+    // Calibrating while holding the lock makes the other threads wait for the thresholds, instead of calibrating too
+    std::lock_guard<std::mutex> lock(thresholds_mutex);
+    if (fixed_thresholds.has_value()) {
+        return *fixed_thresholds;
+    }
+    auto it = calibrated_thresholds.find(tolerance);
+    if (it == calibrated_thresholds.end()) {
+        it = calibrated_thresholds.emplace(tolerance, calibrate_dispatch(tolerance)).first;
+    }
+    return it->second;
+}
+
+void set_dispatch_thresholds(DispatchThresholds const& thresholds)
+{
+    std::lock_guard<std::mutex> lock(thresholds_mutex);
+    fixed_thresholds = thresholds;
+}
+
+SolverBackend select_backend(StencilSystem const& system, DispatchThresholds const& thresholds)
+{
+    if (system.unknowns.empty()) {
+        return SolverBackend::Cholesky;
+    }
+    Eigen::Index min_row = system.unknowns[0].row, max_row = min_row;
+    Eigen::Index min_col = system.unknowns[0].col, max_col = min_col;
+    for (auto const& [row, col] : system.unknowns) {
+        min_row = std::min(min_row, row);
+        max_row = std::max(max_row, row);
+        min_col = std::min(min_col, col);
+        max_col = std::max(max_col, col);
+    }
+    Eigen::Index longest_side = std::max(max_row - min_row, max_col - min_col) + 1;
+    f64 thickness = (f64)system.size() / (f64)longest_side;
+
+    bool thin = thickness <= thresholds.thin_width && (f64)system.size() * thickness <= thresholds.max_thin_fill;
+    bool direct = system.size() <= thresholds.direct_size || thin;
+    SolverBackend backend = direct ? SolverBackend::Cholesky : SolverBackend::MultigridConjugateGradient;
+    logger->debug("Region with {} unknowns ({:.1f} pixels thick): {}", system.size(), thickness, direct ? "direct solver" : "multigrid");
+    return backend;
+}
+}
@@ -0,0 +1,112 @@
+#include "approx/fast_poisson.h"
+
+#include <complex>
+#include <numbers>
+#include <unsupported/Eigen/FFT>
+#include <utils/log.h>
+
+namespace approx {
+static auto logger = utils::create_logger("approx::fast_poisson");
+
+// The sine transform (DST-I) of every column: y_k = sum_j x_j sin(pi j k / (n + 1)), from the Fourier transform of the
+// odd extension of the column (0, x, 0, -reversed x). Applying it twice multiplies by (n + 1) / 2
+static void sine_transform_columns(MatX<f64>& values)
+{
+    Eigen::Index n = values.rows();
+#pragma omp parallel if (values.cols() > 64)
+    {
+        // The FFT caches its plans, so every thread has its own
+        Eigen::FFT<f64> fft;
+        VecX<f64> extended = VecX<f64>::Zero(2 * (n + 1));
+        VecX<std::complex<f64>> spectrum;
+#pragma omp for
+        for (long col = 0; col < (long)values.cols(); ++col) {
+            extended.segment(1, n) = values.col(col);
+            extended.segment(n + 2, n) = -values.col(col).reverse();
+            fft.fwd(spectrum, extended);
+            values.col(col) = -0.5 * spectrum.segment(1, n).imag();
+        }
+    }
+}
+
+static void sine_transform(MatX<f64>& values)
+{
+    sine_transform_columns(values);
+    MatX<f64> transposed = values.transpose();
+    sine_transform_columns(transposed);
+    values = transposed.transpose();
+}
+
+Eigen::Index fast_sine_transform_size(Eigen::Index size)
+{
+    for (Eigen::Index n = std::max<Eigen::Index>(size, 1);; ++n) {
+        Eigen::Index remainder = n + 1;
+        for (Eigen::Index factor : { 2, 3, 5 }) {
+            while (remainder % factor == 0) {
+                remainder /= factor;
+            }
+        }
+        if (remainder == 1) {
+            return n;
+        }
+    }
+}
+
+SineTransformSolver::SineTransformSolver(Eigen::Index rows, Eigen::Index cols)
+{
+    // The eigenvalues of the 1D Laplacians of the columns and the rows add up
+    VecX<f64> row_eigenvalues(rows), col_eigenvalues(cols);
+    for (Eigen::Index j = 0; j < rows; ++j) {
+        row_eigenvalues[j] = 2.0 - 2.0 * std::cos(std::numbers::pi * (f64)(j + 1) / (f64)(rows + 1));
+    }
+    for (Eigen::Index k = 0; k < cols; ++k) {
+        col_eigenvalues[k] = 2.0 - 2.0 * std::cos(std::numbers::pi * (f64)(k + 1) / (f64)(cols + 1));
+    }
+    m_eigenvalues = row_eigenvalues.replicate(1, cols) + col_eigenvalues.transpose().replicate(rows, 1);
+}
+
+MatX<f64> SineTransformSolver::solve(MatX<f64> const& b) const
+{
+    MatX<f64> x = b;
+    sine_transform(x);
+    x.array() /= m_eigenvalues.array();
+    sine_transform(x);
+    // The inverse transform is the same transform, scaled
+    return x * (4.0 / (f64)((rows() + 1) * (cols() + 1)));
+}
+
+void SineTransformPreconditioner::setup(Eigen::Index rows)
+{
+    if ((Eigen::Index)m_unknowns.size() != rows) {
+        logger->error("The sine transform preconditioner needs the pixel of every unknown ({} unknowns, {} pixels)", rows, m_unknowns.size());
+        m_info = Eigen::InvalidInput;
+        return;
+    }
+    if (m_unknowns.empty()) {
+        m_info = Eigen::Success;
+        return;
+    }
+    index_t last = m_unknowns.front();
+    m_origin = m_unknowns.front();
+    for (auto const& [row, col] : m_unknowns) {
+        m_origin = { std::min(m_origin.row, row), std::min(m_origin.col, col) };
+        last = { std::max(last.row, row), std::max(last.col, col) };
+    }
+    m_solver = SineTransformSolver(fast_sine_transform_size(last.row - m_origin.row + 1), fast_sine_transform_size(last.col - m_origin.col + 1));
+    m_info = Eigen::Success;
+}
+
+VecX<f64> SineTransformPreconditioner::apply(VecX<f64> const& b) const
+{
+    MatX<f64> rectangle = MatX<f64>::Zero(m_solver.rows(), m_solver.cols());
+    for (size_t i = 0; i < m_unknowns.size(); ++i) {
+        rectangle(m_unknowns[i].row - m_origin.row, m_unknowns[i].col - m_origin.col) = b[(Eigen::Index)i];
+    }
+    MatX<f64> solution = m_solver.solve(rectangle);
+    VecX<f64> x(b.rows());
+    for (size_t i = 0; i < m_unknowns.size(); ++i) {
+        x[(Eigen::Index)i] = solution(m_unknowns[i].row - m_origin.row, m_unknowns[i].col - m_origin.col);
+    }
+    return x;
+}
+}
@@ -1,5 +1,7 @@
 #include "approx/laplace.h"
 #include "approx/db.h"
+#include "approx/dispatch.h"
+#include "approx/tuning.h"
 #include "utils/eigen.h"
 #include "utils/filesystem.h"
 #include "utils/geotiff.h"
@@ -20,7 +22,8 @@ using namespace ranges;
 namespace approx {
 static auto logger = utils::create_logger("approx::laplace");
 
-bool on_border(Eigen::Index row, Eigen::Index col, MatX<f64> const& image)
+template<typename T>
+bool on_border(Eigen::Index row, Eigen::Index col, MatX<T> const& image)
 {
     bool row_border = row == 0 || row == image.rows() - 1;
     bool col_border = col == 0 || col == image.cols() - 1;
@@ -28,107 +31,611 @@ bool on_border(Eigen::Index row, Eigen::Index col, MatX<f64> const& image)
     return row_border || col_border;
 }
 
-void solve_matrix(MatX<f64>& input, MatX<bool> const& invalid_mask)
+static void flood_region(MatX<bool> const& invalid, MatX<int>& labels, int label, index_t seed, std::vector<index_t>* pixels)
 {
-    std::vector<index_t> invalid_pixels;
-    for (Eigen::Index row = 0; row < invalid_mask.rows(); ++row) {
-        for (Eigen::Index col = 0; col < invalid_mask.cols(); ++col) {
-            if (invalid_mask(row, col)) {
-                invalid_pixels.push_back({ row, col });
+    std::queue<index_t> queue;
+    queue.push(seed);
+    labels(seed.row, seed.col) = label;
+
+    while (!queue.empty()) {
+        index_t current = queue.front();
+        queue.pop();
+        if (pixels != nullptr) {
+            pixels->push_back(current);
+        }
+
+        for (auto const& [row, col] : valid_neighbours(invalid, current)) {
+            if (invalid(row, col) && labels(row, col) == 0) {
+                labels(row, col) = label;
+                queue.push({ row, col });
             }
         }
     }
-    if (invalid_pixels.empty()) {
-        logger->info("Could not perform approximation: no invalid pixels");
-        return;
+}
+
+std::vector<index_t> flood(MatX<bool> const& invalid, Eigen::Index row, Eigen::Index col)
+{
+    std::vector<index_t> pixels;
+    if (!within_bounds(invalid, { row, col }) || !invalid(row, col)) {
+        return pixels;
     }
 
-    auto [min_row, max_row] = minmax(invalid_pixels | views::transform([](index_t i) { return i.row; }));
-    auto [min_col, max_col] = minmax(invalid_pixels | views::transform([](index_t i) { return i.col; }));
+    MatX<int> labels = MatX<int>::Zero(invalid.rows(), invalid.cols());
+    flood_region(invalid, labels, 1, { row, col }, &pixels);
+    return pixels;
+}
 
-    auto height = (max_row - min_row) + 1;
-    auto width = (max_col - min_col) + 1;
+ConnectedComponents find_connected_components(MatX<bool> const& invalid)
+{
+    ConnectedComponents components;
+    components.matrix = MatX<int>::Zero(invalid.rows(), invalid.cols());
+
+    int label = 0;
+    for (Eigen::Index row = 0; row < invalid.rows(); ++row) {
+        for (Eigen::Index col = 0; col < invalid.cols(); ++col) {
+            if (invalid(row, col) && components.matrix(row, col) == 0) {
+                label += 1;
+                flood_region(invalid, components.matrix, label, { row, col }, nullptr);
+            }
+        }
+    }
 
-    auto matrix_size = height * width;
+    // Collect the pixels in a second pass so that every region is stored in raster order
+    for (Eigen::Index row = 0; row < invalid.rows(); ++row) {
+        for (Eigen::Index col = 0; col < invalid.cols(); ++col) {
+            int l = components.matrix(row, col);
+            if (l != 0) {
+                components.region_map[l].push_back({ row, col });
+            }
+        }
+    }
 
-    auto index = [&](Eigen::Index row, Eigen::Index col) {
-        return (col - min_col) + (row - min_row) * width;
-    };
+    return components;
+}
 
-    Eigen::VectorXd b(matrix_size);
-    b.setZero();
+std::vector<int> ConnectedComponents::labels_by_size() const
+{
+    std::vector<int> labels;
+    labels.reserve(region_map.size());
+    for (auto const& [label, pixels] : region_map) {
+        labels.push_back(label);
+    }
+    std::sort(labels.begin(), labels.end(), [&](int a, int b) {
+        return region_map.at(a).size() > region_map.at(b).size();
+    });
+    return labels;
+}
 
-    std::vector<triplet_t> coefficients;
+// Visit the (up to) 4 pixels of the fine level that are combined into a pixel of the coarse level
+template<typename Function>
+static void for_each_child(Eigen::Index rows, Eigen::Index cols, Eigen::Index row, Eigen::Index col, Function&& function)
+{
+    for (Eigen::Index c = 2 * col; c < std::min(2 * col + 2, cols); ++c) {
+        for (Eigen::Index r = 2 * row; r < std::min(2 * row + 2, rows); ++r) {
+            function(r, c);
+        }
+    }
+}
 
-    auto dirichlet_boundary_constraint_row = [&](Eigen::Index row, Eigen::Index col) {
-        // Results in a row with [... 0 0 1 0 0 ... ]
-        // And the corresponding value in the b vector: [ ... 0 0 v 0 0 ...]^T
-        auto i = index(row, col); // This is producing a value that is out of bounds... I wonder why?
-        coefficients.emplace_back(i, i, 1.0);
-        b[i] = input(row, col);
+// The levels of the pull-push pyramid: the weight of every pixel (how much of it is known, between 0 and 1), from the
+// full resolution level down to a single pixel
+static std::vector<MatX<f64>> pull_weights(MatX<bool> const& invalid_pixels)
+{
+    std::vector<MatX<f64>> weights;
+    weights.emplace_back((!invalid_pixels.array()).cast<f64>());
+    while (weights.back().rows() > 1 || weights.back().cols() > 1) {
+        MatX<f64> const& fine = weights.back();
+        MatX<f64> coarse = MatX<f64>::Zero((fine.rows() + 1) / 2, (fine.cols() + 1) / 2);
+#pragma omp parallel for if (coarse.cols() > 256)
+        for (Eigen::Index col = 0; col < coarse.cols(); ++col) {
+            for (Eigen::Index row = 0; row < coarse.rows(); ++row) {
+                for_each_child(fine.rows(), fine.cols(), row, col, [&](Eigen::Index r, Eigen::Index c) {
+                    coarse(row, col) += fine(r, c);
+                });
+            }
+        }
+        // A coarse pixel is fully known as soon as its children add up to one known pixel
+        weights.emplace_back(coarse.cwiseMin(1.0));
+    }
+    return weights;
+}
+
+// Sample a coarse level at the position of a pixel of the level above it (bilinear interpolation). Coarse pixel i
+// covers the fine pixels 2i and 2i + 1, so its center is at 2i + 0.5
+static f64 sample_coarse(MatX<f64> const& coarse, Eigen::Index fine_row, Eigen::Index fine_col)
+{
+    auto position = [](Eigen::Index fine, Eigen::Index size, Eigen::Index& low, f64& t) {
+        f64 x = std::clamp(0.5 * ((f64)fine - 0.5), 0.0, (f64)(size - 1));
+        low = std::min((Eigen::Index)x, size - 1);
+        t = x - (f64)low;
     };
+    Eigen::Index r0, c0;
+    f64 tr, tc;
+    position(fine_row, coarse.rows(), r0, tr);
+    position(fine_col, coarse.cols(), c0, tc);
+    Eigen::Index r1 = std::min(r0 + 1, coarse.rows() - 1);
+    Eigen::Index c1 = std::min(c0 + 1, coarse.cols() - 1);
+    return (1.0 - tc) * ((1.0 - tr) * coarse(r0, c0) + tr * coarse(r1, c0)) + tc * ((1.0 - tr) * coarse(r0, c1) + tr * coarse(r1, c1));
+}
 
-    auto set_coefficient = [&](Eigen::Index row, Eigen::Index col, int row_offset, int col_offset, f64 v) {
-        auto i = index(row, col);
-        Eigen::Index row2 = row + row_offset;
-        Eigen::Index col2 = col + col_offset;
+template<typename T>
+static void pull_push_channel(MatX<T>& image, std::vector<MatX<f64>> const& weights, bool parallel)
+{
+    // Pull: every coarse pixel is the weighted average of its (up to) 4 children
+    std::vector<MatX<f64>> values;
+    values.emplace_back((weights[0].array() > 0.0).select(image.template cast<f64>(), 0.0));
+    for (size_t level = 1; level < weights.size(); ++level) {
+        MatX<f64> const& fine = values.back();
+        MatX<f64> const& fine_weights = weights[level - 1];
+        MatX<f64> coarse = MatX<f64>::Zero(weights[level].rows(), weights[level].cols());
+#pragma omp parallel for if (parallel && coarse.cols() > 256)
+        for (Eigen::Index col = 0; col < coarse.cols(); ++col) {
+            for (Eigen::Index row = 0; row < coarse.rows(); ++row) {
+                f64 sum = 0.0, total = 0.0;
+                for_each_child(fine.rows(), fine.cols(), row, col, [&](Eigen::Index r, Eigen::Index c) {
+                    sum += fine_weights(r, c) * fine(r, c);
+                    total += fine_weights(r, c);
+                });
+                coarse(row, col) = total > 0.0 ? sum / total : 0.0;
+            }
+        }
+        values.push_back(std::move(coarse));
+    }
 
-        f64 pixel = input(row2, col2);
-        if (!invalid_mask(row2, col2)) {
-            // If we know the value, then we move it into the b vector
-            // to keep symmetry with the dirichlet boundary constraint rows.
-            b[i] -= v * pixel;
-            return;
+    // Push: the parts of a pixel that are not known are taken from the (interpolated) level below it
+    for (size_t level = values.size() - 1; level-- > 0;) {
+        MatX<f64>& fine = values[level];
+        MatX<f64> const& coarse = values[level + 1];
+        MatX<f64> const& fine_weights = weights[level];
+#pragma omp parallel for if (parallel && fine.cols() > 256)
+        for (Eigen::Index col = 0; col < fine.cols(); ++col) {
+            for (Eigen::Index row = 0; row < fine.rows(); ++row) {
+                f64 w = fine_weights(row, col);
+                if (w < 1.0) {
+                    fine(row, col) = w * fine(row, col) + (1.0 - w) * sample_coarse(coarse, row, col);
+                }
+            }
         }
-        auto j = index(row2, col2);
-        coefficients.emplace_back(i, j, v);
-    };
+    }
+
+    image = (weights[0].array() > 0.0).select(image, values[0].cast<T>());
+}
 
-    auto laplacian_row = [&](Eigen::Index row, Eigen::Index col) {
-        // Finite difference to construct laplacian
-        set_coefficient(row, col, -1, 0, 1.0);
-        set_coefficient(row, col, +1, 0, 1.0);
-        set_coefficient(row, col, 0, -1, 1.0);
-        set_coefficient(row, col, 0, +1, 1.0);
-        set_coefficient(row, col, 0, 0, -4.0);
+template<typename T>
+static void pull_push_fill(BasicMultiChannelImage<T>& input_images, MatX<bool> const& invalid_pixels)
+{
+    for (auto const& image : input_images.images) {
+        if (image.rows() != invalid_pixels.rows() || image.cols() != invalid_pixels.cols()) {
+            throw std::runtime_error(fmt::format("Input image and mask are not the same size ({} vs {})",
+                image.size(), invalid_pixels.size()));
+        }
+    }
+    if (invalid_pixels.size() == 0 || !invalid_pixels.any()) {
+        logger->info("Could not perform approximation: no invalid pixels");
+        return;
+    }
+    if (invalid_pixels.all()) {
+        logger->warn("Could not perform approximation: every pixel is invalid");
+        return;
+    }
+
+    spdlog::stopwatch sw;
+    std::vector<MatX<f64>> weights = pull_weights(invalid_pixels);
+    // A single channel is parallelized over the columns instead
+    bool per_channel = input_images.images.size() > 1;
+#pragma omp parallel for if (per_channel)
+    for (long c = 0; c < (long)input_images.images.size(); ++c) {
+        pull_push_channel(input_images.images[(size_t)c], weights, !per_channel);
+    }
+    logger->debug("It took {} seconds to fill {} channels with pull-push ({} levels)", sw, input_images.images.size(), weights.size());
+}
+
+// Solve the laplace equation over a single connected region, for every channel of the image.
+// Returns the new values of the region pixels (in the same order as the pixels) for each channel, and records the solve
+template<typename T>
+std::vector<VecX<f64>> solve_matrix(BasicMultiChannelImage<T> const& input, std::vector<index_t> const& pixels,
+    MultiChannelImage const* guess, SolverOptions const& options, ToleranceTuner const* tuner, deadline_t deadline,
+    FillResult& result, PerfInfo& perf_info)
+{
+    MatX<T> const& first = input[0];
+
+    // Only the invalid pixels are unknowns: the pixels on the border of the image are assumed to be "known"
+    // (even though they may or may not actually be known), and keep their current value.
+    StencilSystem system;
+    for (auto const& [row, col] : pixels) {
+        if (!on_border(row, col, first)) {
+            system.unknowns.push_back({ row, col });
+        }
+    }
+    auto num_unknowns = system.size();
+
+    std::vector<VecX<f64>> region_values(input.images.size(), VecX<f64>(pixels.size()));
+    if (num_unknowns == 0) {
+        for (size_t c = 0; c < input.images.size(); ++c) {
+            for (size_t i = 0; i < pixels.size(); ++i) {
+                region_values[c][(Eigen::Index)i] = input(c, pixels[i].row, pixels[i].col);
+            }
+        }
+        return region_values;
+    }
+
+    // Finite difference to construct the (negative) laplacian: 4 on the diagonal, and -1 for each neighbour.
+    // If we know the value of a neighbour, then we move it into the b vector, which keeps the system symmetric positive definite.
+    // The unknowns are never on the border of the image, so all four neighbours always exist.
+    StencilKernels<f64, Boundary::Interior> kernels(system.unknowns, first.rows(), first.cols());
+    system.diagonal = kernels.diagonal();
+
+    // This will always be a symmetric positive definite system
+    // See: https://eigen.tuxfamily.org/dox/group__TopicSparseSystems.html
+    // The matrix only depends on the mask, so it is set up once and reused for every channel. The tolerance is tuned
+    // for the backend that was picked for the region
+    LinearSolver solver(system, options, deadline);
+    if (tuner != nullptr) {
+        solver.set_tolerance(tuner->tolerance((long)num_unknowns, solver.backend(), solver.preconditioner(), options.tolerance));
+    }
+    auto num_channels = (Eigen::Index)input.images.size();
+    MatX<f64> B(num_unknowns, num_channels);
+    for (Eigen::Index c = 0; c < num_channels; ++c) {
+        B.col(c) = kernels.right_hand_side(input.images[(size_t)c]);
+    }
+
+    MatX<f64> guesses = MatX<f64>::Zero(num_unknowns, num_channels);
+    if (guess != nullptr) {
+        for (Eigen::Index c = 0; c < num_channels; ++c) {
+            guesses.col(c) = kernels.values(guess->images[(size_t)c]);
+        }
+    }
+    auto start = std::chrono::steady_clock::now();
+    MatX<f64> values = solver.solveWithGuess(B, guesses);
+    auto end = std::chrono::steady_clock::now();
+    result = solver.result();
+    perf_info = PerfInfo {
+        .method = ApproxMethod::Laplace,
+        .region_size = (long)num_unknowns,
+        .tolerance = solver.tolerance(),
+        .max_iterations = solver.max_iterations(),
+        .iterations = solver.iterations(),
+        .solves = solver.solves(),
+        .error = solver.error(),
+        .solve_time = static_cast<f64>(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()),
+        .backend = solver.backend(),
+        .automatic = options.backend == SolverBackend::Automatic,
+        .preconditioner = solver.preconditioner(),
+        .setup_time = solver.setup_time(),
+        .deadline_reached = solver.deadline_reached()
     };
+    if (solver.deadline_reached()) {
+        logger->debug("Stopped a region with {} unknowns at the deadline ({} iterations, {:.4e} error)", num_unknowns, solver.iterations(), solver.error());
+    } else if (solver.info() != Eigen::Success) {
+        logger->warn("Solver did not converge for a region with {} unknowns ({} iterations, {:.4e} error)", num_unknowns, solver.iterations(), solver.error());
+    } else if (options.measure_visual_error && options.perf_database.has_value() && solver.backend() != SolverBackend::Cholesky) {
+        // The direct solution is exact, so only the iterative solves are measured
+        perf_info.visual_error = measure_visual_error(solver, B, values);
+    }
+
+    // The unknowns are in the same order as the pixels, with the pixels on the border of the image left out
+    for (Eigen::Index c = 0; c < num_channels; ++c) {
+        Eigen::Index v = 0;
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            auto const& [row, col] = pixels[i];
+            region_values[c][(Eigen::Index)i] = on_border(row, col, first) ? input(c, row, col) : values(v++, c);
+        }
+    }
+    return region_values;
+}
+
+template<typename T>
+static FillResult fill_regions(BasicMultiChannelImage<T>& input_images, MatX<bool> const& invalid_pixels, SolverOptions const& options)
+{
+    if (input_images.images.empty()) {
+        throw std::runtime_error("Cannot fill missing portion: the image has no channels");
+    }
+    for (auto const& image : input_images.images) {
+        if (image.rows() != invalid_pixels.rows() || image.cols() != invalid_pixels.cols()) {
+            throw std::runtime_error(fmt::format("Input image and mask are not the same size ({} vs {})",
+                image.size(), invalid_pixels.size()));
+        }
+    }
+
+    spdlog::stopwatch sw;
+    deadline_t deadline = start_deadline(options);
+    auto components = find_connected_components(invalid_pixels);
+    if (components.region_map.empty()) {
+        logger->info("Could not perform approximation: no invalid pixels");
+        return {};
+    }
+
+    // Calibrate before the regions are solved concurrently, so the timings are not skewed by the other threads, and
+    // hand the thresholds to the solver of every region
+    SolverOptions region_options = options;
+    if (options.backend == SolverBackend::Automatic && !options.dispatch.has_value()) {
+        region_options.dispatch = dispatch_thresholds(options.tolerance);
+    }
 
-    for (auto [row, col] : views::cartesian_product(
-             views::ints(min_row, max_row + 1), views::ints(min_col, max_col + 1))) {
-        // If we are on the border, we assume that the pixel is "known" (even though they may or may not actually be known)
-        if (on_border(row, col, input)) {
-            dirichlet_boundary_constraint_row(row, col);
-        } else if (invalid_mask(row, col)) {
-            laplacian_row(row, col);
+    std::optional<ToleranceTuner> tuner;
+    if (options.tuning.has_value()) {
+        if (options.perf_database.has_value()) {
+            tuner.emplace(PerfDataBase(*options.perf_database).select_perf_info(), *options.tuning, ApproxMethod::Laplace);
         } else {
-            dirichlet_boundary_constraint_row(row, col);
+            logger->warn("Not tuning the tolerance: the options do not have a database to tune it from");
         }
     }
 
-    sparse_t A(matrix_size, matrix_size);
-    A.setFromTriplets(coefficients.begin(), coefficients.end());
+    // The pull-push fill is computed once for the whole image, and then shared by all of the regions
+    std::optional<MultiChannelImage> guess;
+    if (options.pull_push_guess) {
+        guess.emplace();
+        for (auto const& image : input_images.images) {
+            guess->images.emplace_back(image.template cast<f64>());
+        }
+        pull_push_fill(*guess, invalid_pixels);
+    }
 
-    // This will always be a symmetric positive definite system, so we can use cholesky LDLt factorization
-    // See: https://eigen.tuxfamily.org/dox/group__TopicSparseSystems.html
-    SparseSolver chol(A);
-    VecX<f64> values = chol.solve(b);
+    // The regions are sorted from largest to smallest, and handed out one at a time (dynamic scheduling) to whichever
+    // thread is free. The largest regions start first, so a large region is not left to run on its own at the end
+    std::vector<int> labels = components.labels_by_size();
+    std::vector<std::vector<VecX<f64>>> solutions(labels.size());
+    std::vector<FillResult> results(labels.size());
+    std::vector<PerfInfo> records(labels.size());
+
+    // The regions are independent, so they can be solved concurrently. The values are only
+    // written back into the image once every region has been solved, since the systems read from it.
+    // The regions that are split into subdomains (the largest ones) are solved in parallel on their own first
+    auto solve_region = [&](long i) {
+        int label = labels[(size_t)i];
+        solutions[(size_t)i] = solve_matrix(input_images, components.region_map.at(label), guess.has_value() ? &*guess : nullptr, region_options,
+            tuner.has_value() ? &*tuner : nullptr, deadline, results[(size_t)i], records[(size_t)i]);
+    };
+    long first_concurrent = 0;
+    while (first_concurrent < (long)labels.size() && decomposes_region(options, (long)components.region_map.at(labels[(size_t)first_concurrent]).size())) {
+        solve_region(first_concurrent++);
+    }
+#pragma omp parallel for schedule(dynamic)
+    for (long i = first_concurrent; i < (long)labels.size(); ++i) {
+        solve_region(i);
+    }
 
-    // Move the solution values into the image
-    for (auto [row, col] : invalid_pixels) {
-        input(row, col) = values[index(row, col)];
+    FillResult result;
+    for (auto const& region_result : results) {
+        result.merge(region_result);
+    }
+
+    for (size_t i = 0; i < labels.size(); ++i) {
+        auto const& pixels = components.region_map.at(labels[i]);
+        for (size_t c = 0; c < input_images.images.size(); ++c) {
+            for (size_t p = 0; p < pixels.size(); ++p) {
+                input_images(c, pixels[p].row, pixels[p].col) = static_cast<T>(solutions[i][c][(Eigen::Index)p]);
+            }
+        }
+    }
+    if (options.perf_database.has_value()) {
+        // The regions without unknowns (on the border of the image) were not solved
+        std::erase_if(records, [](PerfInfo const& info) { return info.region_size == 0; });
+        PerfDataBase(*options.perf_database).write_perf_info(records);
     }
+    logger->debug("It took {} seconds to solve {} regions ({} channels)", sw, labels.size(), input_images.images.size());
+    return result;
 }
 
-void fill_missing_portion_smooth_boundary(MatX<f64>& input_image, MatX<bool> const& invalid_pixels)
+template<typename T>
+static FillResult fill_single_channel(MatX<T>& input_image, MatX<bool> const& invalid_pixels, SolverOptions const& options)
 {
     if (input_image.size() != invalid_pixels.size()) {
         throw std::runtime_error(fmt::format("Input image and mask are not the same size ({} vs {})",
             input_image.size(), invalid_pixels.size()));
     }
 
+    BasicMultiChannelImage<T> images({ std::move(input_image) });
+    FillResult result = fill_regions(images, invalid_pixels, options);
+    input_image = std::move(images[0]);
+    return result;
+}
+
+FillResult fill_missing_portion_smooth_boundary(MultiChannelImage& input_images, MatX<bool> const& invalid_pixels, SolverOptions const& options)
+{
+    return fill_regions(input_images, invalid_pixels, options);
+}
+
+FillResult fill_missing_portion_smooth_boundary(MultiChannelImageF32& input_images, MatX<bool> const& invalid_pixels, SolverOptions const& options)
+{
+    return fill_regions(input_images, invalid_pixels, options);
+}
+
+std::vector<MatX<f64>> fill_missing_portion_smooth_boundary(std::vector<MatX<f64>> const& input_images, MatX<bool> const& invalid_pixels, SolverOptions const& options)
+{
+    MultiChannelImage images(input_images);
+    fill_missing_portion_smooth_boundary(images, invalid_pixels, options);
+    return images.images;
+}
+
+std::vector<MatX<f32>> fill_missing_portion_smooth_boundary(std::vector<MatX<f32>> const& input_images, MatX<bool> const& invalid_pixels, SolverOptions const& options)
+{
+    MultiChannelImageF32 images(input_images);
+    fill_missing_portion_smooth_boundary(images, invalid_pixels, options);
+    return images.images;
+}
+
+FillResult fill_missing_portion_smooth_boundary(MatX<f64>& input_image, MatX<bool> const& invalid_pixels, SolverOptions const& options)
+{
+    return fill_single_channel(input_image, invalid_pixels, options);
+}
+
+FillResult fill_missing_portion_smooth_boundary(MatX<f32>& input_image, MatX<bool> const& invalid_pixels, SolverOptions const& options)
+{
+    return fill_single_channel(input_image, invalid_pixels, options);
+}
+
+// The columns are relaxed in blocks. A column reads its two neighbouring columns, so neighbouring blocks are never
+// relaxed at the same time: the even blocks go first, then the odd ones
+static constexpr Eigen::Index sor_block_cols = 32;
+
+// The part of the image that contains every unknown (the rows and columns are inclusive)
+struct SORBounds {
+    Eigen::Index first_row;
+    Eigen::Index rows;
+    Eigen::Index first_col;
+    Eigen::Index last_col;
+};
+
+// One half-sweep over the pixels of one color. Only the opposite color is read for the pixels that are updated, so the
+// columns can be updated in place
+static void sor_half_sweep(MatX<f64>& image, MatX<f64> const& color, SORBounds const& bounds, f64 omega)
+{
+    auto relax_column = [&](Eigen::Index col) {
+        auto center = image.col(col).segment(bounds.first_row, bounds.rows).array();
+        auto up = image.col(col).segment(bounds.first_row - 1, bounds.rows).array();
+        auto down = image.col(col).segment(bounds.first_row + 1, bounds.rows).array();
+        auto left = image.col(col - 1).segment(bounds.first_row, bounds.rows).array();
+        auto right = image.col(col + 1).segment(bounds.first_row, bounds.rows).array();
+        auto mask = color.col(col).segment(bounds.first_row, bounds.rows).array();
+        // A select rather than a multiplication by the mask, so that non-finite known pixels are left alone
+        center = mask.select(center + omega * (0.25 * (up + down + left + right) - center), center);
+    };
+
+    Eigen::Index num_cols = bounds.last_col - bounds.first_col + 1;
+    long num_blocks = (long)((num_cols + sor_block_cols - 1) / sor_block_cols);
+    for (long parity = 0; parity < 2; ++parity) {
+#pragma omp parallel for if (num_cols > 256)
+        for (long block = parity; block < num_blocks; block += 2) {
+            Eigen::Index begin = bounds.first_col + block * sor_block_cols;
+            Eigen::Index end = std::min(begin + sor_block_cols, bounds.last_col + 1);
+            for (Eigen::Index col = begin; col < end; ++col) {
+                relax_column(col);
+            }
+        }
+    }
+}
+
+// The norm of 4 x - (sum of the neighbours) over the unknowns, i.e. |b - A x| of the equivalent sparse system
+static f64 sor_residual_norm(MatX<f64> const& image, MatX<f64> const& unknowns, SORBounds const& bounds)
+{
+    f64 sum = 0.0;
+#pragma omp parallel for reduction(+ : sum) if (bounds.last_col - bounds.first_col > 256)
+    for (Eigen::Index col = bounds.first_col; col <= bounds.last_col; ++col) {
+        auto center = image.col(col).segment(bounds.first_row, bounds.rows).array();
+        auto up = image.col(col).segment(bounds.first_row - 1, bounds.rows).array();
+        auto down = image.col(col).segment(bounds.first_row + 1, bounds.rows).array();
+        auto left = image.col(col - 1).segment(bounds.first_row, bounds.rows).array();
+        auto right = image.col(col + 1).segment(bounds.first_row, bounds.rows).array();
+        auto mask = unknowns.col(col).segment(bounds.first_row, bounds.rows).array();
+        sum += mask.select(4.0 * center - up - down - left - right, 0.0).square().sum();
+    }
+    return std::sqrt(sum);
+}
+
+SORFillResult fill_missing_portion_sor(MatX<f64>& input_image, MatX<bool> const& invalid_pixels, SORFillOptions const& options)
+{
+    if (input_image.rows() != invalid_pixels.rows() || input_image.cols() != invalid_pixels.cols()) {
+        throw std::runtime_error(fmt::format("Input image and mask are not the same size ({} vs {})",
+            input_image.size(), invalid_pixels.size()));
+    }
+
+    // Same as the sparse path: the pixels on the border of the image are known
+    SORFillResult result;
+    Eigen::Index rows = input_image.rows();
+    Eigen::Index cols = input_image.cols();
+    if (rows < 3 || cols < 3) {
+        return result;
+    }
+    MatX<f64> unknowns = MatX<f64>::Zero(rows, cols);
+    unknowns.block(1, 1, rows - 2, cols - 2) = invalid_pixels.block(1, 1, rows - 2, cols - 2).cast<f64>();
+
+    Eigen::Index min_row = rows, max_row = -1, min_col = cols, max_col = -1;
+    for (Eigen::Index col = 1; col < cols - 1; ++col) {
+        for (Eigen::Index row = 1; row < rows - 1; ++row) {
+            if (unknowns(row, col) != 0.0) {
+                min_row = std::min(min_row, row);
+                max_row = std::max(max_row, row);
+                min_col = std::min(min_col, col);
+                max_col = std::max(max_col, col);
+            }
+        }
+    }
+    if (max_row < 0) {
+        logger->info("Could not perform approximation: no invalid pixels");
+        result.converged = true;
+        return result;
+    }
+    SORBounds bounds { min_row, max_row - min_row + 1, min_col, max_col };
+
+    // The optimal over-relaxation factor for the laplacian on a rectangle with the size of the bounding box is
+    // 2 / (1 + sqrt(1 - rho^2)), with rho the spectral radius of the Jacobi iteration
+    f64 rho = 0.5 * (std::cos(EIGEN_PI / (f64)(bounds.rows + 1)) + std::cos(EIGEN_PI / (f64)(max_col - min_col + 2)));
+    f64 omega = options.omega.value_or(2.0 / (1.0 + std::sqrt(1.0 - rho * rho)));
+    if (omega <= 0.0 || omega >= 2.0) {
+        throw std::runtime_error(fmt::format("SOR relaxation factor must be between 0 and 2 (got {})", omega));
+    }
+
+    MatX<f64> red = MatX<f64>::Zero(rows, cols);
+    MatX<f64> black = MatX<f64>::Zero(rows, cols);
+    for (Eigen::Index col = min_col; col <= max_col; ++col) {
+        for (Eigen::Index row = min_row; row <= max_row; ++row) {
+            ((row + col) % 2 == 0 ? red : black)(row, col) = unknowns(row, col);
+        }
+    }
+
+    // The unknowns start from their current values, which makes it possible to continue from a previous fill.
+    // Values that cannot be a starting point (nodata stored as NaN) start from zero instead
+    input_image = (unknowns.array() != 0.0 && !input_image.array().isFinite()).select(0.0, input_image);
+
+    // |b| is the residual with every unknown set to zero
+    MatX<f64> zeroed = (unknowns.array() != 0.0).select(0.0, input_image);
+    f64 b_norm = sor_residual_norm(zeroed, unknowns, bounds);
+    if (b_norm == 0.0) {
+        input_image = (unknowns.array() != 0.0).select(0.0, input_image);
+        result.converged = true;
+        return result;
+    }
+
     spdlog::stopwatch sw;
-    solve_matrix(input_image, invalid_pixels);
-    logger->debug("It took {} seconds to solve the problem", sw);
+    long check_every = std::max<long>(options.check_every, 1);
+    result.error = sor_residual_norm(input_image, unknowns, bounds) / b_norm;
+    while (result.error > options.tolerance && result.sweeps < options.max_sweeps) {
+        sor_half_sweep(input_image, red, bounds, omega);
+        sor_half_sweep(input_image, black, bounds, omega);
+        result.sweeps += 1;
+        if (result.sweeps % check_every == 0 || result.sweeps == options.max_sweeps) {
+            result.error = sor_residual_norm(input_image, unknowns, bounds) / b_norm;
+        }
+    }
+    result.converged = result.error <= options.tolerance;
+
+    if (!result.converged) {
+        logger->warn("SOR fill did not converge ({} sweeps, {:.4e} error)", result.sweeps, result.error);
+    }
+    logger->debug("It took {} seconds to fill {}x{} pixels with SOR (omega {:.4f}, {} sweeps)", sw, bounds.rows, max_col - min_col + 1, omega, result.sweeps);
+    return result;
+}
+
+void fill_missing_portion_pull_push(MultiChannelImage& input_images, MatX<bool> const& invalid_pixels)
+{
+    pull_push_fill(input_images, invalid_pixels);
+}
+
+void fill_missing_portion_pull_push(MultiChannelImageF32& input_images, MatX<bool> const& invalid_pixels)
+{
+    pull_push_fill(input_images, invalid_pixels);
+}
+
+void fill_missing_portion_pull_push(MatX<f64>& input_image, MatX<bool> const& invalid_pixels)
+{
+    MultiChannelImage images({ std::move(input_image) });
+    pull_push_fill(images, invalid_pixels);
+    input_image = std::move(images[0]);
+}
+
+void fill_missing_portion_pull_push(MatX<f32>& input_image, MatX<bool> const& invalid_pixels)
+{
+    MultiChannelImageF32 images({ std::move(input_image) });
+    pull_push_fill(images, invalid_pixels);
+    input_image = std::move(images[0]);
+}
+
+std::vector<MatX<f64>> fill_missing_portion_pull_push(std::vector<MatX<f64>> const& input_images, MatX<bool> const& invalid_pixels)
+{
+    MultiChannelImage images(input_images);
+    pull_push_fill(images, invalid_pixels);
+    return images.images;
 }
 
 cv::Mat apply_laplace(cv::Mat const &image, cv::Mat const &invalid_image, f64 red_threshold)
@@ -149,15 +656,17 @@ cv::Mat apply_laplace(cv::Mat const &image, cv::Mat const &invalid_image, f64 re
     channels_cv.clear();
     cv::split(image, channels_cv);
 
-    std::vector<cv::Mat> output;
-    for (auto const & channel : channels_cv) {
-        MatX<f64> mat_eigen;
-        cv::cv2eigen(channel, mat_eigen);
-
-        fill_missing_portion_smooth_boundary(mat_eigen, invalid_pixels);
+    // All the channels share the same mask, so they are filled together
+    MultiChannelImage images(channels_cv.size(), invalid_pixels.rows(), invalid_pixels.cols());
+    for (size_t c = 0; c < channels_cv.size(); ++c) {
+        cv::cv2eigen(channels_cv[c], images[c]);
+    }
+    fill_missing_portion_smooth_boundary(images, invalid_pixels);
 
+    std::vector<cv::Mat> output;
+    for (auto const& channel : images.images) {
         cv::Mat output_mat;
-        cv::eigen2cv(mat_eigen, output_mat);
+        cv::eigen2cv(channel, output_mat);
         output.push_back(output_mat);
     }
 
@@ -0,0 +1,100 @@
+#include "approx/mixed_precision.h"
+
+#include <utils/log.h>
+
+namespace approx {
+static auto logger = utils::create_logger("approx::mixed_precision");
+
+// Every correction has to reduce the error by at least this much. The f32 solver cannot get much further than this
+// in a single solve anyway
+static constexpr f64 inner_tolerance = 1e-4;
+static constexpr long max_refinements = 20;
+
+MixedPrecisionSolver::MixedPrecisionSolver(StencilSystem const& system, Precision precision)
+    : m_precision(precision)
+{
+    if (fits_matrix_free(system)) {
+        m_stencil_solver = std::make_unique<StencilConjugateGradientF32>(system);
+        m_kernels = StencilKernels<f64, Boundary::Neumann>(system.unknowns, system.diagonal);
+        m_info = m_stencil_solver->info();
+        return;
+    }
+
+    sparse_t A = system.assemble();
+    m_matrix_f32 = A.cast<f32>();
+    m_exact = A.isCompressed() && (m_matrix_f32.coeffs().cast<f64>().array() == A.coeffs().array()).all();
+    if (!m_exact) {
+        m_matrix = std::move(A);
+    }
+    m_solver.compute(m_matrix_f32);
+    m_info = m_solver.info();
+}
+
+VecX<f64> MixedPrecisionSolver::residual(VecX<f64> const& b, VecX<f64> const& x) const
+{
+    if (m_stencil_solver != nullptr) {
+        MatX<f64> r;
+        m_kernels.residual(m_kernels.scatter(b), m_kernels.scatter(x), r);
+        return m_kernels.gather(r);
+    }
+    if (m_exact) {
+        return b - m_matrix_f32.cast<f64>() * x;
+    }
+    return b - m_matrix * x;
+}
+
+VecX<f64> MixedPrecisionSolver::solveWithGuess(VecX<f64> const& b, VecX<f64> const& guess)
+{
+    m_iterations = 0;
+    m_refinements = 0;
+    m_error = 0.0;
+
+    f64 b_norm = b.norm();
+    if (b_norm == 0.0) {
+        m_info = Eigen::Success;
+        return VecX<f64>::Zero(b.size());
+    }
+
+    // The f32 solver cannot reach a tighter tolerance on its own
+    f64 tolerance = m_precision == Precision::Single ? std::max(m_tolerance, single_precision_tolerance) : m_tolerance;
+
+    VecX<f64> x = guess;
+    VecX<f64> r = residual(b, x);
+    m_error = r.norm() / b_norm;
+    while (m_error > tolerance && m_refinements < max_refinements && m_iterations < m_max_iterations) {
+        // Only ask for as much accuracy as is still needed, but at least a few orders of magnitude
+        VecX<f64> correction = solve_correction(r, std::max(tolerance / m_error, inner_tolerance), m_max_iterations - m_iterations, m_iterations);
+        m_refinements += 1;
+
+        VecX<f64> next = x + correction;
+        VecX<f64> next_residual = residual(b, next);
+        f64 error = next_residual.norm() / b_norm;
+        if (error >= m_error) {
+            logger->debug("Iterative refinement stopped improving after {} corrections ({:.4e} error)", m_refinements, m_error);
+            break;
+        }
+        x = std::move(next);
+        r = std::move(next_residual);
+        m_error = error;
+    }
+
+    m_info = m_error <= tolerance ? Eigen::Success : Eigen::NoConvergence;
+    return x;
+}
+
+VecX<f64> MixedPrecisionSolver::solve_correction(VecX<f64> const& r, f64 tolerance, long max_iterations, long& iterations)
+{
+    if (m_stencil_solver != nullptr) {
+        m_stencil_solver->setTolerance(tolerance);
+        m_stencil_solver->setMaxIterations(max_iterations);
+        VecX<f64> correction = m_stencil_solver->solveWithGuess(r, VecX<f64>::Zero(r.size()));
+        iterations += m_stencil_solver->iterations();
+        return correction;
+    }
+    m_solver.setTolerance((f32)tolerance);
+    m_solver.setMaxIterations(max_iterations);
+    VecX<f32> correction = m_solver.solve(r.cast<f32>());
+    iterations += m_solver.iterations();
+    return correction.cast<f64>();
+}
+}
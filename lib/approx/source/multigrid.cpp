@@ -0,0 +1,199 @@
+#include "approx/multigrid.h"
+
+#include <algorithm>
+#include <array>
+#include <utils/log.h>
+
+namespace approx {
+static auto logger = utils::create_logger("approx::multigrid");
+
+// Build the interpolation from the coarse grid (half resolution) into the fine grid.
+// The coarse unknowns are returned through coarse_unknowns (in raster order).
+static sparse_t build_prolongation(std::vector<index_t> const& fine_unknowns, std::vector<index_t>& coarse_unknowns)
+{
+    Eigen::Index stride = 0;
+    for (auto const& [row, col] : fine_unknowns) {
+        stride = std::max(stride, (col >> 1) + 2);
+    }
+    auto key = [&](Eigen::Index row, Eigen::Index col) {
+        return row * stride + col;
+    };
+
+    std::vector<Eigen::Index> keys;
+    keys.reserve(fine_unknowns.size());
+    for (auto const& [row, col] : fine_unknowns) {
+        keys.push_back(key(row >> 1, col >> 1));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    coarse_unknowns.clear();
+    coarse_unknowns.reserve(keys.size());
+    for (auto k : keys) {
+        coarse_unknowns.push_back({ k / stride, k % stride });
+    }
+
+    auto coarse_number = [&](Eigen::Index row, Eigen::Index col) -> Eigen::Index {
+        if (row < 0 || col < 0) {
+            return -1;
+        }
+        auto k = key(row, col);
+        auto it = std::lower_bound(keys.begin(), keys.end(), k);
+        return (it != keys.end() && *it == k) ? (Eigen::Index)(it - keys.begin()) : -1;
+    };
+
+    // Bilinear interpolation between cell centers: the parent cell has a weight of 9/16, the two closest
+    // neighbours of the parent 3/16 and the diagonal neighbour 1/16. Coarse cells that are not
+    // unknowns are skipped, and the remaining weights are normalized so constants are interpolated exactly.
+    std::vector<triplet_t> triplets;
+    triplets.reserve(4 * fine_unknowns.size());
+    for (size_t i = 0; i < fine_unknowns.size(); ++i) {
+        auto [row, col] = fine_unknowns[i];
+        Eigen::Index coarse_row = row >> 1;
+        Eigen::Index coarse_col = col >> 1;
+        Eigen::Index row_offset = (row & 1) ? 1 : -1;
+        Eigen::Index col_offset = (col & 1) ? 1 : -1;
+
+        std::array<std::pair<Eigen::Index, f64>, 4> candidates = { {
+            { coarse_number(coarse_row, coarse_col), 9.0 },
+            { coarse_number(coarse_row + row_offset, coarse_col), 3.0 },
+            { coarse_number(coarse_row, coarse_col + col_offset), 3.0 },
+            { coarse_number(coarse_row + row_offset, coarse_col + col_offset), 1.0 },
+        } };
+
+        f64 total = 0.0;
+        for (auto const& [j, weight] : candidates) {
+            total += j >= 0 ? weight : 0.0;
+        }
+        for (auto const& [j, weight] : candidates) {
+            if (j >= 0) {
+                triplets.emplace_back((Eigen::Index)i, j, weight / total);
+            }
+        }
+    }
+
+    sparse_t P((Eigen::Index)fine_unknowns.size(), (Eigen::Index)coarse_unknowns.size());
+    P.setFromTriplets(triplets.begin(), triplets.end());
+    return P;
+}
+
+Multigrid::Multigrid(sparse_t const& A, std::vector<index_t> const& unknowns, MultigridOptions options)
+{
+    compute(A, unknowns, options);
+}
+
+void Multigrid::compute(sparse_t const& A, std::vector<index_t> const& unknowns, MultigridOptions options)
+{
+    m_options = options;
+    m_levels.clear();
+    if (A.rows() != (Eigen::Index)unknowns.size()) {
+        logger->error("Cannot build multigrid hierarchy: {} unknowns for a {}x{} matrix", unknowns.size(), A.rows(), A.cols());
+        m_info = Eigen::InvalidInput;
+        return;
+    }
+
+    std::vector<index_t> level_unknowns = unknowns;
+    m_levels.push_back({ .A = A });
+    while (m_levels.back().A.rows() > m_options.coarsest_size) {
+        std::vector<index_t> coarse_unknowns;
+        sparse_t P = build_prolongation(level_unknowns, coarse_unknowns);
+        if (coarse_unknowns.size() == level_unknowns.size()) {
+            break;
+        }
+
+        sparse_t coarse_A = P.transpose() * m_levels.back().A * P;
+        m_levels.back().prolongation = std::move(P);
+        m_levels.push_back({ .A = std::move(coarse_A) });
+        level_unknowns = std::move(coarse_unknowns);
+    }
+
+    for (auto& level : m_levels) {
+        level.inverse_diagonal = level.A.diagonal().cwiseInverse();
+    }
+
+    m_coarse_solver.compute(m_levels.back().A);
+    m_info = m_coarse_solver.info();
+    if (m_info != Eigen::Success) {
+        logger->warn("Failed to factorize the coarsest multigrid level ({} unknowns)", m_levels.back().A.rows());
+    }
+    logger->debug("Created multigrid hierarchy with {} levels ({} -> {} unknowns)", m_levels.size(), A.rows(), m_levels.back().A.rows());
+}
+
+void Multigrid::smooth(Level const& level, VecX<f64> const& b, VecX<f64>& x, bool forward) const
+{
+    // Gauss-Seidel. A is symmetric, so column i contains the coefficients of row i
+    auto n = level.A.outerSize();
+    for (Eigen::Index k = 0; k < n; ++k) {
+        Eigen::Index i = forward ? k : n - 1 - k;
+        f64 sum = b[i];
+        for (sparse_t::InnerIterator it(level.A, i); it; ++it) {
+            if (it.index() != i) {
+                sum -= it.value() * x[it.index()];
+            }
+        }
+        x[i] = sum * level.inverse_diagonal[i];
+    }
+}
+
+void Multigrid::cycle(size_t level, VecX<f64> const& b, VecX<f64>& x) const
+{
+    if (level + 1 == m_levels.size()) {
+        x = m_coarse_solver.solve(b);
+        return;
+    }
+
+    auto const& current = m_levels[level];
+    for (int i = 0; i < m_options.pre_smoothing; ++i) {
+        smooth(current, b, x, true);
+    }
+
+    VecX<f64> residual = b - current.A * x;
+    VecX<f64> coarse_b = current.prolongation.transpose() * residual;
+    VecX<f64> coarse_x = VecX<f64>::Zero(coarse_b.size());
+
+    int visits = m_options.cycle == MultigridCycle::W ? 2 : 1;
+    for (int i = 0; i < visits; ++i) {
+        cycle(level + 1, coarse_b, coarse_x);
+    }
+    x += current.prolongation * coarse_x;
+
+    for (int i = 0; i < m_options.post_smoothing; ++i) {
+        smooth(current, b, x, false);
+    }
+}
+
+void Multigrid::cycle(VecX<f64> const& b, VecX<f64>& x) const
+{
+    if (m_levels.empty()) {
+        return;
+    }
+    cycle(0, b, x);
+}
+
+VecX<f64> Multigrid::solveWithGuess(VecX<f64> const& b, VecX<f64> const& guess)
+{
+    VecX<f64> x = guess;
+    m_iterations = 0;
+    m_error = 0.0;
+    if (m_levels.empty()) {
+        m_info = Eigen::InvalidInput;
+        return x;
+    }
+
+    f64 b_norm = b.norm();
+    if (b_norm == 0.0) {
+        m_info = Eigen::Success;
+        return VecX<f64>::Zero(b.size());
+    }
+
+    auto const& A = m_levels.front().A;
+    m_error = (b - A * x).norm() / b_norm;
+    while (m_error > m_tolerance && m_iterations < m_max_iterations) {
+        cycle(0, b, x);
+        m_error = (b - A * x).norm() / b_norm;
+        m_iterations += 1;
+    }
+    m_info = m_error <= m_tolerance ? Eigen::Success : Eigen::NoConvergence;
+    return x;
+}
+}
@@ -0,0 +1,173 @@
+#include "approx/ordering.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace approx {
+// Spread the lower 32 bits of the value out to the even bits
+static u64 spread_bits(u64 value)
+{
+    value &= 0xffffffff;
+    value = (value | (value << 16)) & 0x0000ffff0000ffff;
+    value = (value | (value << 8)) & 0x00ff00ff00ff00ff;
+    value = (value | (value << 4)) & 0x0f0f0f0f0f0f0f0f;
+    value = (value | (value << 2)) & 0x3333333333333333;
+    value = (value | (value << 1)) & 0x5555555555555555;
+    return value;
+}
+
+static std::vector<Eigen::Index> morton_order(std::vector<index_t> const& unknowns)
+{
+    std::vector<Eigen::Index> order(unknowns.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (unknowns.empty()) {
+        return order;
+    }
+
+    Eigen::Index min_row = unknowns[0].row, min_col = unknowns[0].col;
+    for (auto const& [row, col] : unknowns) {
+        min_row = std::min(min_row, row);
+        min_col = std::min(min_col, col);
+    }
+    std::vector<u64> keys(unknowns.size());
+    for (size_t i = 0; i < unknowns.size(); ++i) {
+        keys[i] = spread_bits((u64)(unknowns[i].row - min_row)) | (spread_bits((u64)(unknowns[i].col - min_col)) << 1);
+    }
+    std::sort(order.begin(), order.end(), [&](Eigen::Index a, Eigen::Index b) { return keys[(size_t)a] < keys[(size_t)b]; });
+    return order;
+}
+
+struct LevelStructure {
+    // The nodes in the order they were visited, so level by level
+    std::vector<Eigen::Index> nodes;
+    Eigen::Index depth = 0;
+    // The position of the first node of the last level
+    size_t last_level = 0;
+};
+
+// Breadth first search from the start node, over the nodes that were not numbered yet
+static LevelStructure breadth_first(sparse_t const& A, Eigen::Index start, std::vector<bool> const& numbered, std::vector<Eigen::Index>& distance)
+{
+    LevelStructure levels { .nodes = { start } };
+    distance[(size_t)start] = 0;
+    for (size_t next = 0; next < levels.nodes.size(); ++next) {
+        Eigen::Index node = levels.nodes[next];
+        for (sparse_t::InnerIterator it(A, node); it; ++it) {
+            auto neighbour = (size_t)it.index();
+            if (!numbered[neighbour] && distance[neighbour] < 0) {
+                distance[neighbour] = distance[(size_t)node] + 1;
+                levels.nodes.push_back(it.index());
+            }
+        }
+    }
+
+    levels.depth = distance[(size_t)levels.nodes.back()];
+    levels.last_level = levels.nodes.size() - 1;
+    while (levels.last_level > 0 && distance[(size_t)levels.nodes[levels.last_level - 1]] == levels.depth) {
+        levels.last_level -= 1;
+    }
+    // Only reset the nodes that were visited, so the search does not depend on the size of the whole graph
+    for (auto node : levels.nodes) {
+        distance[(size_t)node] = -1;
+    }
+    return levels;
+}
+
+static std::vector<Eigen::Index> reverse_cuthill_mckee_order(sparse_t const& A)
+{
+    auto n = (size_t)A.cols();
+    std::vector<Eigen::Index> degree(n);
+    for (size_t i = 0; i < n; ++i) {
+        degree[i] = A.outerIndexPtr()[i + 1] - A.outerIndexPtr()[i] - 1;
+    }
+
+    std::vector<Eigen::Index> order;
+    order.reserve(n);
+    std::vector<bool> numbered(n, false);
+    std::vector<Eigen::Index> distance(n, -1);
+    std::vector<Eigen::Index> candidates;
+    for (size_t first = 0; first < n; ++first) {
+        if (numbered[first]) {
+            continue;
+        }
+
+        // Start from a pseudo-peripheral node of the component (George and Liu): move to the node with the smallest
+        // degree in the last level of the search, as long as that makes the search deeper
+        auto start = (Eigen::Index)first;
+        LevelStructure levels = breadth_first(A, start, numbered, distance);
+        while (true) {
+            Eigen::Index candidate = levels.nodes[levels.last_level];
+            for (size_t i = levels.last_level; i < levels.nodes.size(); ++i) {
+                if (degree[(size_t)levels.nodes[i]] < degree[(size_t)candidate]) {
+                    candidate = levels.nodes[i];
+                }
+            }
+            LevelStructure candidate_levels = breadth_first(A, candidate, numbered, distance);
+            if (candidate_levels.depth <= levels.depth) {
+                break;
+            }
+            start = candidate;
+            levels = std::move(candidate_levels);
+        }
+
+        // Cuthill-McKee: number the nodes level by level, and the neighbours of every node from the smallest degree up
+        size_t next = order.size();
+        order.push_back(start);
+        numbered[(size_t)start] = true;
+        for (; next < order.size(); ++next) {
+            candidates.clear();
+            for (sparse_t::InnerIterator it(A, order[next]); it; ++it) {
+                if (!numbered[(size_t)it.index()]) {
+                    numbered[(size_t)it.index()] = true;
+                    candidates.push_back(it.index());
+                }
+            }
+            std::sort(candidates.begin(), candidates.end(), [&](Eigen::Index a, Eigen::Index b) {
+                return degree[(size_t)a] < degree[(size_t)b];
+            });
+            order.insert(order.end(), candidates.begin(), candidates.end());
+        }
+    }
+
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+std::vector<Eigen::Index> unknown_order(StencilSystem const& system, UnknownOrdering ordering)
+{
+    switch (ordering) {
+    case UnknownOrdering::Morton:
+        return morton_order(system.unknowns);
+    case UnknownOrdering::ReverseCuthillMcKee:
+        return reverse_cuthill_mckee_order(system.assemble());
+    case UnknownOrdering::Raster:
+        break;
+    }
+    std::vector<Eigen::Index> order((size_t)system.size());
+    std::iota(order.begin(), order.end(), 0);
+    return order;
+}
+
+StencilSystem reorder(StencilSystem const& system, std::vector<Eigen::Index> const& order)
+{
+    StencilSystem reordered;
+    reordered.unknowns.resize(order.size());
+    reordered.diagonal.resize((Eigen::Index)order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        reordered.unknowns[i] = system.unknowns[(size_t)order[i]];
+        reordered.diagonal[(Eigen::Index)i] = system.diagonal[order[i]];
+    }
+    return reordered;
+}
+
+Eigen::Index bandwidth(sparse_t const& A)
+{
+    Eigen::Index result = 0;
+    for (Eigen::Index col = 0; col < A.outerSize(); ++col) {
+        for (sparse_t::InnerIterator it(A, col); it; ++it) {
+            result = std::max(result, std::abs(it.index() - col));
+        }
+    }
+    return result;
+}
+}
@@ -1,4 +1,10 @@
 #include "approx/poisson.h"
+#include "approx/convolution_pyramid.h"
+#include "approx/dispatch.h"
+#include "approx/fast_poisson.h"
+#include "approx/laplace.h"
+#include "approx/quadtree.h"
+#include "approx/stencil.h"
 #include "approx/utils.h"
 
 #include <boost/date_time/gregorian/gregorian.hpp>
@@ -6,19 +12,51 @@
 #include <magic_enum.hpp>
 #include <opencv2/core/eigen.hpp>
 #include <spdlog/stopwatch.h>
+#include <utils/eigen.h>
 #include <utils/error.h>
+#include <utils/geotiff.h>
 
 namespace date_time = boost::gregorian;
 
 namespace approx {
-void PerfInfo::write(fs::path const& output) const
+// The Poisson blend leaves the neighbours outside of the image out of the stencil
+using PoissonKernels = StencilKernels<f64, Boundary::Neumann>;
+
+// The divergence of the guidance field (the gradient of the image) at every pixel: the sum of the differences between
+// the pixel and its neighbours inside of the image. Computed with whole-image shifted differences, which Eigen vectorizes
+template<typename T>
+static MatX<f64> guidance_divergence(MatX<T> const& image)
 {
-    std::ofstream out_file(output, std::ios_base::app);
-    out_file << region_size << "," << tolerance << "," << max_iterations << "," << iterations << "," << error << "," << solve_time << "\n";
-    out_file.close();
+    auto values = image.template cast<f64>();
+    Eigen::Index rows = image.rows();
+    Eigen::Index cols = image.cols();
+    MatX<f64> divergence = MatX<f64>::Zero(rows, cols);
+    if (rows > 1) {
+        MatX<f64> difference = values.topRows(rows - 1) - values.bottomRows(rows - 1);
+        divergence.topRows(rows - 1) += difference;
+        divergence.bottomRows(rows - 1) -= difference;
+    }
+    if (cols > 1) {
+        MatX<f64> difference = values.leftCols(cols - 1) - values.rightCols(cols - 1);
+        divergence.leftCols(cols - 1) += difference;
+        divergence.rightCols(cols - 1) -= difference;
+    }
+    return divergence;
+}
+
+template<typename T>
+static std::vector<MatX<f64>> guidance_divergence(BasicMultiChannelImage<T> const& images)
+{
+    std::vector<MatX<f64>> divergence(images.images.size());
+#pragma omp parallel for
+    for (long c = 0; c < (long)images.images.size(); ++c) {
+        divergence[(size_t)c] = guidance_divergence(images.images[(size_t)c]);
+    }
+    return divergence;
 }
 
-void blend_images_poisson(MultiChannelImage& input_images, MultiChannelImage const& replacement_images, int start_row, int start_column)
+void blend_images_poisson(MultiChannelImage& input_images, MultiChannelImage const& replacement_images, int start_row, int start_column,
+    SolverOptions const& options)
 {
     spdlog::stopwatch sw;
     // Sanity checks
@@ -43,86 +81,95 @@ void blend_images_poisson(MultiChannelImage& input_images, MultiChannelImage con
         return index_t { row + start_row, col + start_column };
     };
 
-    auto flatten_index = [&](Eigen::Index row, Eigen::Index col) {
-        return col + row * replacement_images.cols();
-    };
-
-    // Map from the flattened index, into the number of variables
-    std::unordered_map<Eigen::Index, int> variable_numbers;
-    int i = 0;
+    // Dense index image: the number of the variable of every pixel of the replacement image (-1 == not a variable)
+    MatX<int> variable_numbers = MatX<int>::Constant(replacement_images.rows(), replacement_images.cols(), -1);
+    int num_unknowns = 0;
     for (Eigen::Index row = 0; row < replacement_images.rows(); ++row) {
         for (Eigen::Index col = 0; col < replacement_images.cols(); ++col) {
             if (replacement_images.valid_pixel(row, col)) {
-                variable_numbers.emplace(flatten_index(row, col), i);
-                i += 1;
+                variable_numbers(row, col) = num_unknowns;
+                num_unknowns += 1;
             }
         }
     }
-    auto num_unknowns = (int)variable_numbers.size();
 
-    std::vector<triplet_t> triplets;
-
-    int irow = 0;
-    int invalid_pixels = 0;
-    // The A matrix is generated from the missing area, and does not depend on the specific image we are solving for
+    StencilSystem system;
+    system.unknowns.reserve((size_t)num_unknowns);
     for (Eigen::Index row = 0; row < replacement_images.rows(); ++row) {
         for (Eigen::Index col = 0; col < replacement_images.cols(); ++col) {
-            if (!replacement_images.valid_pixel(row, col))
-                continue;
-
-            invalid_pixels += 1;
-            // First, take care of the left hand side of the equation
-            std::vector<index_t> neighbours = valid_neighbours(replacement_images[0], { row, col });
-            triplets.emplace_back(irow, variable_numbers.at(flatten_index(row, col)), (f64)neighbours.size());
-
-            for (auto const& [nrow, ncol] : neighbours) {
-                // Sum over all the neighbours that are not on the boundary
-                if (replacement_images.valid_pixel(nrow, ncol)) {
-                    triplets.emplace_back(irow, variable_numbers.at(flatten_index(nrow, ncol)), -1);
-                }
+            if (variable_numbers(row, col) >= 0) {
+                system.unknowns.push_back({ row, col });
             }
-
-            irow += 1;
         }
     }
 
-    spdlog::debug("Found {} invalid pixels", invalid_pixels);
-    sparse_t A(num_unknowns, num_unknowns);
-    A.setFromTriplets(triplets.begin(), triplets.end());
-    SparseSolver chol(A);
+    spdlog::debug("Found {} invalid pixels", num_unknowns);
+    if (num_unknowns == 0) {
+        return;
+    }
 
-    // Solve for each channel of the multi-band image
-    std::vector<VecX<f64>> solutions;
+    // The A matrix is generated from the missing area, and does not depend on the specific image we are solving for.
+    // The neighbours outside of the replacement image are left out, so the diagonal is the number of neighbours inside of it
+    PoissonKernels kernels(system.unknowns, replacement_images.rows(), replacement_images.cols());
+    system.diagonal = kernels.diagonal();
 
-    spdlog::debug("Solving the system for {} image channels", input_images.images.size());
-    for (size_t c = 0; c < input_images.images.size(); ++c) {
-        VecX<f64> b(num_unknowns);
-        b.setZero();
-        irow = 0;
-
-        for (Eigen::Index row = 0; row < replacement_images.rows(); ++row) {
-            for (Eigen::Index col = 0; col < replacement_images.cols(); ++col) {
-                if (!replacement_images.valid_pixel(row, col))
-                    continue;
+    // Solve for each channel of the multi-band image
+    std::vector<MatX<f64>> divergence = guidance_divergence(replacement_images);
+    std::vector<VecX<f64>> solutions(input_images.images.size());
+    auto right_hand_side = [&](size_t c) {
+        // The neighbours that are not part of the mask must be on the region boundary. Their values are known, so
+        // they are part of the right hand side
+        MatX<f64> input_window = input_images.images[c].block(start_row, start_column, replacement_images.rows(), replacement_images.cols());
+        return VecX<f64>(kernels.values(divergence[c]) + kernels.right_hand_side(input_window));
+    };
 
-                std::vector<index_t> neighbours = valid_neighbours(replacement_images[0], { row, col });
-                for (auto const& [nrow, ncol] : neighbours) {
-                    // This computes the sum of the gradient (difference) for each pixel in the replacement image
-                    b(irow) += (replacement_images.images[c](row, col) - replacement_images.images[c](nrow, ncol));
-
-                    // If the neighbours are not part of the mask, they must be on the region boundary.
-                    // In that case we will add them to the RHS of the equation, because their values are known
-                    if (!replacement_images.valid_pixel(nrow, ncol)) {
-                        index_t index_in_input = replacement_to_input(nrow, ncol);
-                        b(irow) += input_images(c, index_in_input.row, index_in_input.col);
-                    }
-                }
+    // A region that fills its bounding rectangle, and is not on the border of the replacement image (every unknown has
+    // 4 neighbours), has known values all around it: the sine transform solves it directly, if the size of the rectangle
+    // has a fast transform. A rectangle on the border of the replacement image has rows with fewer neighbours (the
+    // Neumann boundary), which the sine transform does not diagonalize, so it is solved with conjugate gradient below
+    index_t first = system.unknowns.front(), last = first;
+    for (auto const& [row, col] : system.unknowns) {
+        first = { std::min(first.row, row), std::min(first.col, col) };
+        last = { std::max(last.row, row), std::max(last.col, col) };
+    }
+    Eigen::Index rectangle_rows = last.row - first.row + 1, rectangle_cols = last.col - first.col + 1;
+    bool rectangle = rectangle_rows * rectangle_cols == num_unknowns && system.diagonal.minCoeff() == 4.0
+        && fast_sine_transform_size(rectangle_rows) == rectangle_rows && fast_sine_transform_size(rectangle_cols) == rectangle_cols;
 
-                irow += 1;
-            }
+    spdlog::debug("Solving the system for {} image channels", input_images.images.size());
+    if (rectangle) {
+        // The unknowns are numbered row by row
+        using row_major_t = Eigen::Matrix<f64, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+        SineTransformSolver solver(rectangle_rows, rectangle_cols);
+#pragma omp parallel for
+        for (long c = 0; c < (long)input_images.images.size(); ++c) {
+            VecX<f64> b = right_hand_side((size_t)c);
+            MatX<f64> x = solver.solve(Eigen::Map<row_major_t const>(b.data(), rectangle_rows, rectangle_cols));
+            solutions[(size_t)c].resize(num_unknowns);
+            Eigen::Map<row_major_t>(solutions[(size_t)c].data(), rectangle_rows, rectangle_cols) = x;
         }
-
-        solutions.push_back(chol.solve(b));
+    } else {
+        // Any other region is solved on its bounding rectangle, with conjugate gradient for the pixels that are not
+        // part of the region
+        sparse_t A = system.assemble();
+        Eigen::ConjugateGradient<sparse_row_t, Eigen::Lower | Eigen::Upper, SineTransformPreconditioner> solver;
+        solver.preconditioner().set_unknowns(system.unknowns);
+        solver.compute(row_major_view(A));
+        solver.setTolerance(options.tolerance);
+        solver.setMaxIterations(options.max_iterations.value_or(std::max(num_unknowns, 100)));
+        // The solver keeps the iterations and the error of the last solve, so the channels are solved one at a time.
+        // The row-major products and the transforms of the preconditioner use the threads instead
+        long iterations = 0;
+        f64 error = 0.0;
+        for (size_t c = 0; c < input_images.images.size(); ++c) {
+            solutions[c] = solver.solve(right_hand_side(c));
+            iterations += solver.iterations();
+            error = std::max(error, solver.error());
+        }
+        if (error > options.tolerance) {
+            spdlog::warn("The blend did not reach the tolerance ({:.4e} error after {} iterations)", error, iterations);
+        }
+        spdlog::debug("Solved {} channels after {} iterations with {:.4e} error", input_images.images.size(), iterations, error);
     }
 
     // Put the new values into the images
@@ -134,7 +181,7 @@ void blend_images_poisson(MultiChannelImage& input_images, MultiChannelImage con
                     continue;
 
                 index_t index_input = replacement_to_input(row, col);
-                input_images.images[c](index_input.row, index_input.col) = solutions[c](variable_numbers.at(flatten_index(row, col)));
+                input_images.images[c](index_input.row, index_input.col) = solutions[c](variable_numbers(row, col));
             }
         }
     }
@@ -142,151 +189,443 @@ void blend_images_poisson(MultiChannelImage& input_images, MultiChannelImage con
     spdlog::debug("It took {:.2f} seconds to solve the poisson equation", sw);
 }
 
-void blend_images_poisson(
-    MultiChannelImage& input_images,
-    MultiChannelImage const& replacement_images,
-    MatX<bool> const& invalid_mask,
-    f64 tolerance,
-    std::optional<int> max_iterations)
+struct RegionSolution {
+    std::vector<VecX<f64>> channels;
+    PerfInfo perf_info;
+    FillResult result;
+};
+
+// Compare the warm start with the replacement image (the guess we would have used otherwise). Conjugate gradient
+// reduces the error by about the same factor every iteration, so the rate of the solve tells how many more
+// iterations starting from the replacement image would have taken
+template<typename T>
+static void record_warm_start(PerfInfo& perf_info, LinearSolver const& solver, MatX<f64> const& B, MatX<f64> const& guesses,
+    BasicMultiChannelImage<T> const& replacement_images, std::vector<index_t> const& pixels)
 {
-    spdlog::stopwatch sw;
-    // Sanity checks
-    if (replacement_images.size() != input_images.size()) {
-        spdlog::error("Cannot solve problem: replacement image is not the same size as input image ({} vs {})", replacement_images.size(), input_images.size());
-        return;
+    MatX<f64> replacement(B.rows(), B.cols());
+    for (Eigen::Index c = 0; c < B.cols(); ++c) {
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            replacement((Eigen::Index)i, c) = replacement_images.images[(size_t)c](pixels[i].row, pixels[i].col);
+        }
     }
-    if (input_images.size() != invalid_mask.size()) {
-        spdlog::error("Cannot solve problem: input images and mask are different sizes ({} vs {})", input_images.size(), invalid_mask.size());
+    perf_info.guess_error = solver.relative_residual(B, guesses);
+    perf_info.replacement_error = solver.relative_residual(B, replacement);
+
+    // Without any iterations there is no rate, so nothing is estimated
+    if (perf_info.iterations > 0 && perf_info.error > 0.0 && perf_info.guess_error > perf_info.error) {
+        f64 rate = std::log(perf_info.guess_error / perf_info.error) / (f64)perf_info.iterations;
+        f64 cold_iterations = std::log(perf_info.replacement_error / perf_info.error) / rate;
+        perf_info.iterations_saved = std::lround(cold_iterations) - perf_info.iterations;
+    }
+}
+
+// The right hand side of every channel of a region (a column each): the divergence of the guidance field, plus the
+// known values of the neighbours on the boundary of the region
+template<typename T>
+static MatX<f64> region_right_hand_side(PoissonKernels const& kernels, BasicMultiChannelImage<T> const& input_images, std::vector<MatX<f64>> const& divergence)
+{
+    auto num_channels = (Eigen::Index)input_images.images.size();
+    MatX<f64> B(kernels.size(), num_channels);
+    for (Eigen::Index c = 0; c < num_channels; ++c) {
+        B.col(c) = kernels.values(divergence[(size_t)c]) + kernels.right_hand_side(input_images.images[(size_t)c]);
+    }
+    return B;
+}
+
+// Solve a region on its quadtree. The blend is the replacement image R plus a membrane, which is smooth away from the
+// boundary of the region. Only the membrane is interpolated from the nodes (X = R + S y), and the system is projected
+// on the nodes: S^T A S y = S^T (B - A R)
+template<typename T>
+static std::optional<RegionSolution> solve_region_quadtree(
+    StencilSystem const& system,
+    MatX<f64> const& B,
+    BasicMultiChannelImage<T> const& replacement_images,
+    BasicMultiChannelImage<T> const* warm_start,
+    MatX<int> const& labels,
+    int label,
+    SolverOptions const& options,
+    deadline_t deadline)
+{
+    auto const& pixels = system.unknowns;
+    auto num_unknowns = (Eigen::Index)system.size();
+    auto num_channels = B.cols();
+    bool direct = options.backend == SolverBackend::Cholesky;
+
+    MatX<f64> replacement(num_unknowns, num_channels);
+    for (Eigen::Index i = 0; i < num_unknowns; ++i) {
+        for (Eigen::Index c = 0; c < num_channels; ++c) {
+            replacement(i, c) = replacement_images.images[c](pixels[(size_t)i].row, pixels[(size_t)i].col);
+        }
     }
 
-    auto flatten_index = [&](Eigen::Index row, Eigen::Index col) {
-        return col + row * replacement_images.cols();
+    // The tolerance is not tuned, and the visual error is not measured: it is dominated by the interpolation, not by
+    // the residual of the solve. The records are marked, so the tuning leaves them out
+    RegionSolution solution;
+    solution.perf_info = PerfInfo {
+        .region_size = num_unknowns,
+        .tolerance = options.tolerance,
+        .solves = num_channels,
+        .backend = direct ? SolverBackend::Cholesky : SolverBackend::ConjugateGradient,
+        .automatic = options.backend == SolverBackend::Automatic,
+        .preconditioner = Preconditioner::Jacobi,
+        .warm_start = warm_start != nullptr,
+        .quadtree = true
     };
 
-    // Map from the flattened index, into the number of variables
-    std::unordered_map<Eigen::Index, int> variable_numbers;
-    int i = 0;
-    for (Eigen::Index row = 0; row < replacement_images.rows(); ++row) {
-        for (Eigen::Index col = 0; col < replacement_images.cols(); ++col) {
-            if (invalid_mask(row, col)) {
-                variable_numbers.emplace(flatten_index(row, col), i);
-                i += 1;
+    // The setup counts against the deadline, the same as for LinearSolver: once it has passed, the region keeps its guess
+    auto setup_start = std::chrono::steady_clock::now();
+    sparse_t A = system.assemble();
+    if (deadline.has_value() && setup_start >= *deadline) {
+        MatX<f64> X = replacement;
+        if (warm_start != nullptr) {
+            for (Eigen::Index i = 0; i < num_unknowns; ++i) {
+                for (Eigen::Index c = 0; c < num_channels; ++c) {
+                    X(i, c) = warm_start->images[c](pixels[(size_t)i].row, pixels[(size_t)i].col);
+                }
+            }
+        }
+        for (Eigen::Index c = 0; c < num_channels; ++c) {
+            f64 b_norm = B.col(c).norm();
+            if (b_norm > 0.0) {
+                solution.perf_info.error = std::max(solution.perf_info.error, (B.col(c) - A * X.col(c)).norm() / b_norm);
             }
+            solution.channels.emplace_back(X.col(c));
+        }
+        solution.perf_info.deadline_reached = solution.perf_info.error > options.tolerance;
+        solution.result = { .error = solution.perf_info.error };
+        if (solution.perf_info.deadline_reached) {
+            solution.result.status = FillStatus::DeadlineReached;
         }
+        spdlog::debug("Not solving a region of {} pixels on a quadtree: the deadline has passed", num_unknowns);
+        return solution;
     }
-    auto num_unknowns = (int)variable_numbers.size();
 
-    std::vector<triplet_t> triplets;
-    int irow = 0;
-    // The A matrix is generated from the missing area, and does not depend on the specific image we are solving for
-    for (Eigen::Index row = 0; row < replacement_images.rows(); ++row) {
-        for (Eigen::Index col = 0; col < replacement_images.cols(); ++col) {
-            if (!invalid_mask(row, col))
-                continue;
+    Quadtree tree = build_quadtree(pixels, labels, label, *options.quadtree);
+    sparse_t const& S = tree.interpolation;
+    sparse_t reduced = S.transpose() * (A * S);
+    MatX<f64> B_reduced = S.transpose() * (B - A * replacement);
 
-            // First, take care of the left hand side of the equation
-            std::vector<index_t> neighbours = valid_neighbours(replacement_images[0], { row, col });
-            triplets.emplace_back(irow, variable_numbers.at(flatten_index(row, col)), (f64)neighbours.size());
+    // The reduced system is not a stencil on the grid, so only its size is compared against the calibrated thresholds
+    if (options.backend == SolverBackend::Automatic) {
+        auto thresholds = options.dispatch.has_value() ? *options.dispatch : dispatch_thresholds(options.tolerance);
+        direct = reduced.rows() <= thresholds.direct_size;
+        solution.perf_info.backend = direct ? SolverBackend::Cholesky : SolverBackend::ConjugateGradient;
+    }
 
-            for (auto const& [nrow, ncol] : neighbours) {
-                // Sum over all the neighbours that are not on the boundary
-                if (invalid_mask(nrow, ncol)) {
-                    triplets.emplace_back(irow, variable_numbers.at(flatten_index(nrow, ncol)), -1);
-                }
+    // The nodes are pixels of the region, which are interpolated from themselves, so the membrane of a warm start is
+    // its difference from the replacement image at the nodes
+    MatX<f64> Y = MatX<f64>::Zero(reduced.rows(), num_channels);
+    if (warm_start != nullptr) {
+        for (size_t n = 0; n < tree.nodes.size(); ++n) {
+            auto const& [row, col] = tree.nodes[n];
+            for (Eigen::Index c = 0; c < num_channels; ++c) {
+                Y((Eigen::Index)n, c) = warm_start->images[c](row, col) - replacement_images.images[c](row, col);
             }
+        }
+    }
 
-            irow += 1;
+    Eigen::ComputationInfo info = Eigen::Success;
+    std::chrono::steady_clock::time_point solve_start;
+    if (direct) {
+        // The direct solver cannot be stopped early, and does not use the guess
+        Factorization factorization(reduced);
+        solve_start = std::chrono::steady_clock::now();
+        Y = factorization.solve(B_reduced);
+        info = factorization.info();
+    } else {
+        Eigen::DiagonalPreconditioner<f64> preconditioner(reduced);
+        long max_iterations = options.max_iterations.value_or((int)reduced.rows());
+        auto stop = deadline.value_or(std::chrono::steady_clock::time_point::max());
+        solution.perf_info.max_iterations = max_iterations;
+        solve_start = std::chrono::steady_clock::now();
+        for (Eigen::Index c = 0; c < num_channels; ++c) {
+            long iterations = 0;
+            f64 error = 0.0;
+            Y.col(c) = conjugate_gradient_until_deadline(reduced, preconditioner, VecX<f64>(B_reduced.col(c)), VecX<f64>(Y.col(c)),
+                max_iterations, options.tolerance, stop, iterations, error, solution.perf_info.deadline_reached);
+            solution.perf_info.iterations += iterations;
+            solution.perf_info.error = std::max(solution.perf_info.error, error);
+        }
+        if (solution.perf_info.error > options.tolerance) {
+            info = Eigen::NoConvergence;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    solution.perf_info.setup_time = static_cast<f64>(std::chrono::duration_cast<std::chrono::milliseconds>(solve_start - setup_start).count());
+    solution.perf_info.solve_time = static_cast<f64>(std::chrono::duration_cast<std::chrono::milliseconds>(end - solve_start).count());
+    solution.result = { .error = solution.perf_info.error, .iterations = solution.perf_info.iterations };
+    spdlog::debug("Solved a region of {} pixels on a quadtree with {} nodes", num_unknowns, reduced.rows());
+    if (solution.perf_info.deadline_reached) {
+        // The best solution so far is still used
+        solution.result.status = FillStatus::DeadlineReached;
+    } else if (info != Eigen::Success) {
+        if (direct || info != Eigen::NoConvergence) {
+            spdlog::error("Failed to solve matrix. Encountered error: '{}'", magic_enum::enum_name(info));
+            return {};
         }
+        solution.result.status = FillStatus::NotConverged;
     }
 
-    spdlog::debug("Found {} invalid pixels", num_unknowns);
-    sparse_t A(num_unknowns, num_unknowns);
-    A.setFromTriplets(triplets.begin(), triplets.end());
-    SparseSolver solver(A);
+    MatX<f64> X = replacement + S * Y;
+    for (Eigen::Index c = 0; c < num_channels; ++c) {
+        solution.channels.emplace_back(X.col(c));
+    }
+    return solution;
+}
+
+// Solve the poisson equation over a single connected region of the mask, for every channel of the image.
+template<typename T>
+static std::optional<RegionSolution> solve_region(
+    BasicMultiChannelImage<T> const& input_images,
+    BasicMultiChannelImage<T> const& replacement_images,
+    BasicMultiChannelImage<T> const* warm_start,
+    std::vector<MatX<f64>> const& divergence,
+    MatX<int> const& labels,
+    int label,
+    std::vector<index_t> const& pixels,
+    SolverOptions const& options,
+    ToleranceTuner const* tuner,
+    deadline_t deadline)
+{
+    // Every pixel of the region is a variable
+    StencilSystem system { .unknowns = pixels };
+    auto num_unknowns = (int)system.size();
+
+    // The A matrix is generated from the missing area, and does not depend on the specific image we are solving for.
+    // Only the diagonal has to be computed: the neighbours that are part of the region are always -1
+    PoissonKernels kernels(pixels, replacement_images.rows(), replacement_images.cols());
+    system.diagonal = kernels.diagonal();
+
+    MatX<f64> B = region_right_hand_side(kernels, input_images, divergence);
+    if (options.quadtree.has_value() && num_unknowns >= options.quadtree->min_region_size) {
+        return solve_region_quadtree(system, B, replacement_images, warm_start, labels, label, options, deadline);
+    }
 
-    long max_iters = max_iterations.value_or(A.cols() / 2);
-    solver.setMaxIterations(max_iters);
-    solver.setTolerance(tolerance);
+    LinearSolver solver(system, options, deadline);
     {
         auto info = solver.info();
         if (info != Eigen::Success) {
             spdlog::error("Failed to construct matrix. Encountered error: '{}'", magic_enum::enum_name(info));
-            return;
+            return {};
         }
     }
+    // The tolerance is tuned for the backend that was picked for the region
+    if (tuner != nullptr) {
+        solver.set_tolerance(tuner->tolerance(num_unknowns, solver.backend(), solver.preconditioner(), options.tolerance));
+    }
 
-    PerfInfo perf_info {
+    RegionSolution solution;
+    solution.perf_info = PerfInfo {
         .region_size = num_unknowns,
-        .tolerance = tolerance,
-        .max_iterations = max_iters
+        .tolerance = solver.tolerance(),
+        .max_iterations = solver.max_iterations(),
+        .backend = solver.backend(),
+        .automatic = options.backend == SolverBackend::Automatic,
+        .preconditioner = solver.preconditioner(),
+        .setup_time = solver.setup_time(),
+        .warm_start = warm_start != nullptr
     };
 
-    // Solve for each channel of the multi-band image
-    std::vector<VecX<f64>> solutions;
-    for (size_t c = 0; c < input_images.images.size(); ++c) {
-        VecX<f64> b(num_unknowns);
-        b.setZero();
-        irow = 0;
+    // The right hand side of each channel is a column of B, so all the channels can be solved together.
+    // The guess is the replacement image, or the earlier result we warm start from
+    auto num_channels = (Eigen::Index)input_images.images.size();
+    MatX<f64> guesses(num_unknowns, num_channels);
+    BasicMultiChannelImage<T> const& guess_images = warm_start != nullptr ? *warm_start : replacement_images;
+    for (Eigen::Index c = 0; c < num_channels; ++c) {
+        guesses.col(c) = kernels.values(guess_images.images[(size_t)c]);
+    }
 
-        // The guess will be the replacement image
-        VecX<f64> guess(num_unknowns);
+    auto start = std::chrono::steady_clock::now();
+    MatX<f64> X = solver.solveWithGuess(B, guesses);
+    auto end = std::chrono::steady_clock::now();
+    solution.perf_info.solve_time = static_cast<f64>(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+    solution.perf_info.error = solver.error();
+    solution.perf_info.iterations = solver.iterations();
+    solution.perf_info.solves = solver.solves();
+    solution.perf_info.deadline_reached = solver.deadline_reached();
+    solution.result = solver.result();
+    spdlog::debug("Solution found after {} iterations with {:.4e} error", solver.iterations(), solver.error());
+    // The direct solver does not use the guess
+    if (warm_start != nullptr && solver.backend() != SolverBackend::Cholesky) {
+        record_warm_start(solution.perf_info, solver, B, guesses, replacement_images, pixels);
+    }
+    // A solve that was stopped by the deadline is the best solution we have, so it is still used
+    if (!solver.deadline_reached()) {
+        auto info = solver.info();
+        if (info != Eigen::Success) {
+            spdlog::error("Failed to solve matrix. Encountered error: '{}'", magic_enum::enum_name(info));
+            return {};
+        }
+    }
+    // The direct solution is exact, so only the iterative solves are measured
+    if (options.measure_visual_error && options.perf_database.has_value() && !solver.deadline_reached() && solver.backend() != SolverBackend::Cholesky) {
+        solution.perf_info.visual_error = measure_visual_error(solver, B, X);
+    }
 
-        for (Eigen::Index row = 0; row < replacement_images.rows(); ++row) {
-            for (Eigen::Index col = 0; col < replacement_images.cols(); ++col) {
-                if (!invalid_mask(row, col))
-                    continue;
+    for (Eigen::Index c = 0; c < num_channels; ++c) {
+        solution.channels.emplace_back(X.col(c));
+    }
 
-                guess(irow) = replacement_images.images[c](row, col);
+    return solution;
+}
 
-                std::vector<index_t> neighbours = valid_neighbours(replacement_images[0], { row, col });
-                for (auto const& [nrow, ncol] : neighbours) {
-                    // This computes the sum of the gradient (difference) for each pixel in the replacement image
-                    b(irow) += (replacement_images.images[c](row, col) - replacement_images.images[c](nrow, ncol));
+template<typename T>
+static FillResult blend_regions(
+    BasicMultiChannelImage<T>& input_images,
+    BasicMultiChannelImage<T> const& replacement_images,
+    MatX<bool> const& invalid_mask,
+    BasicMultiChannelImage<T> const* warm_start,
+    SolverOptions const& options)
+{
+    spdlog::stopwatch sw;
+    deadline_t deadline = start_deadline(options);
+    // Sanity checks
+    if (replacement_images.size() != input_images.size()) {
+        spdlog::error("Cannot solve problem: replacement image is not the same size as input image ({} vs {})", replacement_images.size(), input_images.size());
+        return { .status = FillStatus::NotConverged };
+    }
+    if (input_images.size() != invalid_mask.size()) {
+        spdlog::error("Cannot solve problem: input images and mask are different sizes ({} vs {})", input_images.size(), invalid_mask.size());
+        return { .status = FillStatus::NotConverged };
+    }
+    if (warm_start != nullptr && (warm_start->size() != input_images.size() || warm_start->images.size() != input_images.images.size())) {
+        spdlog::warn("Not using the warm start: it is not the same size as the input image ({} vs {})", warm_start->size(), input_images.size());
+        warm_start = nullptr;
+    }
 
-                    // If the neighbours are not part of the mask, they must be on the region boundary.
-                    // In that case we will add them to the RHS of the equation, because their values are known
-                    if (!invalid_mask(nrow, ncol)) {
-                        b(irow) += input_images(c, nrow, ncol);
-                    }
-                }
-                irow += 1;
-            }
-        }
+    // Every connected region of the mask is an independent system, so we solve each region separately
+    auto components = find_connected_components(invalid_mask);
+    std::vector<int> labels = components.labels_by_size();
+    spdlog::debug("Found {} invalid pixels in {} regions", utils::count_non_zero(invalid_mask), labels.size());
 
-        auto start = std::chrono::steady_clock::now();
-        solutions.emplace_back(solver.solveWithGuess(b, guess));
-        auto end = std::chrono::steady_clock::now();
-        perf_info.solve_time = static_cast<f64>(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
-        perf_info.error = solver.error();
-        perf_info.iterations = solver.iterations();
-        spdlog::debug("Solution found after {} iterations with {:.4e} error", solver.iterations(), solver.error());
-        {
-            auto info = solver.info();
-            if (info != Eigen::Success) {
-                spdlog::error("Failed to solve matrix. Encountered error: '{}'", magic_enum::enum_name(info));
-                return;
-            }
+    // Calibrate before the regions are solved concurrently, so the timings are not skewed by the other threads, and
+    // hand the thresholds to the solver of every region
+    SolverOptions region_options = options;
+    if (options.backend == SolverBackend::Automatic && !options.dispatch.has_value()) {
+        region_options.dispatch = dispatch_thresholds(options.tolerance);
+    }
+
+    // The guidance field only depends on the replacement image, so it is shared by all of the regions
+    std::vector<MatX<f64>> divergence = guidance_divergence(replacement_images);
+
+    std::unique_ptr<PerfDataBase> db;
+    std::optional<ToleranceTuner> tuner;
+    if (options.perf_database.has_value()) {
+        db = std::make_unique<PerfDataBase>(*options.perf_database);
+        if (options.tuning.has_value()) {
+            tuner.emplace(db->select_perf_info(), *options.tuning, ApproxMethod::Poisson);
         }
+    } else if (options.tuning.has_value()) {
+        spdlog::warn("Not tuning the tolerance: the options do not have a database to tune it from");
+    }
+
+    // The regions that are split into subdomains (the largest ones) are solved in parallel on their own first
+    std::vector<std::optional<RegionSolution>> solutions(labels.size());
+    auto solve = [&](long i) {
+        int label = labels[(size_t)i];
+        solutions[(size_t)i] = solve_region(input_images, replacement_images, warm_start, divergence, components.matrix, label,
+            components.region_map.at(label), region_options, tuner.has_value() ? &*tuner : nullptr, deadline);
+    };
+    long first_concurrent = 0;
+    while (first_concurrent < (long)labels.size() && decomposes_region(options, (long)components.region_map.at(labels[(size_t)first_concurrent]).size())) {
+        solve(first_concurrent++);
+    }
+#pragma omp parallel for schedule(dynamic)
+    for (long i = first_concurrent; i < (long)labels.size(); ++i) {
+        solve(i);
     }
 
     // Put the new values into the images
-    for (size_t c = 0; c < input_images.images.size(); ++c) {
-        for (Eigen::Index row = 0; row < replacement_images.rows(); ++row) {
-            for (Eigen::Index col = 0; col < replacement_images.cols(); ++col) {
-                // No need to do any modifications if the pixel is not part of the mask
-                if (!invalid_mask(row, col))
-                    continue;
+    FillResult result;
+    std::vector<PerfInfo> records;
+    for (size_t i = 0; i < labels.size(); ++i) {
+        // Regions that failed to solve keep their original values
+        if (!solutions[i].has_value()) {
+            result.status = result.status == FillStatus::Converged ? FillStatus::NotConverged : result.status;
+            continue;
+        }
+        result.merge(solutions[i]->result);
 
-                input_images.images[c](row, col) = solutions[c](variable_numbers.at(flatten_index(row, col)));
+        auto const& pixels = components.region_map.at(labels[i]);
+        for (size_t c = 0; c < input_images.images.size(); ++c) {
+            for (size_t p = 0; p < pixels.size(); ++p) {
+                input_images.images[c](pixels[p].row, pixels[p].col) = static_cast<T>(solutions[i]->channels[c]((Eigen::Index)p));
             }
         }
+        records.push_back(solutions[i]->perf_info);
+    }
+    if (db != nullptr) {
+        db->write_perf_info(records);
     }
 
     spdlog::debug("It took {:.2f} seconds to solve the poisson equation", sw);
+    return result;
+}
+
+FillResult blend_images_poisson(
+    MultiChannelImage& input_images,
+    MultiChannelImage const& replacement_images,
+    MatX<bool> const& invalid_mask,
+    SolverOptions const& options)
+{
+    return blend_regions<f64>(input_images, replacement_images, invalid_mask, nullptr, options);
+}
+
+FillResult blend_images_poisson(
+    MultiChannelImage& input_images,
+    MultiChannelImage const& replacement_images,
+    MatX<bool> const& invalid_mask,
+    MultiChannelImage const& warm_start,
+    SolverOptions const& options)
+{
+    return blend_regions(input_images, replacement_images, invalid_mask, &warm_start, options);
+}
 
-    fs::path output_path = "/home/ebiederstadt/masters/earth_engine/s2_collection/2019_01_downsampled/test_indexing";
-    output_path = output_path / "perf_info.csv";
-    perf_info.write(output_path);
+FillResult blend_images_poisson(
+    MultiChannelImageF32& input_images,
+    MultiChannelImageF32 const& replacement_images,
+    MatX<bool> const& invalid_mask,
+    SolverOptions const& options)
+{
+    return blend_regions<f32>(input_images, replacement_images, invalid_mask, nullptr, options);
+}
+
+void blend_images_poisson(
+    MultiChannelImage& input_images,
+    MultiChannelImage const& replacement_images,
+    MatX<bool> const& invalid_mask,
+    f64 tolerance,
+    std::optional<int> max_iterations)
+{
+    SolverOptions options {
+        .tolerance = tolerance,
+        .max_iterations = max_iterations
+    };
+    blend_images_poisson(input_images, replacement_images, invalid_mask, options);
+}
+
+std::vector<MatX<f64>> blend_images_poisson(
+    std::vector<MatX<f64>> const& input_images,
+    std::vector<MatX<f64>> const& replacement_images,
+    MatX<bool> const& invalid_mask,
+    SolverOptions const& options)
+{
+    MultiChannelImage input(input_images);
+    MultiChannelImage replacement(replacement_images);
+    blend_images_poisson(input, replacement, invalid_mask, options);
+    return input.images;
+}
+
+std::vector<MatX<f32>> blend_images_poisson(
+    std::vector<MatX<f32>> const& input_images,
+    std::vector<MatX<f32>> const& replacement_images,
+    MatX<bool> const& invalid_mask,
+    SolverOptions const& options)
+{
+    MultiChannelImageF32 input(input_images);
+    MultiChannelImageF32 replacement(replacement_images);
+    blend_images_poisson(input, replacement, invalid_mask, options);
+    return input.images;
 }
 
 std::vector<MatX<f64>> blend_images_poisson(
@@ -295,10 +634,74 @@ std::vector<MatX<f64>> blend_images_poisson(
     MatX<bool> const& invalid_mask,
     f64 tolerance,
     std::optional<int> max_iterations)
+{
+    SolverOptions options {
+        .tolerance = tolerance,
+        .max_iterations = max_iterations
+    };
+    return blend_images_poisson(input_images, replacement_images, invalid_mask, options);
+}
+
+// The blended image is the replacement image plus a membrane: the harmonic interpolation of the differences between the
+// images on the boundary of the mask. The membrane is approximated with the normalized convolution of the differences
+// on the boundary, which the convolution pyramid computes in linear time
+template<typename T>
+static void blend_pyramid(BasicMultiChannelImage<T>& input_images, BasicMultiChannelImage<T> const& replacement_images, MatX<bool> const& invalid_mask)
+{
+    if (replacement_images.size() != input_images.size() || replacement_images.images.size() != input_images.images.size()) {
+        spdlog::error("Cannot solve problem: replacement image is not the same size as input image ({} vs {})", replacement_images.size(), input_images.size());
+        return;
+    }
+    if (input_images.size() != invalid_mask.size()) {
+        spdlog::error("Cannot solve problem: input images and mask are different sizes ({} vs {})", input_images.size(), invalid_mask.size());
+        return;
+    }
+
+    spdlog::stopwatch sw;
+    // The valid pixels next to the mask
+    MatX<f64> boundary = MatX<f64>::Zero(invalid_mask.rows(), invalid_mask.cols());
+    for (Eigen::Index col = 0; col < invalid_mask.cols(); ++col) {
+        for (Eigen::Index row = 0; row < invalid_mask.rows(); ++row) {
+            if (!invalid_mask(row, col)) {
+                continue;
+            }
+            for (auto const& [nrow, ncol] : valid_neighbours(invalid_mask, { row, col })) {
+                if (!invalid_mask(nrow, ncol)) {
+                    boundary(nrow, ncol) = 1.0;
+                }
+            }
+        }
+    }
+
+    PyramidKernels kernels = membrane_kernels();
+    MatX<f64> weights = convolution_pyramid(boundary, kernels);
+    for (size_t c = 0; c < input_images.images.size(); ++c) {
+        MatX<f64> differences = (boundary.array() > 0.0).select(input_images.images[c].template cast<f64>() - replacement_images.images[c].template cast<f64>(), 0.0);
+        MatX<f64> membrane = convolution_pyramid(differences, kernels);
+        // Without any boundary (the whole image is masked), the replacement image is used as it is
+        membrane = (weights.array() > 0.0).select(membrane.array() / weights.array(), 0.0);
+        input_images.images[c] = invalid_mask.select((replacement_images.images[c].template cast<f64>() + membrane).template cast<T>(), input_images.images[c]);
+    }
+    spdlog::debug("It took {:.2f} seconds to blend {} channels with a convolution pyramid", sw, input_images.images.size());
+}
+
+void blend_images_poisson_pyramid(MultiChannelImage& input_images, MultiChannelImage const& replacement_images, MatX<bool> const& invalid_mask)
+{
+    blend_pyramid(input_images, replacement_images, invalid_mask);
+}
+
+void blend_images_poisson_pyramid(MultiChannelImageF32& input_images, MultiChannelImageF32 const& replacement_images, MatX<bool> const& invalid_mask)
+{
+    blend_pyramid(input_images, replacement_images, invalid_mask);
+}
+
+std::vector<MatX<f64>> blend_images_poisson_pyramid(
+    std::vector<MatX<f64>> const& input_images,
+    std::vector<MatX<f64>> const& replacement_images,
+    MatX<bool> const& invalid_mask)
 {
     MultiChannelImage input(input_images);
-    MultiChannelImage replacement(replacement_images);
-    blend_images_poisson(input, replacement, invalid_mask, tolerance, max_iterations);
+    blend_pyramid(input, MultiChannelImage(replacement_images), invalid_mask);
     return input.images;
 }
 
@@ -320,6 +723,57 @@ void highlight_area_replaced(MultiChannelImage& input_images, MultiChannelImage
     }
 }
 
+fs::path approximated_band_path(fs::path const& base_folder, date_time::date const& date, std::string const& band_name, int id)
+{
+    return base_folder / date_time::to_iso_extended_string(date) / "approximated_data" / fmt::format("{}_{}.tif", band_name, id);
+}
+
+fs::path write_approximated_band(
+    DataBase& db,
+    fs::path const& base_folder,
+    std::string const& date_string,
+    std::string const& band_name,
+    MatX<f64> const& values,
+    fs::path const& template_path,
+    ApproxMethod method)
+{
+    int id = db.write_approx_results(date_string, band_name, method);
+    fs::path path = approximated_band_path(base_folder, date_time::from_simple_string(date_string), band_name, id);
+    fs::create_directories(path.parent_path());
+    utils::GeoTiffWriter<f64> writer(std::make_shared<MatX<f64>>(values), template_path);
+    writer.write(path);
+    return path;
+}
+
+std::optional<MultiChannelImage> find_warm_start(
+    DataBase& db,
+    fs::path const& base_folder,
+    std::string const& date_string,
+    std::vector<std::string> const& band_names,
+    ApproxMethod method)
+{
+    MultiChannelImage warm_start;
+    for (auto const& band_name : band_names) {
+        std::optional<ApproxResult> previous = db.select_previous_approx(date_string, band_name, method);
+        if (!previous.has_value()) {
+            spdlog::debug("No warm start for {}: {} was not approximated before", date_string, band_name);
+            return {};
+        }
+        fs::path path = approximated_band_path(base_folder, previous->date, band_name, previous->id);
+        if (!fs::exists(path)) {
+            spdlog::warn("No warm start for {}: {} does not exist", date_string, path);
+            return {};
+        }
+        warm_start.images.push_back(utils::GeoTIFF<f64>(path).read(1));
+        if (warm_start.images.back().rows() != warm_start.images.front().rows() || warm_start.images.back().cols() != warm_start.images.front().cols()) {
+            spdlog::warn("No warm start for {}: the earlier results are different sizes", date_string);
+            return {};
+        }
+        spdlog::debug("Warm starting {} from {}", band_name, path);
+    }
+    return warm_start;
+}
+
 std::string find_good_close_image(std::string const& date_string, f64 distance_weight, DataBase& db)
 {
     if (distance_weight < 0 || distance_weight > 1) {
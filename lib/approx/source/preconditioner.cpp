@@ -0,0 +1,197 @@
+#include "approx/preconditioner.h"
+
+#include <algorithm>
+#include <utils/log.h>
+
+namespace approx {
+static auto logger = utils::create_logger("approx::preconditioner");
+
+void SSORPreconditioner::setup(sparse_t const& A)
+{
+    if (m_omega <= 0.0 || m_omega >= 2.0) {
+        logger->error("SSOR relaxation factor must be between 0 and 2 (got {})", m_omega);
+        m_info = Eigen::InvalidInput;
+        return;
+    }
+
+    m_diagonal = A.diagonal();
+    // The diagonal of the systems is never zero, so the entries already exist and can be scaled in place
+    m_lower = A.triangularView<Eigen::Lower>();
+    for (Eigen::Index i = 0; i < A.rows(); ++i) {
+        m_lower.coeffRef(i, i) = m_diagonal[i] / m_omega;
+    }
+    m_info = Eigen::Success;
+}
+
+VecX<f64> SSORPreconditioner::apply(VecX<f64> const& b) const
+{
+    // Forward sweep, scale by the diagonal, then the backward sweep, and the scaling factor w (2 - w) of M
+    VecX<f64> x = m_lower.triangularView<Eigen::Lower>().solve(b);
+    x = x.cwiseProduct(m_diagonal) / m_omega;
+    m_lower.transpose().triangularView<Eigen::Upper>().solveInPlace(x);
+    return x * (2.0 - m_omega);
+}
+
+void BlockJacobiPreconditioner::setup(sparse_t const& A)
+{
+    long block_size = std::max<long>(m_block_size, 1);
+    sparse_t blocks = A;
+    blocks.prune([&](Eigen::Index row, Eigen::Index col, f64) {
+        return row / block_size == col / block_size;
+    });
+    m_blocks.compute(blocks);
+    if (m_blocks.info() != Eigen::Success) {
+        logger->warn("Failed to factorize the blocks of the block-Jacobi preconditioner ({} unknowns)", A.rows());
+    }
+}
+
+void SchwarzPreconditioner::setup(sparse_t const& A)
+{
+    m_rows = A.rows();
+    m_subdomains.clear();
+    m_coarse.reset();
+    if ((Eigen::Index)m_unknowns.size() != A.rows()) {
+        logger->error("Additive Schwarz needs the pixel of every unknown ({} unknowns, {} pixels)", A.rows(), m_unknowns.size());
+        m_info = Eigen::InvalidInput;
+        return;
+    }
+    if (m_unknowns.empty()) {
+        m_info = Eigen::Success;
+        return;
+    }
+    long tile_size = std::max<long>(m_tile_size, 1);
+    // A pixel is at most in the extended tiles next to its own tile
+    long overlap = std::clamp<long>(m_overlap, 0, tile_size - 1);
+
+    Eigen::Index first_row = m_unknowns.front().row, first_col = m_unknowns.front().col, last_col = first_col;
+    for (auto const& [row, col] : m_unknowns) {
+        first_row = std::min(first_row, row);
+        first_col = std::min(first_col, col);
+        last_col = std::max(last_col, col);
+    }
+    Eigen::Index tile_cols = (last_col - first_col) / tile_size + 1;
+
+    // Only the tiles that contain unknowns are subdomains
+    std::vector<Eigen::Index> tile_of_unknown(m_unknowns.size());
+    for (size_t i = 0; i < m_unknowns.size(); ++i) {
+        tile_of_unknown[i] = ((m_unknowns[i].row - first_row) / tile_size) * tile_cols + (m_unknowns[i].col - first_col) / tile_size;
+    }
+    std::vector<Eigen::Index> used_tiles = tile_of_unknown;
+    std::sort(used_tiles.begin(), used_tiles.end());
+    used_tiles.erase(std::unique(used_tiles.begin(), used_tiles.end()), used_tiles.end());
+    auto subdomain_index = [&](Eigen::Index tile) -> Eigen::Index {
+        auto it = std::lower_bound(used_tiles.begin(), used_tiles.end(), tile);
+        return it != used_tiles.end() && *it == tile ? it - used_tiles.begin() : -1;
+    };
+
+    m_subdomains.resize(used_tiles.size());
+    m_tiles.resize(m_unknowns.size());
+    for (size_t i = 0; i < m_unknowns.size(); ++i) {
+        m_tiles[i] = subdomain_index(tile_of_unknown[i]);
+        Eigen::Index row = m_unknowns[i].row - first_row;
+        Eigen::Index col = m_unknowns[i].col - first_col;
+        // The extended tiles that contain the pixel
+        for (Eigen::Index r = std::max<Eigen::Index>(0, (row - overlap) / tile_size); r <= (row + overlap) / tile_size; ++r) {
+            for (Eigen::Index c = std::max<Eigen::Index>(0, (col - overlap) / tile_size); c <= std::min(tile_cols - 1, (col + overlap) / tile_size); ++c) {
+                Eigen::Index subdomain = subdomain_index(r * tile_cols + c);
+                if (subdomain >= 0) {
+                    m_subdomains[(size_t)subdomain].unknowns.push_back((Eigen::Index)i);
+                }
+            }
+        }
+    }
+
+    // The system of every subdomain is the part of the matrix between its unknowns: the unknowns outside of the
+    // subdomain are zero
+    bool failed = false;
+#pragma omp parallel
+    {
+        std::vector<Eigen::Index> local(m_unknowns.size(), -1);
+#pragma omp for schedule(dynamic)
+        for (long s = 0; s < (long)m_subdomains.size(); ++s) {
+            auto& subdomain = m_subdomains[(size_t)s];
+            for (size_t k = 0; k < subdomain.unknowns.size(); ++k) {
+                local[(size_t)subdomain.unknowns[k]] = (Eigen::Index)k;
+            }
+            std::vector<triplet_t> coefficients;
+            coefficients.reserve(subdomain.unknowns.size() * 5);
+            for (size_t k = 0; k < subdomain.unknowns.size(); ++k) {
+                for (sparse_t::InnerIterator it(A, subdomain.unknowns[k]); it; ++it) {
+                    if (local[(size_t)it.row()] >= 0) {
+                        coefficients.emplace_back(local[(size_t)it.row()], (Eigen::Index)k, it.value());
+                    }
+                }
+            }
+            sparse_t block((Eigen::Index)subdomain.unknowns.size(), (Eigen::Index)subdomain.unknowns.size());
+            block.setFromTriplets(coefficients.begin(), coefficients.end());
+            subdomain.factorization = std::make_unique<Eigen::SimplicialLDLT<sparse_t>>(block);
+            if (subdomain.factorization->info() != Eigen::Success) {
+#pragma omp atomic write
+                failed = true;
+            }
+            for (auto unknown : subdomain.unknowns) {
+                local[(size_t)unknown] = -1;
+            }
+        }
+    }
+    if (failed) {
+        logger->warn("Failed to factorize the subdomains of the additive Schwarz preconditioner ({} unknowns)", A.rows());
+        m_info = Eigen::NumericalIssue;
+        return;
+    }
+
+    // The coarse system R A R^T, where R sums the unknowns of every tile
+    if (m_subdomains.size() > 1) {
+        sparse_t restriction((Eigen::Index)m_subdomains.size(), A.rows());
+        std::vector<triplet_t> coefficients;
+        coefficients.reserve(m_tiles.size());
+        for (size_t i = 0; i < m_tiles.size(); ++i) {
+            coefficients.emplace_back(m_tiles[i], (Eigen::Index)i, 1.0);
+        }
+        restriction.setFromTriplets(coefficients.begin(), coefficients.end());
+        sparse_t coarse = restriction * A * sparse_t(restriction.transpose());
+        m_coarse = std::make_unique<Eigen::SimplicialLDLT<sparse_t>>(coarse);
+        if (m_coarse->info() != Eigen::Success) {
+            logger->warn("Failed to factorize the coarse system of the additive Schwarz preconditioner, it is only one level");
+            m_coarse.reset();
+        }
+    }
+    logger->debug("Additive Schwarz preconditioner with {} subdomains for {} unknowns", m_subdomains.size(), A.rows());
+    m_info = Eigen::Success;
+}
+
+VecX<f64> SchwarzPreconditioner::apply(VecX<f64> const& b) const
+{
+    // The subdomains are solved in parallel, and added up afterwards since they overlap
+    std::vector<VecX<f64>> solutions(m_subdomains.size());
+#pragma omp parallel for schedule(dynamic)
+    for (long s = 0; s < (long)m_subdomains.size(); ++s) {
+        auto const& subdomain = m_subdomains[(size_t)s];
+        VecX<f64> local(subdomain.unknowns.size());
+        for (size_t k = 0; k < subdomain.unknowns.size(); ++k) {
+            local[(Eigen::Index)k] = b[subdomain.unknowns[k]];
+        }
+        solutions[(size_t)s] = subdomain.factorization->solve(local);
+    }
+
+    VecX<f64> x = VecX<f64>::Zero(b.rows());
+    for (size_t s = 0; s < m_subdomains.size(); ++s) {
+        auto const& unknowns = m_subdomains[s].unknowns;
+        for (size_t k = 0; k < unknowns.size(); ++k) {
+            x[unknowns[k]] += solutions[s][(Eigen::Index)k];
+        }
+    }
+
+    if (m_coarse != nullptr) {
+        VecX<f64> coarse_b = VecX<f64>::Zero(m_coarse->rows());
+        for (size_t i = 0; i < m_tiles.size(); ++i) {
+            coarse_b[m_tiles[i]] += b[(Eigen::Index)i];
+        }
+        VecX<f64> coarse_x = m_coarse->solve(coarse_b);
+        for (size_t i = 0; i < m_tiles.size(); ++i) {
+            x[(Eigen::Index)i] += coarse_x[m_tiles[i]];
+        }
+    }
+    return x;
+}
+}
@@ -0,0 +1,226 @@
+#include "approx/quadtree.h"
+
+#include <queue>
+#include <unordered_map>
+#include <utils/log.h>
+
+namespace approx {
+static auto logger = utils::create_logger("approx::quadtree");
+
+// The interpolation of a single pixel from the nodes: (node, weight) pairs
+using weights_t = std::vector<std::pair<int, f64>>;
+
+namespace {
+    // The part of the image that contains the region, and the maps of the quadtree over it
+    class RegionGrid {
+    public:
+        RegionGrid(std::vector<index_t> const& pixels, MatX<int> const& labels, int label)
+            : m_labels(labels)
+            , m_label(label)
+        {
+            m_first_row = m_last_row = pixels.front().row;
+            m_first_col = m_last_col = pixels.front().col;
+            for (auto const& [row, col] : pixels) {
+                m_first_row = std::min(m_first_row, row);
+                m_last_row = std::max(m_last_row, row);
+                m_first_col = std::min(m_first_col, col);
+                m_last_col = std::max(m_last_col, col);
+            }
+            distance = MatX<long>::Zero(rows(), cols());
+            cell_size = MatX<long>::Zero(rows(), cols());
+            node = MatX<int>::Constant(rows(), cols(), -1);
+        }
+
+        [[nodiscard]] Eigen::Index rows() const { return m_last_row - m_first_row + 1; }
+        [[nodiscard]] Eigen::Index cols() const { return m_last_col - m_first_col + 1; }
+        [[nodiscard]] bool in_region(Eigen::Index row, Eigen::Index col) const
+        {
+            return row >= m_first_row && row <= m_last_row && col >= m_first_col && col <= m_last_col && m_labels(row, col) == m_label;
+        }
+        [[nodiscard]] bool in_image(Eigen::Index row, Eigen::Index col) const
+        {
+            return row >= 0 && col >= 0 && row < m_labels.rows() && col < m_labels.cols();
+        }
+        // The maps are indexed with image coordinates
+        template<typename Matrix>
+        auto& at(Matrix& map, Eigen::Index row, Eigen::Index col) const
+        {
+            return map(row - m_first_row, col - m_first_col);
+        }
+
+        [[nodiscard]] Eigen::Index first_row() const { return m_first_row; }
+        [[nodiscard]] Eigen::Index first_col() const { return m_first_col; }
+        [[nodiscard]] Eigen::Index last_row() const { return m_last_row; }
+        [[nodiscard]] Eigen::Index last_col() const { return m_last_col; }
+
+        // The chessboard distance of every pixel of the region to the closest pixel that is not in the region. The
+        // border of the image is not a boundary: the blend has no boundary values there
+        MatX<long> distance;
+        // The size of the cell that every pixel is in (0 outside of the region)
+        MatX<long> cell_size;
+        // The node of the top-left pixel of every cell
+        MatX<int> node;
+
+    private:
+        MatX<int> const& m_labels;
+        int m_label;
+        Eigen::Index m_first_row, m_last_row, m_first_col, m_last_col;
+    };
+}
+
+static void compute_distances(RegionGrid& grid, std::vector<index_t> const& pixels)
+{
+    std::queue<index_t> queue;
+    for (auto const& [row, col] : pixels) {
+        bool boundary = false;
+        for (Eigen::Index dr = -1; dr <= 1 && !boundary; ++dr) {
+            for (Eigen::Index dc = -1; dc <= 1 && !boundary; ++dc) {
+                boundary = grid.in_image(row + dr, col + dc) && !grid.in_region(row + dr, col + dc);
+            }
+        }
+        if (boundary) {
+            grid.at(grid.distance, row, col) = 1;
+            queue.push({ row, col });
+        }
+    }
+    // Without any boundary, the whole region is as far from the boundary as the image is large
+    if (queue.empty()) {
+        grid.distance = (grid.distance.array() == 0).select(MatX<long>::Constant(grid.rows(), grid.cols(), std::max(grid.rows(), grid.cols())), grid.distance);
+        return;
+    }
+
+    while (!queue.empty()) {
+        auto [row, col] = queue.front();
+        queue.pop();
+        long next = grid.at(grid.distance, row, col) + 1;
+        for (Eigen::Index dr = -1; dr <= 1; ++dr) {
+            for (Eigen::Index dc = -1; dc <= 1; ++dc) {
+                Eigen::Index nrow = row + dr, ncol = col + dc;
+                if (grid.in_region(nrow, ncol) && grid.at(grid.distance, nrow, ncol) == 0) {
+                    grid.at(grid.distance, nrow, ncol) = next;
+                    queue.push({ nrow, ncol });
+                }
+            }
+        }
+    }
+}
+
+// A cell can be a leaf if the cell and the corners it is interpolated from (the pixels up to row + size and
+// col + size) are in the region, and are far enough from the boundary
+static bool can_be_leaf(RegionGrid const& grid, Eigen::Index row, Eigen::Index col, long size, f64 grading)
+{
+    auto min_distance = (long)std::ceil(grading * (f64)size);
+    for (Eigen::Index c = col; c <= col + size; ++c) {
+        for (Eigen::Index r = row; r <= row + size; ++r) {
+            if (!grid.in_region(r, c) || grid.distance(r - grid.first_row(), c - grid.first_col()) < min_distance) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void subdivide(RegionGrid& grid, Eigen::Index row, Eigen::Index col, long size, f64 grading, Quadtree& tree)
+{
+    if (row > grid.last_row() || col > grid.last_col() || row + size <= grid.first_row() || col + size <= grid.first_col()) {
+        return;
+    }
+    bool leaf = size == 1 ? grid.in_region(row, col) : can_be_leaf(grid, row, col, size, grading);
+    if (leaf) {
+        grid.at(grid.node, row, col) = (int)tree.nodes.size();
+        tree.nodes.push_back({ row, col });
+        tree.cell_sizes.push_back(size);
+        for (Eigen::Index c = col; c < col + size; ++c) {
+            for (Eigen::Index r = row; r < row + size; ++r) {
+                grid.at(grid.cell_size, r, c) = size;
+            }
+        }
+        return;
+    }
+    if (size > 1) {
+        long half = size / 2;
+        subdivide(grid, row, col, half, grading, tree);
+        subdivide(grid, row + half, col, half, grading, tree);
+        subdivide(grid, row, col + half, half, grading, tree);
+        subdivide(grid, row + half, col + half, half, grading, tree);
+    }
+}
+
+// Bilinear interpolation from the corners of the cell. The corners on the far side of the cell can be on the side of
+// a larger cell, so they are interpolated in turn. Those cells are always larger, so this ends after a few cells
+static weights_t interpolate(RegionGrid const& grid, Eigen::Index row, Eigen::Index col, std::unordered_map<Eigen::Index, weights_t>& corners)
+{
+    long size = grid.cell_size(row - grid.first_row(), col - grid.first_col());
+    Eigen::Index cell_row = row - row % size;
+    Eigen::Index cell_col = col - col % size;
+    if (cell_row == row && cell_col == col) {
+        return { { grid.node(row - grid.first_row(), col - grid.first_col()), 1.0 } };
+    }
+
+    f64 tr = (f64)(row - cell_row) / (f64)size;
+    f64 tc = (f64)(col - cell_col) / (f64)size;
+    std::array<std::tuple<Eigen::Index, Eigen::Index, f64>, 4> corner_weights { {
+        { cell_row, cell_col, (1.0 - tr) * (1.0 - tc) },
+        { cell_row + size, cell_col, tr * (1.0 - tc) },
+        { cell_row, cell_col + size, (1.0 - tr) * tc },
+        { cell_row + size, cell_col + size, tr * tc },
+    } };
+
+    weights_t result;
+    for (auto const& [r, c, w] : corner_weights) {
+        if (w == 0.0) {
+            continue;
+        }
+        Eigen::Index key = (r - grid.first_row()) * (grid.cols() + 1) + (c - grid.first_col());
+        auto it = corners.find(key);
+        if (it == corners.end()) {
+            it = corners.emplace(key, interpolate(grid, r, c, corners)).first;
+        }
+        for (auto const& [node, node_weight] : it->second) {
+            auto existing = std::find_if(result.begin(), result.end(), [&](auto const& entry) { return entry.first == node; });
+            if (existing != result.end()) {
+                existing->second += w * node_weight;
+            } else {
+                result.emplace_back(node, w * node_weight);
+            }
+        }
+    }
+    return result;
+}
+
+Quadtree build_quadtree(std::vector<index_t> const& pixels, MatX<int> const& labels, int label, QuadtreeOptions const& options)
+{
+    Quadtree tree;
+    if (pixels.empty()) {
+        return tree;
+    }
+    RegionGrid grid(pixels, labels, label);
+    compute_distances(grid, pixels);
+
+    // The largest cells are aligned to multiples of their size, so the smaller cells are too
+    long max_size = 1;
+    while (max_size * 2 <= std::max(options.max_cell_size, 1L)) {
+        max_size *= 2;
+    }
+    for (Eigen::Index col = grid.first_col() - grid.first_col() % max_size; col <= grid.last_col(); col += max_size) {
+        for (Eigen::Index row = grid.first_row() - grid.first_row() % max_size; row <= grid.last_row(); row += max_size) {
+            subdivide(grid, row, col, max_size, options.grading, tree);
+        }
+    }
+
+    std::unordered_map<Eigen::Index, weights_t> corners;
+    std::vector<Eigen::Triplet<f64>> coefficients;
+    coefficients.reserve(pixels.size() * 4);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        for (auto const& [node, weight] : interpolate(grid, pixels[i].row, pixels[i].col, corners)) {
+            coefficients.emplace_back((Eigen::Index)i, node, weight);
+        }
+    }
+    tree.interpolation.resize((Eigen::Index)pixels.size(), (Eigen::Index)tree.nodes.size());
+    tree.interpolation.setFromTriplets(coefficients.begin(), coefficients.end());
+
+    logger->debug("Quadtree of a region with {} pixels: {} nodes ({:.1f}x fewer unknowns)", pixels.size(), tree.nodes.size(),
+        (f64)pixels.size() / (f64)std::max<size_t>(tree.nodes.size(), 1));
+    return tree;
+}
+}
@@ -0,0 +1,440 @@
+#include "approx/solver.h"
+#include "approx/dispatch.h"
+
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <utils/log.h>
+
+namespace approx {
+static auto logger = utils::create_logger("approx::solver");
+
+// The number of multigrid cycles (or mixed precision iterations) that is timed before the rest are fitted into the time
+// budget
+static constexpr long first_deadline_chunk = 8;
+
+void FillResult::merge(FillResult const& other)
+{
+    if (other.status == FillStatus::DeadlineReached || (other.status == FillStatus::NotConverged && status == FillStatus::Converged)) {
+        status = other.status;
+    }
+    error = std::max(error, other.error);
+    iterations += other.iterations;
+}
+
+deadline_t start_deadline(SolverOptions const& options)
+{
+    if (!options.time_budget.has_value()) {
+        return {};
+    }
+    auto budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<f64>(*options.time_budget));
+    return std::chrono::steady_clock::now() + budget;
+}
+
+bool decomposes_region(SolverOptions const& options, long num_unknowns)
+{
+    auto const& preconditioner = options.preconditioner;
+    return options.backend == SolverBackend::ConjugateGradient && preconditioner.type == Preconditioner::AdditiveSchwarz
+        && num_unknowns > preconditioner.tile_size * preconditioner.tile_size;
+}
+
+// Create one of Eigen's conjugate gradient solvers. The preconditioner is configured before the matrix is factorized
+template<typename Solver, typename Matrix, typename Configure>
+static std::unique_ptr<Solver> make_conjugate_gradient(Matrix const& A, long max_iterations, f64 tolerance, Configure&& configure)
+{
+    auto solver = std::make_unique<Solver>();
+    configure(solver->preconditioner());
+    solver->compute(A);
+    solver->setMaxIterations(max_iterations);
+    solver->setTolerance(tolerance);
+    return solver;
+}
+
+LinearSolver::LinearSolver(StencilSystem const& system, SolverOptions const& requested_options, deadline_t deadline)
+    : m_deadline(deadline)
+{
+    auto start = std::chrono::steady_clock::now();
+    SolverOptions options = requested_options;
+    if (options.backend == SolverBackend::Automatic) {
+        options.backend = select_backend(system, options.dispatch.has_value() ? *options.dispatch : dispatch_thresholds(options.tolerance));
+    }
+    if (options.backend == SolverBackend::MatrixFreeConjugateGradient && !fits_matrix_free(system)) {
+        // The same iterations on the sparse matrix, which only stores the unknowns
+        logger->debug("Region with {} unknowns is too sparse for the matrix-free solver, using the sparse matrix", system.size());
+        options.backend = SolverBackend::ConjugateGradient;
+        options.preconditioner = {};
+    }
+    m_backend = options.backend;
+    m_preconditioner = options.preconditioner.type;
+    m_tolerance = options.tolerance;
+
+    // The setup counts against the deadline. Once it has passed, the preconditioner (or the factorization) is not set up
+    // at all, and only the matrix is assembled to report the residuals of the guesses
+    if (m_deadline.has_value() && start >= *m_deadline) {
+        logger->debug("Not setting up a region with {} unknowns: the deadline has passed", system.size());
+        m_setup_skipped = true;
+        m_matrix = system.assemble();
+        m_setup_info = m_info = Eigen::Success;
+        m_setup_time = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return;
+    }
+
+    // Reordering only changes where the unknowns are in memory, so it is undone around every solve
+    StencilSystem reordered;
+    bool reorder_unknowns = options.ordering != UnknownOrdering::Raster && options.backend != SolverBackend::MatrixFreeConjugateGradient
+        && options.backend != SolverBackend::Cholesky;
+    if (reorder_unknowns) {
+        m_order = unknown_order(system, options.ordering);
+        reordered = reorder(system, m_order);
+    }
+    StencilSystem const& ordered = reorder_unknowns ? reordered : system;
+    // The matrix-free solver never needs the matrix, and the direct solver only assembles it if the factorization is not cached.
+    // The single and mixed precision solver assembles its own f32 copy if it needs one
+    bool reduced_precision = options.preconditioner.type == Preconditioner::Jacobi && options.precision != Precision::Double;
+    if (options.backend != SolverBackend::MatrixFreeConjugateGradient && options.backend != SolverBackend::Cholesky
+        && !(options.backend == SolverBackend::ConjugateGradient && reduced_precision)) {
+        m_matrix = ordered.assemble();
+    }
+    m_block = options.block_channels && options.backend == SolverBackend::ConjugateGradient
+        && options.preconditioner.type == Preconditioner::Jacobi && options.precision == Precision::Double;
+
+    switch (options.backend) {
+    case SolverBackend::ConjugateGradient: {
+        m_max_iterations = options.max_iterations.value_or(std::max<long>(ordered.size(), 100));
+        auto const& preconditioner = options.preconditioner;
+        switch (preconditioner.type) {
+        case Preconditioner::Jacobi:
+            if (reduced_precision) {
+                auto solver = std::make_unique<MixedPrecisionSolver>(ordered, options.precision);
+                solver->setMaxIterations(m_max_iterations);
+                solver->setTolerance(options.tolerance);
+                m_solver = std::move(solver);
+            } else {
+                m_solver = make_conjugate_gradient<SparseSolver>(row_major_view(m_matrix), m_max_iterations, options.tolerance, [](auto&) {});
+            }
+            break;
+        case Preconditioner::IncompleteCholesky:
+            m_solver = make_conjugate_gradient<IncompleteCholeskyCG>(m_matrix, m_max_iterations, options.tolerance, [](auto&) {});
+            break;
+        case Preconditioner::SSOR:
+            m_solver = make_conjugate_gradient<SSORCG>(m_matrix, m_max_iterations, options.tolerance,
+                [&](SSORPreconditioner& p) { p.set_omega(preconditioner.omega); });
+            break;
+        case Preconditioner::BlockJacobi:
+            m_solver = make_conjugate_gradient<BlockJacobiCG>(m_matrix, m_max_iterations, options.tolerance,
+                [&](BlockJacobiPreconditioner& p) { p.set_block_size(preconditioner.block_size); });
+            break;
+        case Preconditioner::AdditiveSchwarz:
+            // The row-major matrix runs the products of the outer iterations on all the threads as well
+            m_solver = make_conjugate_gradient<SchwarzCG>(row_major_view(m_matrix), m_max_iterations, options.tolerance,
+                [&](SchwarzPreconditioner& p) { p.set_unknowns(ordered.unknowns, preconditioner.tile_size, preconditioner.overlap); });
+            break;
+        case Preconditioner::SineTransform:
+            m_solver = make_conjugate_gradient<SineTransformCG>(row_major_view(m_matrix), m_max_iterations, options.tolerance,
+                [&](SineTransformPreconditioner& p) { p.set_unknowns(ordered.unknowns); });
+            break;
+        }
+        break;
+    }
+    case SolverBackend::Multigrid: {
+        m_max_iterations = options.max_iterations.value_or(100);
+        auto solver = std::make_unique<Multigrid>(m_matrix, ordered.unknowns, options.multigrid);
+        solver->setMaxIterations(m_max_iterations);
+        solver->setTolerance(options.tolerance);
+        m_solver = std::move(solver);
+        break;
+    }
+    case SolverBackend::MultigridConjugateGradient: {
+        m_max_iterations = options.max_iterations.value_or(std::max<long>(ordered.size(), 100));
+        m_solver = make_conjugate_gradient<MultigridCG>(m_matrix, m_max_iterations, options.tolerance,
+            [&](MultigridPreconditioner& p) { p.set_unknowns(ordered.unknowns, options.multigrid); });
+        break;
+    }
+    case SolverBackend::MatrixFreeConjugateGradient: {
+        m_max_iterations = options.max_iterations.value_or(std::max<long>(ordered.size(), 100));
+        if (options.precision != Precision::Double) {
+            // The region fits the matrix-free solver, so the f32 iterations run on the grids as well
+            auto solver = std::make_unique<MixedPrecisionSolver>(ordered, options.precision);
+            solver->setMaxIterations(m_max_iterations);
+            solver->setTolerance(options.tolerance);
+            m_solver = std::move(solver);
+        } else {
+            auto solver = std::make_unique<StencilConjugateGradient>(ordered);
+            solver->setMaxIterations(m_max_iterations);
+            solver->setTolerance(options.tolerance);
+            m_solver = std::move(solver);
+        }
+        break;
+    }
+    case SolverBackend::Cholesky: {
+        auto solver = std::make_unique<CholeskySolver>(ordered);
+        if (solver->cached()) {
+            logger->debug("Reusing the cached factorization for a region with {} unknowns", ordered.size());
+        }
+        m_solver = std::move(solver);
+        break;
+    }
+    case SolverBackend::Automatic:
+        break;
+    }
+    m_info = std::visit([](auto const& solver) { return solver->info(); }, m_solver);
+    m_setup_info = m_info;
+
+    auto end = std::chrono::steady_clock::now();
+    m_setup_time = std::chrono::duration<f64, std::milli>(end - start).count();
+}
+
+LinearSolver::~LinearSolver() = default;
+
+// The rows of X in the given order
+static MatX<f64> gather_rows(MatX<f64> const& X, std::vector<Eigen::Index> const& order)
+{
+    MatX<f64> result(X.rows(), X.cols());
+    for (Eigen::Index c = 0; c < X.cols(); ++c) {
+        for (size_t i = 0; i < order.size(); ++i) {
+            result((Eigen::Index)i, c) = X(order[i], c);
+        }
+    }
+    return result;
+}
+
+// The inverse of gather_rows
+static MatX<f64> scatter_rows(MatX<f64> const& X, std::vector<Eigen::Index> const& order)
+{
+    MatX<f64> result(X.rows(), X.cols());
+    for (Eigen::Index c = 0; c < X.cols(); ++c) {
+        for (size_t i = 0; i < order.size(); ++i) {
+            result(order[i], c) = X((Eigen::Index)i, c);
+        }
+    }
+    return result;
+}
+
+FillResult LinearSolver::result() const
+{
+    FillResult result { .error = m_error, .iterations = m_iterations };
+    if (m_deadline_reached) {
+        result.status = FillStatus::DeadlineReached;
+    } else if (m_info != Eigen::Success) {
+        result.status = FillStatus::NotConverged;
+    }
+    return result;
+}
+
+void LinearSolver::set_tolerance(f64 tolerance)
+{
+    m_tolerance = tolerance;
+    std::visit([&](auto& solver) {
+        if constexpr (!std::is_same_v<std::decay_t<decltype(*solver)>, CholeskySolver>) {
+            if (solver != nullptr) {
+                solver->setTolerance(tolerance);
+            }
+        }
+    },
+        m_solver);
+}
+
+f64 LinearSolver::relative_residual(MatX<f64> const& B, MatX<f64> const& X) const
+{
+    // The norms do not depend on the order of the unknowns
+    MatX<f64> ordered_B = m_order.empty() ? B : gather_rows(B, m_order);
+    MatX<f64> ordered_X = m_order.empty() ? X : gather_rows(X, m_order);
+    f64 error = 0.0;
+    for (Eigen::Index c = 0; c < B.cols(); ++c) {
+        f64 b_norm = ordered_B.col(c).norm();
+        if (b_norm > 0.0) {
+            error = std::max(error, residual(ordered_B.col(c), ordered_X.col(c)).norm() / b_norm);
+        }
+    }
+    return error;
+}
+
+VecX<f64> LinearSolver::residual(VecX<f64> const& b, VecX<f64> const& x) const
+{
+    if (auto const* solver = std::get_if<std::unique_ptr<MixedPrecisionSolver>>(&m_solver)) {
+        return (*solver)->residual(b, x);
+    }
+    if (auto const* solver = std::get_if<std::unique_ptr<StencilConjugateGradient>>(&m_solver)) {
+        return (*solver)->residual(b, x);
+    }
+    if (m_matrix.rows() == 0) {
+        return VecX<f64>::Zero(b.size());
+    }
+    return b - m_matrix * x;
+}
+
+VecX<f64> LinearSolver::solveWithGuess(VecX<f64> const& b, VecX<f64> const& guess)
+{
+    m_deadline_reached = false;
+    m_solves = 1;
+    if (m_order.empty()) {
+        return solve_column(b, guess);
+    }
+    return scatter_rows(solve_column(gather_rows(b, m_order), gather_rows(guess, m_order)), m_order);
+}
+
+MatX<f64> LinearSolver::solveWithGuess(MatX<f64> const& B, MatX<f64> const& guesses)
+{
+    m_deadline_reached = false;
+    if (m_order.empty()) {
+        return solve_columns(B, guesses);
+    }
+    return scatter_rows(solve_columns(gather_rows(B, m_order), gather_rows(guesses, m_order)), m_order);
+}
+
+VecX<f64> LinearSolver::solve_column(VecX<f64> const& b, VecX<f64> const& guess)
+{
+    if (m_setup_skipped) {
+        f64 b_norm = b.norm();
+        m_iterations = 0;
+        m_error = b_norm > 0.0 ? residual(b, guess).norm() / b_norm : 0.0;
+        m_info = m_error <= m_tolerance ? Eigen::Success : Eigen::NoConvergence;
+        m_deadline_reached = m_deadline_reached || m_info != Eigen::Success;
+        return guess;
+    }
+    if (m_setup_info != Eigen::Success) {
+        m_info = m_setup_info;
+        return guess;
+    }
+    if (m_deadline.has_value()) {
+        return solve_column_until_deadline(b, guess);
+    }
+    return std::visit([&](auto& solver) -> VecX<f64> {
+        VecX<f64> x = solver->solveWithGuess(b, guess);
+        m_info = solver->info();
+        m_iterations = (long)solver->iterations();
+        m_error = (f64)solver->error();
+        return x;
+    },
+        m_solver);
+}
+
+VecX<f64> LinearSolver::solve_column_until_deadline(VecX<f64> const& b, VecX<f64> const& guess)
+{
+    using clock = std::chrono::steady_clock;
+    return std::visit([&](auto& solver) -> VecX<f64> {
+        using Solver = std::decay_t<decltype(*solver)>;
+        if constexpr (std::is_same_v<Solver, CholeskySolver>) {
+            VecX<f64> x = solver->solveWithGuess(b, guess);
+            m_info = solver->info();
+            m_iterations = 0;
+            m_error = 0.0;
+            return x;
+        } else if constexpr (std::is_same_v<Solver, StencilConjugateGradient>) {
+            solver->setDeadline(m_deadline);
+            VecX<f64> x = solver->solveWithGuess(b, guess);
+            m_info = solver->info();
+            m_iterations = solver->iterations();
+            m_error = solver->error();
+            m_deadline_reached = m_deadline_reached || solver->deadline_reached();
+            return x;
+        } else if constexpr (requires { solver->preconditioner(); }) {
+            // Eigen's conjugate gradient cannot be interrupted, so the same iterations are run here with its preconditioner
+            bool reached = false;
+            VecX<f64> x = conjugate_gradient_until_deadline(row_major_view(m_matrix), solver->preconditioner(), b, guess,
+                m_max_iterations, m_tolerance, *m_deadline, m_iterations, m_error, reached);
+            m_info = m_error <= m_tolerance ? Eigen::Success : Eigen::NoConvergence;
+            m_deadline_reached = m_deadline_reached || reached;
+            return x;
+        } else {
+            // Multigrid cycles and the f64 corrections of the mixed precision solver only carry the solution from one
+            // step to the next, so they lose nothing when they are run in chunks, which are sized from the time the
+            // earlier chunks took
+            auto start = clock::now();
+            VecX<f64> x = guess;
+            long iterations = 0;
+            // At least one iteration is done, so there is always a residual to report
+            long chunk = start >= *m_deadline ? 1 : std::min(first_deadline_chunk, m_max_iterations);
+            while (true) {
+                solver->setMaxIterations(chunk);
+                x = solver->solveWithGuess(b, x);
+                iterations += (long)solver->iterations();
+                m_info = solver->info();
+                m_error = (f64)solver->error();
+                if (m_info == Eigen::Success || iterations >= m_max_iterations) {
+                    break;
+                }
+
+                auto now = clock::now();
+                f64 per_iteration = std::chrono::duration<f64>(now - start).count() / (f64)std::max(iterations, 1L);
+                f64 remaining = std::chrono::duration<f64>(*m_deadline - now).count();
+                chunk = std::min(m_max_iterations - iterations, (long)(remaining / per_iteration));
+                if (chunk < 1) {
+                    m_deadline_reached = true;
+                    break;
+                }
+            }
+            solver->setMaxIterations(m_max_iterations);
+            m_iterations = iterations;
+            return x;
+        }
+    },
+        m_solver);
+}
+
+MatX<f64> LinearSolver::solve_columns(MatX<f64> const& B, MatX<f64> const& guesses)
+{
+    MatX<f64> X = guesses;
+    m_solves = B.cols();
+    if (m_setup_info != Eigen::Success) {
+        m_info = m_setup_info;
+        return X;
+    }
+    std::vector<Eigen::Index> columns;
+    long iterations = 0;
+    long solves = 0;
+    f64 error = 0.0;
+
+    if (auto const* direct = std::get_if<std::unique_ptr<CholeskySolver>>(&m_solver)) {
+        // All the columns are solved at once with the factorization
+        m_info = (*direct)->info();
+        m_iterations = 0;
+        m_error = 0.0;
+        return m_info == Eigen::Success ? (*direct)->solve(B) : X;
+    }
+
+    // Block conjugate gradient cannot be stopped at a deadline, so the columns are solved separately instead
+    if (m_block && B.cols() > 1 && !m_deadline.has_value()) {
+        BlockConjugateGradient block(m_matrix);
+        block.setTolerance(m_tolerance);
+        block.setMaxIterations(m_max_iterations);
+        X = block.solveWithGuess(B, guesses);
+        iterations = block.iterations();
+        solves = 1;
+
+        // The columns that did not converge in the block are solved on their own, starting from the block result.
+        // Their block errors are replaced by the errors of those solves
+        columns = block.needs_fallback();
+        VecX<f64> block_errors = block.errors();
+        for (auto c : columns) {
+            block_errors[c] = 0.0;
+        }
+        error = block_errors.maxCoeff();
+        if (!columns.empty()) {
+            logger->debug("Solving {} of {} columns separately after {} block iterations", columns.size(), B.cols(), iterations);
+        }
+    } else {
+        for (Eigen::Index c = 0; c < B.cols(); ++c) {
+            columns.push_back(c);
+        }
+    }
+
+    Eigen::ComputationInfo info = Eigen::Success;
+    for (auto c : columns) {
+        X.col(c) = solve_column(VecX<f64>(B.col(c)), VecX<f64>(X.col(c)));
+        iterations += m_iterations;
+        solves += 1;
+        error = std::max(error, m_error);
+        if (m_info != Eigen::Success) {
+            info = m_info;
+        }
+    }
+
+    m_info = info;
+    m_iterations = iterations;
+    m_solves = solves;
+    m_error = error;
+    return X;
+}
+}
@@ -0,0 +1,188 @@
+#include "approx/stencil.h"
+
+#include <algorithm>
+
+namespace approx {
+// Regions are usually solved concurrently, so the assembly of small systems is not split any further
+static constexpr Eigen::Index parallel_assembly_size = 50000;
+
+struct BoundingBox {
+    Eigen::Index min_row = 0;
+    Eigen::Index min_col = 0;
+    Eigen::Index rows = 0;
+    Eigen::Index cols = 0;
+};
+
+static BoundingBox bounding_box(std::vector<index_t> const& pixels)
+{
+    if (pixels.empty()) {
+        return {};
+    }
+
+    Eigen::Index min_row = pixels[0].row, max_row = pixels[0].row;
+    Eigen::Index min_col = pixels[0].col, max_col = pixels[0].col;
+    for (auto const& [row, col] : pixels) {
+        min_row = std::min(min_row, row);
+        max_row = std::max(max_row, row);
+        min_col = std::min(min_col, col);
+        max_col = std::max(max_col, col);
+    }
+    return { min_row, min_col, max_row - min_row + 1, max_col - min_col + 1 };
+}
+
+sparse_t StencilSystem::assemble() const
+{
+    // Dense index image over the bounding box of the unknowns (-1 == known)
+    BoundingBox box = bounding_box(unknowns);
+    MatX<int> variable_numbers = MatX<int>::Constant(box.rows, box.cols, -1);
+    auto n = size();
+    bool parallel = n > parallel_assembly_size;
+#pragma omp parallel for if (parallel)
+    for (Eigen::Index i = 0; i < n; ++i) {
+        variable_numbers(unknowns[(size_t)i].row - box.min_row, unknowns[(size_t)i].col - box.min_col) = (int)i;
+    }
+    auto variable_number = [&](Eigen::Index row, Eigen::Index col) {
+        row -= box.min_row;
+        col -= box.min_col;
+        bool in_box = row >= 0 && row < box.rows && col >= 0 && col < box.cols;
+        return in_box ? variable_numbers(row, col) : -1;
+    };
+
+    // The matrix is written directly in compressed form, without sorting triplets. The matrix is symmetric, so the
+    // compressed columns are the same as the compressed rows, and every column can be filled from the stencil of its
+    // own unknown. First count the entries of every column, then fill the columns once their offsets are known
+    sparse_t A(n, n);
+    auto* outer = A.outerIndexPtr();
+    outer[0] = 0;
+#pragma omp parallel for if (parallel)
+    for (Eigen::Index i = 0; i < n; ++i) {
+        auto [row, col] = unknowns[(size_t)i];
+        int count = 1;
+        for (auto [row_offset, col_offset] : stencil_offsets) {
+            count += variable_number(row + row_offset, col + col_offset) >= 0 ? 1 : 0;
+        }
+        outer[i + 1] = count;
+    }
+    for (Eigen::Index i = 0; i < n; ++i) {
+        outer[i + 1] += outer[i];
+    }
+
+    A.resizeNonZeros(outer[n]);
+    auto* inner = A.innerIndexPtr();
+    auto* values = A.valuePtr();
+#pragma omp parallel for if (parallel)
+    for (Eigen::Index i = 0; i < n; ++i) {
+        auto [row, col] = unknowns[(size_t)i];
+        std::array<sparse_t::StorageIndex, 5> indices;
+        size_t count = 0;
+        indices[count++] = (sparse_t::StorageIndex)i;
+        for (auto [row_offset, col_offset] : stencil_offsets) {
+            int j = variable_number(row + row_offset, col + col_offset);
+            if (j >= 0) {
+                indices[count++] = j;
+            }
+        }
+        // The indices inside of a column have to be sorted
+        std::sort(indices.begin(), indices.begin() + count);
+
+        auto offset = outer[i];
+        for (size_t k = 0; k < count; ++k) {
+            inner[offset + k] = indices[k];
+            values[offset + k] = indices[k] == i ? diagonal[i] : -1.0;
+        }
+    }
+    return A;
+}
+
+bool fits_matrix_free(StencilSystem const& system)
+{
+    BoundingBox box = bounding_box(system.unknowns);
+    return (f64)system.size() >= min_matrix_free_fill * (f64)(box.rows * box.cols);
+}
+
+template<typename Scalar>
+BasicStencilConjugateGradient<Scalar>::BasicStencilConjugateGradient(StencilSystem const& system)
+{
+    compute(system);
+}
+
+template<typename Scalar>
+void BasicStencilConjugateGradient<Scalar>::compute(StencilSystem const& system)
+{
+    m_kernels = StencilKernels<Scalar, Boundary::Neumann>(system.unknowns, system.diagonal);
+    grid_t const& diagonal = m_kernels.diagonal_grid();
+    m_inverse_diagonal = (diagonal.array() != Scalar(0)).select(diagonal.cwiseInverse(), Scalar(1));
+    m_info = system.unknowns.empty() ? Eigen::InvalidInput : Eigen::Success;
+}
+
+template<typename Scalar>
+void BasicStencilConjugateGradient<Scalar>::apply(grid_t const& x, grid_t& y) const
+{
+    m_kernels.apply(x, y);
+}
+
+template<typename Scalar>
+VecX<f64> BasicStencilConjugateGradient<Scalar>::residual(VecX<f64> const& b, VecX<f64> const& x) const
+{
+    grid_t r;
+    m_kernels.residual(m_kernels.scatter(b.cast<Scalar>()), m_kernels.scatter(x.cast<Scalar>()), r);
+    return m_kernels.gather(r).template cast<f64>();
+}
+
+template<typename Scalar>
+VecX<f64> BasicStencilConjugateGradient<Scalar>::solveWithGuess(VecX<f64> const& b, VecX<f64> const& guess)
+{
+    m_iterations = 0;
+    m_error = 0.0;
+    m_deadline_reached = false;
+
+    f64 b_norm = b.norm();
+    if (b_norm == 0.0) {
+        m_info = Eigen::Success;
+        return VecX<f64>::Zero(b.size());
+    }
+
+    grid_t x = m_kernels.scatter(guess.cast<Scalar>());
+    grid_t q = grid_t::Zero(x.rows(), x.cols());
+    grid_t residual(x.rows(), x.cols());
+    m_kernels.residual(m_kernels.scatter(b.cast<Scalar>()), x, residual);
+
+    m_error = (f64)residual.norm() / b_norm;
+    if (m_error <= m_tolerance) {
+        m_info = Eigen::Success;
+        return guess;
+    }
+
+    grid_t z = m_inverse_diagonal.cwiseProduct(residual);
+    grid_t p = z;
+    Scalar rz = residual.cwiseProduct(z).sum();
+
+    while (m_iterations < m_max_iterations) {
+        if (m_deadline.has_value() && std::chrono::steady_clock::now() >= *m_deadline) {
+            m_deadline_reached = true;
+            break;
+        }
+        apply(p, q);
+        Scalar alpha = rz / p.cwiseProduct(q).sum();
+        x += alpha * p;
+        residual -= alpha * q;
+        m_iterations += 1;
+
+        m_error = (f64)residual.norm() / b_norm;
+        if (m_error <= m_tolerance) {
+            break;
+        }
+
+        z = m_inverse_diagonal.cwiseProduct(residual);
+        Scalar rz_new = residual.cwiseProduct(z).sum();
+        p = z + (rz_new / rz) * p;
+        rz = rz_new;
+    }
+
+    m_info = m_error <= m_tolerance ? Eigen::Success : Eigen::NoConvergence;
+    return m_kernels.gather(x).template cast<f64>();
+}
+
+template class BasicStencilConjugateGradient<f32>;
+template class BasicStencilConjugateGradient<f64>;
+}
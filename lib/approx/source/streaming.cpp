@@ -0,0 +1,231 @@
+#include "approx/streaming.h"
+#include "approx/poisson.h"
+
+#include <algorithm>
+#include <spdlog/stopwatch.h>
+#include <utils/eigen.h>
+#include <utils/geotiff.h>
+#include <utils/log.h>
+
+namespace approx {
+static auto logger = utils::create_logger("approx::streaming");
+
+// The coarse correction, interpolated (bilinearly, between the centers of the coarse cells) at a full resolution pixel
+static f64 interpolate_coarse(MatX<f64> const& coarse, Eigen::Index factor, Eigen::Index row, Eigen::Index col)
+{
+    auto coordinate = [&](Eigen::Index i, Eigen::Index size, Eigen::Index& low, Eigen::Index& high) {
+        f64 x = std::clamp(((f64)i + 0.5) / (f64)factor - 0.5, 0.0, (f64)(size - 1));
+        low = (Eigen::Index)x;
+        high = std::min(low + 1, size - 1);
+        return x - (f64)low;
+    };
+
+    Eigen::Index r0, r1, c0, c1;
+    f64 tr = coordinate(row, coarse.rows(), r0, r1);
+    f64 tc = coordinate(col, coarse.cols(), c0, c1);
+    return (1.0 - tr) * ((1.0 - tc) * coarse(r0, c0) + tc * coarse(r0, c1))
+        + tr * ((1.0 - tc) * coarse(r1, c0) + tc * coarse(r1, c1));
+}
+
+StreamingResult blend_images_poisson_streaming(RowStreams const& streams, StreamingOptions const& options)
+{
+    StreamingResult result;
+    Eigen::Index rows = streams.rows;
+    Eigen::Index cols = streams.cols;
+    if (rows == 0 || cols == 0) {
+        return result;
+    }
+    Eigen::Index factor = std::max(options.coarse_factor, 1);
+    // The coarse grid is kept in memory, so the blocks are made larger for very large scenes
+    auto coarse_size = [&](Eigen::Index f) { return ((rows + f - 1) / f) * ((cols + f - 1) / f); };
+    while (coarse_size(factor) > std::max<Eigen::Index>(options.max_coarse_pixels, 1)) {
+        factor *= 2;
+    }
+    if (factor != options.coarse_factor) {
+        logger->debug("Using a coarse factor of {} so the coarse grid fits in {} pixels", factor, options.max_coarse_pixels);
+    }
+    Eigen::Index band_rows = std::max<Eigen::Index>(options.band_rows, 1);
+    // The rows where the window ends are kept as the boundary of the solve, so without a halo they would be rows of the
+    // band itself, and would never be solved
+    Eigen::Index halo_rows = std::max<Eigen::Index>(options.halo_rows, 1);
+    spdlog::stopwatch sw;
+
+    // The coarse pass reads whole blocks of rows, so every chunk is a multiple of the coarse factor
+    Eigen::Index chunk_rows = factor * std::max<Eigen::Index>(band_rows / factor, 1);
+    Eigen::Index coarse_rows = (rows + factor - 1) / factor;
+    Eigen::Index coarse_cols = (cols + factor - 1) / factor;
+
+    // The blend is x = replacement + h, with h harmonic inside the holes and h = input - replacement on their boundary.
+    // The coarse grid averages h over the valid pixels of every block. Blocks without any valid pixels are unknowns
+    MultiChannelImage coarse;
+    MatX<f64> valid_pixels = MatX<f64>::Zero(coarse_rows, coarse_cols);
+    bool has_holes = false;
+    for (Eigen::Index first = 0; first < rows; first += chunk_rows) {
+        Eigen::Index n = std::min(chunk_rows, rows - first);
+        MultiChannelImage input = streams.read_input(first, n);
+        MultiChannelImage replacement = streams.read_replacement(first, n);
+        MatX<bool> mask = streams.read_mask(first, n);
+        if (coarse.images.empty()) {
+            coarse = MultiChannelImage(input.images.size(), coarse_rows, coarse_cols);
+        }
+        has_holes = has_holes || mask.any();
+
+        for (Eigen::Index col = 0; col < cols; ++col) {
+            for (Eigen::Index row = 0; row < n; ++row) {
+                if (mask(row, col)) {
+                    continue;
+                }
+                Eigen::Index coarse_row = (first + row) / factor;
+                Eigen::Index coarse_col = col / factor;
+                valid_pixels(coarse_row, coarse_col) += 1.0;
+                for (size_t c = 0; c < coarse.images.size(); ++c) {
+                    coarse(c, coarse_row, coarse_col) += input(c, row, col) - replacement(c, row, col);
+                }
+            }
+        }
+    }
+    result.peak_rows = chunk_rows;
+
+    MatX<bool> coarse_mask = valid_pixels.array() == 0.0;
+    result.coarse_unknowns = utils::count_non_zero(coarse_mask);
+    if (has_holes) {
+        for (auto& image : coarse.images) {
+            image = (valid_pixels.array() > 0.0).select(image.array() / valid_pixels.array(), 0.0);
+        }
+        if (result.coarse_unknowns > 0) {
+            MultiChannelImage zeros(coarse.images.size(), coarse_rows, coarse_cols);
+            blend_images_poisson(coarse, zeros, coarse_mask, options.solver);
+        }
+    }
+    logger->debug("Solved the {}x{} coarse grid ({} unknowns) in {} seconds", coarse_rows, coarse_cols, result.coarse_unknowns, sw);
+
+    // Initial output: the input, and the replacement plus the interpolated coarse correction in the holes
+    for (Eigen::Index first = 0; first < rows; first += band_rows) {
+        Eigen::Index n = std::min(band_rows, rows - first);
+        MultiChannelImage output = streams.read_input(first, n);
+        if (has_holes) {
+            MultiChannelImage replacement = streams.read_replacement(first, n);
+            MatX<bool> mask = streams.read_mask(first, n);
+            for (size_t c = 0; c < output.images.size(); ++c) {
+                for (Eigen::Index col = 0; col < cols; ++col) {
+                    for (Eigen::Index row = 0; row < n; ++row) {
+                        if (mask(row, col)) {
+                            output(c, row, col) = replacement(c, row, col) + interpolate_coarse(coarse[c], factor, first + row, col);
+                        }
+                    }
+                }
+            }
+        }
+        streams.write_output(first, output);
+    }
+    if (!has_holes) {
+        logger->info("Nothing to blend: no invalid pixels");
+        return result;
+    }
+
+    std::vector<Eigen::Index> band_starts;
+    for (Eigen::Index first = 0; first < rows; first += band_rows) {
+        band_starts.push_back(first);
+    }
+
+    for (int pass = 0; pass < options.passes; ++pass) {
+        result.last_change = 0.0;
+        for (size_t i = 0; i < band_starts.size(); ++i) {
+            // Going down the image on even passes and up on odd passes, so each side of a band has the latest values in turn
+            Eigen::Index first = band_starts[pass % 2 == 0 ? i : band_starts.size() - 1 - i];
+            Eigen::Index n = std::min(band_rows, rows - first);
+            Eigen::Index window_first = std::max<Eigen::Index>(first - halo_rows, 0);
+            Eigen::Index window_rows = std::min(first + n + halo_rows, rows) - window_first;
+
+            MatX<bool> mask = streams.read_mask(window_first, window_rows);
+            // Rows where the window cuts through a hole keep their current values, and act as the boundary of the band
+            if (window_first > 0) {
+                mask.row(0).setConstant(false);
+            }
+            if (window_first + window_rows < rows) {
+                mask.row(window_rows - 1).setConstant(false);
+            }
+            if (!mask.middleRows(first - window_first, n).any()) {
+                continue;
+            }
+
+            MultiChannelImage output = streams.read_output(window_first, window_rows);
+            MultiChannelImage replacement = streams.read_replacement(window_first, window_rows);
+            MultiChannelImage previous = output;
+            blend_images_poisson(output, replacement, mask, options.solver);
+            result.peak_rows = std::max(result.peak_rows, window_rows);
+
+            MultiChannelImage band;
+            for (size_t c = 0; c < output.images.size(); ++c) {
+                band.images.emplace_back(output[c].middleRows(first - window_first, n));
+                f64 change = (output[c] - previous[c]).middleRows(first - window_first, n).cwiseAbs().maxCoeff();
+                result.last_change = std::max(result.last_change, change);
+            }
+            streams.write_output(first, band);
+        }
+        logger->debug("Streaming pass {}: largest change {:.4e}", pass + 1, result.last_change);
+    }
+
+    logger->debug("It took {} seconds to blend {}x{} pixels in bands of {} rows", sw, rows, cols, band_rows);
+    return result;
+}
+
+StreamingResult blend_images_poisson_streaming(
+    fs::path const& input_path,
+    fs::path const& replacement_path,
+    fs::path const& mask_path,
+    int mask_band,
+    std::vector<int> const& bands,
+    fs::path const& output_path,
+    StreamingOptions const& options)
+{
+    utils::GeoTIFF<f64> input(input_path);
+    utils::GeoTIFF<f64> replacement(replacement_path);
+    utils::GeoTIFF<f64> mask(mask_path);
+    for (auto const* tiff : { &replacement, &mask }) {
+        if (tiff->width != input.width || tiff->height != input.height) {
+            throw std::runtime_error(fmt::format("Cannot blend images: rasters are different sizes ({}x{} vs {}x{})",
+                tiff->height, tiff->width, input.height, input.width));
+        }
+    }
+    int band_count = std::min(input.band_count(), replacement.band_count());
+    for (auto band : bands) {
+        if (band < 1 || band > band_count) {
+            throw std::runtime_error(fmt::format("Cannot blend images: band {} does not exist (the rasters have {} bands)", band, band_count));
+        }
+    }
+    if (mask_band < 1 || mask_band > mask.band_count()) {
+        throw std::runtime_error(fmt::format("Cannot blend images: mask band {} does not exist (the mask has {} bands)", mask_band, mask.band_count()));
+    }
+
+    // The output starts as a copy of the input, so the bands that are not blended are kept as they are
+    utils::GeoTiffRowWriter<f64> output(input_path, output_path);
+
+    RowStreams streams {
+        .rows = input.height,
+        .cols = input.width,
+        .read_input = [&](Eigen::Index first, Eigen::Index rows) {
+            return MultiChannelImage(input.read_rows(bands, (int)first, (int)rows));
+        },
+        .read_replacement = [&](Eigen::Index first, Eigen::Index rows) {
+            return MultiChannelImage(replacement.read_rows(bands, (int)first, (int)rows));
+        },
+        .read_mask = [&](Eigen::Index first, Eigen::Index rows) -> MatX<bool> {
+            return mask.read_rows(mask_band, (int)first, (int)rows).array() != 0.0;
+        },
+        .read_output = [&](Eigen::Index first, Eigen::Index rows) {
+            MultiChannelImage values;
+            for (auto band : bands) {
+                values.images.push_back(output.read_rows(band, (int)first, (int)rows));
+            }
+            return values;
+        },
+        .write_output = [&](Eigen::Index first, MultiChannelImage const& values) {
+            for (size_t c = 0; c < bands.size(); ++c) {
+                output.write_rows(bands[c], (int)first, values[c]);
+            }
+        }
+    };
+    return blend_images_poisson_streaming(streams, options);
+}
+}
@@ -0,0 +1,250 @@
+#include "approx/tuning.h"
+
+#include <algorithm>
+#include <cmath>
+#include <magic_enum.hpp>
+#include <utils/log.h>
+
+namespace approx {
+static auto logger = utils::create_logger("approx::tuning");
+
+// The percentile of the visual error per residual used for a bucket
+static constexpr f64 error_percentile = 0.9;
+
+f64 measure_visual_error(LinearSolver& solver, MatX<f64> const& B, MatX<f64> const& X)
+{
+    f64 tolerance = solver.tolerance();
+    solver.set_tolerance(tolerance * reference_tolerance_factor);
+    MatX<f64> reference = solver.solveWithGuess(B, X);
+    solver.set_tolerance(tolerance);
+    if (solver.info() != Eigen::Success || X.rows() == 0) {
+        return 0.0;
+    }
+    return (X - reference).colwise().norm().maxCoeff() / std::sqrt((f64)X.rows());
+}
+
+long BucketFit::predicted_iterations(f64 tolerance) const
+{
+    return std::max(0L, std::lround(intercept - slope * std::log10(tolerance)));
+}
+
+ToleranceTuner::ToleranceTuner(std::vector<PerfInfo> const& history, TuningOptions const& options, ApproxMethod method)
+    : m_options(options)
+{
+    // The direct solver does not have a residual, so it does not tell anything about the tolerance. The Laplace fill
+    // and the Poisson blend have different systems, so they are tuned separately. A warm start takes fewer iterations
+    // for the same residual, and the quadtree solves a smaller system than the region, so neither fits the other solves
+    std::map<key_t, std::vector<PerfInfo const*>> records;
+    for (auto const& info : history) {
+        if (info.method == method && info.region_size > 0 && info.error > 0.0 && info.iterations > 0 && info.solves > 0
+            && !info.warm_start && !info.quadtree) {
+            records[bucket(info.region_size, info.backend, info.preconditioner)].push_back(&info);
+        }
+    }
+
+    for (auto const& [key, infos] : records) {
+        auto const& [backend, preconditioner, index] = key;
+        BucketFit fit;
+        fit.backend = backend;
+        fit.preconditioner = preconditioner;
+        fit.min_size = std::lround(std::pow(options.bucket_factor, (f64)index));
+        fit.max_size = std::lround(std::pow(options.bucket_factor, (f64)(index + 1)));
+        fit.records = (long)infos.size();
+
+        // Only the records with a measured visual error tell how the error depends on the residual
+        std::vector<f64> ratios;
+        f64 loosest_measured = 0.0;
+        for (auto const* info : infos) {
+            if (info->visual_error > 0.0) {
+                ratios.push_back(info->visual_error / info->error);
+                loosest_measured = std::max(loosest_measured, info->tolerance);
+            }
+        }
+        fit.measured_records = (long)ratios.size();
+        if (!ratios.empty()) {
+            std::sort(ratios.begin(), ratios.end());
+            auto percentile = (size_t)std::ceil(error_percentile * (f64)ratios.size()) - 1;
+            fit.error_per_residual = ratios[std::min(percentile, ratios.size() - 1)];
+            // The smooth part of the error converges last, so the error per residual grows as the tolerance is loosened,
+            // and the ratio is not extrapolated past the loosest measured solve
+            fit.tolerance = std::min({ options.visual_error / fit.error_per_residual, loosest_measured, options.loosest_tolerance });
+        }
+
+        // The solves of a bucket use the same solver, which reduces the residual by about the same factor every
+        // iteration, so the iterations of a single solve are a linear function of the digits of the residual
+        auto iterations_per_solve = [](PerfInfo const* info) { return (f64)info->iterations / (f64)info->solves; };
+        f64 mean_digits = 0.0, mean_iterations = 0.0;
+        for (auto const* info : infos) {
+            mean_digits += -std::log10(info->error);
+            mean_iterations += iterations_per_solve(info);
+        }
+        mean_digits /= (f64)infos.size();
+        mean_iterations /= (f64)infos.size();
+        f64 covariance = 0.0, variance = 0.0;
+        for (auto const* info : infos) {
+            f64 digits = -std::log10(info->error) - mean_digits;
+            covariance += digits * (iterations_per_solve(info) - mean_iterations);
+            variance += digits * digits;
+        }
+        if (variance > 1e-3 * (f64)infos.size()) {
+            fit.slope = covariance / variance;
+            fit.intercept = mean_iterations - fit.slope * mean_digits;
+        } else {
+            // All the records were solved to about the same tolerance, so the curve is assumed to go through the origin
+            fit.slope = mean_digits > 0.0 ? mean_iterations / mean_digits : 0.0;
+        }
+
+        if (fit.measured_records >= options.min_records) {
+            logger->debug("Regions of {} to {} unknowns ({}, {}): {} records ({} measured), tolerance {:.1e} (about {} iterations)",
+                fit.min_size, fit.max_size, magic_enum::enum_name(backend), magic_enum::enum_name(preconditioner), fit.records,
+                fit.measured_records, fit.tolerance, fit.predicted_iterations(fit.tolerance));
+        }
+        m_buckets.emplace(key, fit);
+    }
+}
+
+ToleranceTuner::key_t ToleranceTuner::bucket(long region_size, SolverBackend backend, Preconditioner preconditioner) const
+{
+    // The other backends do not use the preconditioner of the options
+    if (backend != SolverBackend::ConjugateGradient) {
+        preconditioner = Preconditioner::Jacobi;
+    }
+    auto index = (long)std::floor(std::log((f64)std::max(region_size, 1L)) / std::log(m_options.bucket_factor));
+    return { backend, preconditioner, index };
+}
+
+f64 ToleranceTuner::tolerance(long region_size, SolverBackend backend, Preconditioner preconditioner, f64 fallback) const
+{
+    auto it = m_buckets.find(bucket(region_size, backend, preconditioner));
+    if (it == m_buckets.end() || it->second.measured_records < m_options.min_records) {
+        return fallback;
+    }
+    BucketFit const& fit = it->second;
+    f64 tuned = std::max(fit.tolerance, fallback);
+    // A looser tolerance is only worth its error if it saves iterations
+    auto iterations = (f64)fit.predicted_iterations(fallback);
+    if ((f64)fit.predicted_iterations(tuned) > (1.0 - m_options.min_savings) * iterations) {
+        return fallback;
+    }
+    return tuned;
+}
+
+std::vector<BucketFit> ToleranceTuner::buckets() const
+{
+    std::vector<BucketFit> buckets;
+    for (auto const& [index, fit] : m_buckets) {
+        buckets.push_back(fit);
+    }
+    return buckets;
+}
+
+PerfDataBase::PerfDataBase(fs::path base_path)
+    : utils::DataBase(std::move(base_path))
+{
+}
+
+void PerfDataBase::create_perf_table()
+{
+    std::string sql = R"sql(
+CREATE TABLE IF NOT EXISTS perf_info(
+    id INTEGER PRIMARY KEY AUTOINCREMENT,
+    method TEXT,
+    region_size INTEGER NOT NULL,
+    tolerance REAL,
+    max_iterations INTEGER,
+    iterations INTEGER,
+    error REAL,
+    visual_error REAL,
+    solve_time REAL,
+    backend TEXT,
+    automatic INTEGER,
+    preconditioner TEXT,
+    setup_time REAL,
+    warm_start INTEGER,
+    guess_error REAL,
+    replacement_error REAL,
+    iterations_saved INTEGER,
+    deadline_reached INTEGER,
+    solves INTEGER,
+    quadtree INTEGER);
+)sql";
+    db.exec(sql);
+}
+
+void PerfDataBase::write_perf_info(std::vector<PerfInfo> const& records)
+{
+    create_perf_table();
+
+    std::string sql_string = R"sql(
+INSERT INTO perf_info (method, region_size, tolerance, max_iterations, iterations, error, visual_error, solve_time, backend,
+    automatic, preconditioner, setup_time, warm_start, guess_error, replacement_error, iterations_saved, deadline_reached, solves,
+    quadtree)
+VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);
+)sql";
+    // A single transaction, so the records of all the regions are written at once
+    SQLite::Transaction transaction(db);
+    SQLite::Statement stmt(db, sql_string);
+    for (auto const& info : records) {
+        stmt.reset();
+        stmt.bind(1, std::string(magic_enum::enum_name(info.method)));
+        stmt.bind(2, (i64)info.region_size);
+        stmt.bind(3, info.tolerance);
+        stmt.bind(4, (i64)info.max_iterations);
+        stmt.bind(5, (i64)info.iterations);
+        stmt.bind(6, info.error);
+        stmt.bind(7, info.visual_error);
+        stmt.bind(8, info.solve_time);
+        stmt.bind(9, std::string(magic_enum::enum_name(info.backend)));
+        stmt.bind(10, (int)info.automatic);
+        stmt.bind(11, std::string(magic_enum::enum_name(info.preconditioner)));
+        stmt.bind(12, info.setup_time);
+        stmt.bind(13, (int)info.warm_start);
+        stmt.bind(14, info.guess_error);
+        stmt.bind(15, info.replacement_error);
+        stmt.bind(16, (i64)info.iterations_saved);
+        stmt.bind(17, (int)info.deadline_reached);
+        stmt.bind(18, (i64)info.solves);
+        stmt.bind(19, (int)info.quadtree);
+        stmt.exec();
+    }
+    transaction.commit();
+}
+
+std::vector<PerfInfo> PerfDataBase::select_perf_info()
+{
+    create_perf_table();
+
+    std::string sql_string = R"sql(
+SELECT method, region_size, tolerance, max_iterations, iterations, error, visual_error, solve_time, backend, automatic,
+    preconditioner, setup_time, warm_start, guess_error, replacement_error, iterations_saved, deadline_reached, solves, quadtree
+FROM perf_info;
+)sql";
+    SQLite::Statement stmt(db, sql_string);
+
+    std::vector<PerfInfo> records;
+    while (stmt.executeStep()) {
+        PerfInfo info;
+        info.method = magic_enum::enum_cast<ApproxMethod>(stmt.getColumn(0).getString()).value_or(ApproxMethod::Poisson);
+        info.region_size = (long)stmt.getColumn(1).getInt64();
+        info.tolerance = stmt.getColumn(2);
+        info.max_iterations = (long)stmt.getColumn(3).getInt64();
+        info.iterations = (long)stmt.getColumn(4).getInt64();
+        info.error = stmt.getColumn(5);
+        info.visual_error = stmt.getColumn(6);
+        info.solve_time = stmt.getColumn(7);
+        info.backend = magic_enum::enum_cast<SolverBackend>(stmt.getColumn(8).getString()).value_or(SolverBackend::ConjugateGradient);
+        info.automatic = static_cast<bool>(stmt.getColumn(9).getInt());
+        info.preconditioner = magic_enum::enum_cast<Preconditioner>(stmt.getColumn(10).getString()).value_or(Preconditioner::Jacobi);
+        info.setup_time = stmt.getColumn(11);
+        info.warm_start = static_cast<bool>(stmt.getColumn(12).getInt());
+        info.guess_error = stmt.getColumn(13);
+        info.replacement_error = stmt.getColumn(14);
+        info.iterations_saved = (long)stmt.getColumn(15).getInt64();
+        info.deadline_reached = static_cast<bool>(stmt.getColumn(16).getInt());
+        info.solves = (long)stmt.getColumn(17).getInt64();
+        info.quadtree = static_cast<bool>(stmt.getColumn(18).getInt());
+        records.push_back(info);
+    }
+    return records;
+}
+}
@@ -8,11 +8,6 @@ namespace approx {
 static auto logger = utils::create_logger("approx::utils");
 static f64 gamma = 2.2;
 
-MultiChannelImage::MultiChannelImage(size_t channels, Eigen::Index rows, Eigen::Index cols)
-{
-    images.insert(images.end(), channels, MatX<f64>::Zero(rows, cols));
-}
-
 MultiChannelImage read_image(fs::path path)
 {
     cv::Mat image = cv::imread(path.c_str(), cv::IMREAD_COLOR);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <filesystem>
+#include <utils/types.h>
+
+namespace fs = std::filesystem;
+
+namespace utils {
+// Sentinel-2 scene classification values that represent cloud shadows, clouds and cirrus
+bool invalid_scene_class(f64 value);
+
+// The pixels of a folder of Sentinel-2 bands that are covered by clouds: a cloud probability (CLD.tif) of at least
+// threshold, or an invalid scene classification (SCL.tif). GDAL has to be registered before calling this
+MatX<bool> read_cloud_mask(fs::path const& folder, f64 threshold = 30.0);
+}
@@ -3,6 +3,7 @@
 #include "noCopying.h"
 #include <SQLiteCpp/SQLiteCpp.h>
 #include <filesystem>
+#include <memory>
 #include <string>
 
 #include "types.h"
@@ -26,6 +27,6 @@ protected:
     void create_table();
 
 private:
-    SQLite::Statement stmt;
+    std::unique_ptr<SQLite::Statement> stmt_status = nullptr;
 };
 }
\ No newline at end of file
@@ -25,6 +25,7 @@ public:
     virtual ~GDALDatasetWrapper();
 
     GDALDataset* operator->() const { return dataset; }
+    GDALDataset* get() const { return dataset; }
 
 private:
     GDALDataset* dataset;
@@ -94,6 +95,40 @@ struct overload : Ts... {
 template<class... Ts>
 overload(Ts...) -> overload<Ts...>;
 
+// Transfer full-width rows between a band and a (column-major) matrix. The spacing is set so that pixel (row, col) of
+// the raster is element (row, col) of the matrix
+template<typename ScalarT>
+CPLErr raster_rows_io(GDALRWFlag flag, GDALDataset* dataset, int band_num, int first_row, MatX<ScalarT> const& values)
+{
+    GDALTypeForOurType<ScalarT> type;
+    auto rows = static_cast<int>(values.rows());
+    auto cols = static_cast<int>(values.cols());
+    GDALRasterBand* band = dataset->GetRasterBand(band_num);
+    if (band == nullptr) {
+        return CE_Failure;
+    }
+    return band->RasterIO(
+        flag,
+        0, first_row,
+        cols, rows,
+        (void*)values.data(),
+        cols, rows,
+        type.type,
+        static_cast<GSpacing>(sizeof(ScalarT)) * rows,
+        static_cast<GSpacing>(sizeof(ScalarT)),
+        nullptr);
+}
+
+template<typename ScalarT>
+MatX<ScalarT> read_raster_rows(GDALDataset* dataset, int band_num, int first_row, int rows, int width)
+{
+    MatX<ScalarT> values(rows, width);
+    if (raster_rows_io(GF_Read, dataset, band_num, first_row, values) != CE_None) {
+        throw std::runtime_error(fmt::format("Unable to read rows {}-{} of band {}", first_row, first_row + rows, band_num));
+    }
+    return values;
+}
+
 template<typename ScalarT>
 class GeoTiffWriter {
 public:
@@ -194,6 +229,65 @@ private:
     GDALDataset* poDstDS = nullptr;
 };
 
+/**
+ * Writes blocks of rows into a copy of a template raster, so that results can be written back while they are computed
+ * and the full raster never has to be in memory. The copy starts with the values of the template, and rows that were
+ * already written can be read back.
+ */
+template<typename ScalarT>
+class GeoTiffRowWriter {
+    MAKE_NONCOPYABLE(GeoTiffRowWriter);
+
+public:
+    GeoTiffRowWriter(fs::path const& template_path, fs::path const& destination)
+    {
+        GDALDriver* driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+        if (driver == nullptr) {
+            throw std::runtime_error("Unable to find driver for GTiff");
+        }
+
+        std::unique_ptr<GDALDataset, decltype(&GDALClose)> source {
+            static_cast<GDALDataset*>(GDALOpen(template_path.c_str(), GA_ReadOnly)),
+            GDALClose
+        };
+        if (source == nullptr) {
+            throw IOError("Unable to open template raster", template_path);
+        }
+        dataset = driver->CreateCopy(destination.c_str(), source.get(), FALSE, nullptr, nullptr, nullptr);
+        if (dataset == nullptr) {
+            throw IOError(fmt::format("Unable to create raster: {}", CPLGetLastErrorMsg()), destination);
+        }
+
+        width = dataset->GetRasterXSize();
+        height = dataset->GetRasterYSize();
+    }
+
+    ~GeoTiffRowWriter()
+    {
+        dataset->FlushCache();
+        GDALClose(dataset);
+    }
+
+    void write_rows(int band_num, int first_row, MatX<ScalarT> const& values)
+    {
+        if (raster_rows_io(GF_Write, dataset, band_num, first_row, values) != CE_None) {
+            spdlog::error("Could not write to file. Error code: {}", CPLGetLastErrorMsg());
+            throw std::runtime_error("Unable to write raster image");
+        }
+    }
+
+    MatX<ScalarT> read_rows(int band_num, int first_row, int rows) const
+    {
+        return read_raster_rows<ScalarT>(dataset, band_num, first_row, rows, width);
+    }
+
+    int width = 0;
+    int height = 0;
+
+private:
+    GDALDataset* dataset = nullptr;
+};
+
 //------------------------------------------------------------------------------
 // Useful references:
 // https://gdal.org/tutorials/geotransforms_tut.html#geotransforms-tut
@@ -272,6 +366,24 @@ public:
         return output;
     }
 
+    // Read the full-width rows [first_row, first_row + rows) of a band, without reading the rest of the raster
+    MatX<ScalarT> read_rows(int band_num, int first_row, int rows) const
+    {
+        return read_raster_rows<ScalarT>(m_dataSet.get(), band_num, first_row, rows, width);
+    }
+
+    [[nodiscard]] int band_count() const { return m_dataSet->GetRasterCount(); }
+
+    std::vector<MatX<ScalarT>> read_rows(std::vector<int> const& bands, int first_row, int rows) const
+    {
+        std::vector<MatX<ScalarT>> output;
+        for (auto band_num : bands) {
+            output.push_back(read_rows(band_num, first_row, rows));
+        }
+
+        return output;
+    }
+
     void write(cv::Mat const& matrix, fs::path const& pathOfDestination, int bandIndex = 1) const
     {
         char const* pszFormat = "GTiff";
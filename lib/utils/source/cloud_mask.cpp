@@ -0,0 +1,18 @@
+#include "utils/cloud_mask.h"
+
+#include "utils/geotiff.h"
+
+namespace utils {
+bool invalid_scene_class(f64 value)
+{
+    int scl = static_cast<int>(value);
+    return scl == 3 || scl == 8 || scl == 9 || scl == 10;
+}
+
+MatX<bool> read_cloud_mask(fs::path const& folder, f64 threshold)
+{
+    MatX<f64> cloud_probability = GeoTIFF<f64>(folder / "CLD.tif").read(1);
+    MatX<f64> scene_classification = GeoTIFF<f64>(folder / "SCL.tif").read(1);
+    return (cloud_probability.array() >= threshold) || scene_classification.unaryExpr(&invalid_scene_class).array();
+}
+}
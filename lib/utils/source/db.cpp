@@ -8,22 +8,31 @@ static auto logger = utils::create_logger("utils::db");
 
 DataBase::DataBase(fs::path base_path)
     : db(base_path / "approximation.db", SQLite::OPEN_CREATE | SQLite::OPEN_READWRITE)
-    , stmt(db, "SELECT clouds_computed, shadows_computed, percent_invalid FROM dates WHERE year=? AND month=? AND day=?;")
 {
     create_table();
 }
 
 CloudShadowStatus DataBase::get_status(std::string const& date_string)
 {
+    std::string sql_string = R"sql(
+SELECT clouds_computed, shadows_computed, percent_invalid
+FROM dates WHERE year = ? AND month = ? AND day = ?;
+)sql";
+    // Prepared once the table exists, so a new database can be opened
+    if (stmt_status == nullptr) {
+        stmt_status = std::make_unique<SQLite::Statement>(db, sql_string);
+    }
+    stmt_status->reset();
+
     utils::Date date(date_string);
-    date.bind_sql(stmt, 1);
-    while (stmt.executeStep()) {
-        CloudShadowStatus status;
-        status.clouds_exist = static_cast<bool>(stmt.getColumn(0).getInt());
-        status.shadows_exist = static_cast<bool>(stmt.getColumn(1).getInt());
-        status.percent_invalid = stmt.getColumn(2);
-        return status;
+    date.bind_sql(*stmt_status, 1);
+    CloudShadowStatus status;
+    while (stmt_status->executeStep()) {
+        status.clouds_exist = static_cast<bool>(stmt_status->getColumn(0).getInt());
+        status.shadows_exist = static_cast<bool>(stmt_status->getColumn(1).getInt());
+        status.percent_invalid = stmt_status->getColumn(2);
     }
+    return status;
 }
 
 void DataBase::create_table()
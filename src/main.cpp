@@ -6,8 +6,10 @@
 
 #include <cloud_shadow_detection/automatic_detection.h>
 
+#include <approx/dispatch.h>
 #include <approx/laplace.h>
 #include <approx/poisson.h>
+#include <approx/streaming.h>
 #include <utils/log.h>
 
 namespace py = pybind11;
@@ -46,14 +48,232 @@ PYBIND11_MODULE(_core, m)
     m.def("detect", &remote_sensing::detect,
         "params"_a, "diagonal_distance"_a, "skip_shadow_detection"_a, "use_cache"_a);
 
+    py::enum_<approx::SolverBackend>(m, "SolverBackend")
+        .value("ConjugateGradient", approx::SolverBackend::ConjugateGradient)
+        .value("Multigrid", approx::SolverBackend::Multigrid)
+        .value("MultigridConjugateGradient", approx::SolverBackend::MultigridConjugateGradient)
+        .value("MatrixFreeConjugateGradient", approx::SolverBackend::MatrixFreeConjugateGradient)
+        .value("Cholesky", approx::SolverBackend::Cholesky)
+        .value("Automatic", approx::SolverBackend::Automatic);
+
+    py::class_<approx::DispatchThresholds>(m, "DispatchThresholds")
+        .def(py::init<>())
+        .def_readwrite("direct_size", &approx::DispatchThresholds::direct_size)
+        .def_readwrite("thin_width", &approx::DispatchThresholds::thin_width)
+        .def_readwrite("max_thin_fill", &approx::DispatchThresholds::max_thin_fill);
+    m.def("calibrate_dispatch", &approx::calibrate_dispatch, "tolerance"_a = 1e-6);
+    m.def("dispatch_thresholds", &approx::dispatch_thresholds, "tolerance"_a = 1e-6);
+    m.def("set_dispatch_thresholds", &approx::set_dispatch_thresholds, "thresholds"_a);
+
+    py::enum_<approx::MultigridCycle>(m, "MultigridCycle")
+        .value("V", approx::MultigridCycle::V)
+        .value("W", approx::MultigridCycle::W);
+
+    py::class_<approx::MultigridOptions>(m, "MultigridOptions")
+        .def(py::init<>())
+        .def_readwrite("cycle", &approx::MultigridOptions::cycle)
+        .def_readwrite("pre_smoothing", &approx::MultigridOptions::pre_smoothing)
+        .def_readwrite("post_smoothing", &approx::MultigridOptions::post_smoothing)
+        .def_readwrite("coarsest_size", &approx::MultigridOptions::coarsest_size);
+
+    py::enum_<approx::Preconditioner>(m, "Preconditioner")
+        .value("Jacobi", approx::Preconditioner::Jacobi)
+        .value("IncompleteCholesky", approx::Preconditioner::IncompleteCholesky)
+        .value("SSOR", approx::Preconditioner::SSOR)
+        .value("BlockJacobi", approx::Preconditioner::BlockJacobi)
+        .value("AdditiveSchwarz", approx::Preconditioner::AdditiveSchwarz)
+        .value("SineTransform", approx::Preconditioner::SineTransform);
+
+    py::class_<approx::PreconditionerOptions>(m, "PreconditionerOptions")
+        .def(py::init<>())
+        .def_readwrite("type", &approx::PreconditionerOptions::type)
+        .def_readwrite("omega", &approx::PreconditionerOptions::omega)
+        .def_readwrite("block_size", &approx::PreconditionerOptions::block_size)
+        .def_readwrite("tile_size", &approx::PreconditionerOptions::tile_size)
+        .def_readwrite("overlap", &approx::PreconditionerOptions::overlap);
+
+    py::enum_<approx::Precision>(m, "Precision")
+        .value("Double", approx::Precision::Double)
+        .value("Single", approx::Precision::Single)
+        .value("Mixed", approx::Precision::Mixed);
+
+    py::enum_<approx::UnknownOrdering>(m, "UnknownOrdering")
+        .value("Raster", approx::UnknownOrdering::Raster)
+        .value("Morton", approx::UnknownOrdering::Morton)
+        .value("ReverseCuthillMcKee", approx::UnknownOrdering::ReverseCuthillMcKee);
+
+    py::enum_<approx::ApproxMethod>(m, "ApproxMethod")
+        .value("Laplace", approx::ApproxMethod::Laplace)
+        .value("Poisson", approx::ApproxMethod::Poisson);
+
+    py::class_<approx::TuningOptions>(m, "TuningOptions")
+        .def(py::init<>())
+        .def_readwrite("visual_error", &approx::TuningOptions::visual_error)
+        .def_readwrite("bucket_factor", &approx::TuningOptions::bucket_factor)
+        .def_readwrite("min_records", &approx::TuningOptions::min_records)
+        .def_readwrite("min_savings", &approx::TuningOptions::min_savings)
+        .def_readwrite("loosest_tolerance", &approx::TuningOptions::loosest_tolerance);
+
+    py::class_<approx::BucketFit>(m, "BucketFit")
+        .def_readonly("backend", &approx::BucketFit::backend)
+        .def_readonly("preconditioner", &approx::BucketFit::preconditioner)
+        .def_readonly("min_size", &approx::BucketFit::min_size)
+        .def_readonly("max_size", &approx::BucketFit::max_size)
+        .def_readonly("records", &approx::BucketFit::records)
+        .def_readonly("measured_records", &approx::BucketFit::measured_records)
+        .def_readonly("error_per_residual", &approx::BucketFit::error_per_residual)
+        .def_readonly("tolerance", &approx::BucketFit::tolerance)
+        .def("predicted_iterations", &approx::BucketFit::predicted_iterations, "tolerance"_a);
+    m.def(
+        "tune_tolerances", [](std::filesystem::path const& folder, approx::TuningOptions const& options, approx::ApproxMethod method) {
+            approx::PerfDataBase db(folder);
+            return approx::ToleranceTuner(db.select_perf_info(), options, method).buckets();
+        },
+        "folder"_a, "options"_a = approx::TuningOptions(), "method"_a = approx::ApproxMethod::Poisson);
+
+    py::class_<approx::QuadtreeOptions>(m, "QuadtreeOptions")
+        .def(py::init<>())
+        .def_readwrite("min_region_size", &approx::QuadtreeOptions::min_region_size)
+        .def_readwrite("max_cell_size", &approx::QuadtreeOptions::max_cell_size)
+        .def_readwrite("grading", &approx::QuadtreeOptions::grading);
+
+    py::class_<approx::SolverOptions>(m, "SolverOptions")
+        .def(py::init<>())
+        .def_readwrite("backend", &approx::SolverOptions::backend)
+        .def_readwrite("tolerance", &approx::SolverOptions::tolerance)
+        .def_readwrite("max_iterations", &approx::SolverOptions::max_iterations)
+        .def_readwrite("multigrid", &approx::SolverOptions::multigrid)
+        .def_readwrite("preconditioner", &approx::SolverOptions::preconditioner)
+        .def_readwrite("precision", &approx::SolverOptions::precision)
+        .def_readwrite("block_channels", &approx::SolverOptions::block_channels)
+        .def_readwrite("ordering", &approx::SolverOptions::ordering)
+        .def_readwrite("time_budget", &approx::SolverOptions::time_budget)
+        .def_readwrite("pull_push_guess", &approx::SolverOptions::pull_push_guess)
+        .def_readwrite("perf_database", &approx::SolverOptions::perf_database)
+        .def_readwrite("measure_visual_error", &approx::SolverOptions::measure_visual_error)
+        .def_readwrite("tuning", &approx::SolverOptions::tuning)
+        .def_readwrite("dispatch", &approx::SolverOptions::dispatch)
+        .def_readwrite("quadtree", &approx::SolverOptions::quadtree);
+
+    py::enum_<approx::FillStatus>(m, "FillStatus")
+        .value("Converged", approx::FillStatus::Converged)
+        .value("NotConverged", approx::FillStatus::NotConverged)
+        .value("DeadlineReached", approx::FillStatus::DeadlineReached);
+    py::class_<approx::FillResult>(m, "FillResult")
+        .def_readonly("status", &approx::FillResult::status)
+        .def_readonly("error", &approx::FillResult::error)
+        .def_readonly("iterations", &approx::FillResult::iterations);
+
+    m.def("clear_factorization_cache", &approx::clear_factorization_cache);
+    m.def("set_factorization_cache_capacity", &approx::set_factorization_cache_capacity, "bytes"_a);
+    m.def("factorization_cache_bytes", &approx::factorization_cache_bytes);
+
+    m.def(
+        "filling_missing_portions_smooth_boundaries", [](MatX<f64>& input_image, MatX<bool> const& invalid_pixels, approx::SolverOptions const& options) {
+            approx::fill_missing_portion_smooth_boundary(input_image, invalid_pixels, options);
+            return input_image;
+        },
+        py::arg("input_image").noconvert(), py::arg("invalid_pixels").noconvert(), "options"_a = approx::SolverOptions());
     m.def(
-        "filling_missing_portions_smooth_boundaries", [](MatX<f64>& input_image, MatX<bool> const& invalid_pixels) {
-            approx::fill_missing_portion_smooth_boundary(input_image, invalid_pixels);
+        "filling_missing_portions_smooth_boundaries", [](MatX<f32>& input_image, MatX<bool> const& invalid_pixels, approx::SolverOptions const& options) {
+            approx::fill_missing_portion_smooth_boundary(input_image, invalid_pixels, options);
+            return input_image;
+        },
+        py::arg("input_image").noconvert(), py::arg("invalid_pixels").noconvert(), "options"_a = approx::SolverOptions());
+    m.def(
+        "filling_missing_portions_smooth_boundaries",
+        py::overload_cast<std::vector<MatX<f64>> const&, MatX<bool> const&, approx::SolverOptions const&>(&approx::fill_missing_portion_smooth_boundary),
+        "input_images"_a, "invalid_pixels"_a, "options"_a = approx::SolverOptions());
+    m.def(
+        "filling_missing_portions_smooth_boundaries_with_status", [](std::vector<MatX<f64>> const& input_images, MatX<bool> const& invalid_pixels, approx::SolverOptions const& options) {
+            approx::MultiChannelImage images(input_images);
+            auto result = approx::fill_missing_portion_smooth_boundary(images, invalid_pixels, options);
+            return std::make_pair(images.images, result);
+        },
+        "input_images"_a, "invalid_pixels"_a, "options"_a = approx::SolverOptions());
+    py::class_<approx::SORFillOptions>(m, "SORFillOptions")
+        .def(py::init<>())
+        .def_readwrite("omega", &approx::SORFillOptions::omega)
+        .def_readwrite("tolerance", &approx::SORFillOptions::tolerance)
+        .def_readwrite("max_sweeps", &approx::SORFillOptions::max_sweeps)
+        .def_readwrite("check_every", &approx::SORFillOptions::check_every);
+    py::class_<approx::SORFillResult>(m, "SORFillResult")
+        .def_readonly("sweeps", &approx::SORFillResult::sweeps)
+        .def_readonly("error", &approx::SORFillResult::error)
+        .def_readonly("converged", &approx::SORFillResult::converged);
+    m.def(
+        "fill_missing_portions_sor", [](MatX<f64>& input_image, MatX<bool> const& invalid_pixels, approx::SORFillOptions const& options) {
+            auto result = approx::fill_missing_portion_sor(input_image, invalid_pixels, options);
+            return std::make_pair(input_image, result);
+        },
+        py::arg("input_image").noconvert(), py::arg("invalid_pixels").noconvert(), "options"_a = approx::SORFillOptions());
+    m.def(
+        "fill_missing_portions_pull_push", [](MatX<f64>& input_image, MatX<bool> const& invalid_pixels) {
+            approx::fill_missing_portion_pull_push(input_image, invalid_pixels);
             return input_image;
         },
         py::arg("input_image").noconvert(), py::arg("invalid_pixels").noconvert());
+    m.def(
+        "fill_missing_portions_pull_push",
+        py::overload_cast<std::vector<MatX<f64>> const&, MatX<bool> const&>(&approx::fill_missing_portion_pull_push),
+        "input_images"_a, "invalid_pixels"_a);
     m.def(
         "blend_images_poisson",
         py::overload_cast<std::vector<MatX<f64>> const&, std::vector<MatX<f64>> const&, MatX<bool> const&, f64, std::optional<int>>(&approx::blend_images_poisson),
         "input_image"_a, "replacement_image"_a, "invalid_mask"_a, "tolerance"_a = 1e-6, "max_iterations"_a = std::nullopt);
+    m.def(
+        "blend_images_poisson",
+        py::overload_cast<std::vector<MatX<f64>> const&, std::vector<MatX<f64>> const&, MatX<bool> const&, approx::SolverOptions const&>(&approx::blend_images_poisson),
+        "input_image"_a, "replacement_image"_a, "invalid_mask"_a, "options"_a);
+    m.def(
+        "blend_images_poisson", [](std::vector<MatX<f64>> const& input_images, std::vector<MatX<f64>> const& replacement_images, MatX<bool> const& invalid_mask, std::vector<MatX<f64>> const& warm_start, approx::SolverOptions const& options) {
+            approx::MultiChannelImage input(input_images);
+            approx::blend_images_poisson(input, approx::MultiChannelImage(replacement_images), invalid_mask, approx::MultiChannelImage(warm_start), options);
+            return input.images;
+        },
+        "input_image"_a, "replacement_image"_a, "invalid_mask"_a, "warm_start"_a, "options"_a);
+    m.def(
+        "write_approximated_band", [](std::filesystem::path const& folder, std::string const& date_string, std::string const& band_name, MatX<f64> const& values, std::filesystem::path const& template_path, approx::ApproxMethod method) {
+            approx::DataBase db(folder);
+            return approx::write_approximated_band(db, folder, date_string, band_name, values, template_path, method);
+        },
+        "folder"_a, "date_string"_a, "band_name"_a, "values"_a, "template_path"_a, "method"_a = approx::ApproxMethod::Poisson);
+    m.def(
+        "find_warm_start", [](std::filesystem::path const& folder, std::string const& date_string, std::vector<std::string> const& band_names, approx::ApproxMethod method) -> std::optional<std::vector<MatX<f64>>> {
+            approx::DataBase db(folder);
+            auto warm_start = approx::find_warm_start(db, folder, date_string, band_names, method);
+            if (!warm_start.has_value()) {
+                return {};
+            }
+            return warm_start->images;
+        },
+        "folder"_a, "date_string"_a, "band_names"_a, "method"_a = approx::ApproxMethod::Poisson);
+    m.def(
+        "blend_images_poisson_pyramid",
+        py::overload_cast<std::vector<MatX<f64>> const&, std::vector<MatX<f64>> const&, MatX<bool> const&>(&approx::blend_images_poisson_pyramid),
+        "input_image"_a, "replacement_image"_a, "invalid_mask"_a);
+    m.def(
+        "blend_images_poisson_with_status", [](std::vector<MatX<f64>> const& input_images, std::vector<MatX<f64>> const& replacement_images, MatX<bool> const& invalid_mask, approx::SolverOptions const& options) {
+            approx::MultiChannelImage input(input_images);
+            auto result = approx::blend_images_poisson(input, approx::MultiChannelImage(replacement_images), invalid_mask, options);
+            return std::make_pair(input.images, result);
+        },
+        "input_image"_a, "replacement_image"_a, "invalid_mask"_a, "options"_a = approx::SolverOptions());
+
+    py::class_<approx::StreamingOptions>(m, "StreamingOptions")
+        .def(py::init<>())
+        .def_readwrite("band_rows", &approx::StreamingOptions::band_rows)
+        .def_readwrite("halo_rows", &approx::StreamingOptions::halo_rows)
+        .def_readwrite("coarse_factor", &approx::StreamingOptions::coarse_factor)
+        .def_readwrite("max_coarse_pixels", &approx::StreamingOptions::max_coarse_pixels)
+        .def_readwrite("passes", &approx::StreamingOptions::passes)
+        .def_readwrite("solver", &approx::StreamingOptions::solver);
+    py::class_<approx::StreamingResult>(m, "StreamingResult")
+        .def_readonly("coarse_unknowns", &approx::StreamingResult::coarse_unknowns)
+        .def_readonly("last_change", &approx::StreamingResult::last_change)
+        .def_readonly("peak_rows", &approx::StreamingResult::peak_rows);
+    m.def(
+        "blend_images_poisson_streaming",
+        py::overload_cast<fs::path const&, fs::path const&, fs::path const&, int, std::vector<int> const&, fs::path const&, approx::StreamingOptions const&>(&approx::blend_images_poisson_streaming),
+        "input_path"_a, "replacement_path"_a, "mask_path"_a, "mask_band"_a, "bands"_a, "output_path"_a, "options"_a = approx::StreamingOptions());
 }
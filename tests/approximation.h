@@ -1,11 +1,70 @@
 #include <doctest/doctest.h>
 #include <givde/types.hpp>
 
+#include "approx/dispatch.h"
+#include "approx/fast_poisson.h"
 #include "approx/laplace.h"
+#include "approx/poisson.h"
+#include "approx/quadtree.h"
+#include "approx/streaming.h"
 
 using namespace givde;
 using namespace approx;
 
+// A smooth image for the fills to reproduce: sin(row_frequency * row) * cos(col_frequency * col)
+static MatX<f64> smooth_test_image(Eigen::Index rows, Eigen::Index cols, f64 row_frequency = 0.1, f64 col_frequency = 0.07)
+{
+    MatX<f64> image(rows, cols);
+    for (Eigen::Index row = 0; row < rows; ++row) {
+        for (Eigen::Index col = 0; col < cols; ++col) {
+            image(row, col) = std::sin(row_frequency * (f64)row) * std::cos(col_frequency * (f64)col);
+        }
+    }
+    return image;
+}
+
+struct Rectangle {
+    Eigen::Index row, col, rows, cols;
+};
+
+// A mask where only the rectangles are invalid
+static MatX<bool> rectangle_mask(Eigen::Index rows, Eigen::Index cols, std::initializer_list<Rectangle> rectangles)
+{
+    MatX<bool> invalid = MatX<bool>::Constant(rows, cols, false);
+    for (auto const& [row, col, height, width] : rectangles) {
+        invalid.block(row, col, height, width).setConstant(true);
+    }
+    return invalid;
+}
+
+// The Laplace fill solved to a tight tolerance, which the other solvers are compared against
+static MatX<f64> reference_fill(MatX<f64> image, MatX<bool> const& invalid)
+{
+    fill_missing_portion_smooth_boundary(image, invalid, { .tolerance = 1e-12 });
+    return image;
+}
+
+// The same for the Poisson blend
+static MultiChannelImage reference_blend(MultiChannelImage input, MultiChannelImage const& replacement, MatX<bool> const& invalid)
+{
+    blend_images_poisson(input, replacement, invalid, SolverOptions { .tolerance = 1e-12 });
+    return input;
+}
+
+// The input of the offset blends: a gradient that differs between the channels, plus a smooth wave
+static MultiChannelImage offset_blend_input()
+{
+    MultiChannelImage input(3, 30, 40);
+    for (size_t c = 0; c < 3; ++c) {
+        for (Eigen::Index row = 0; row < input.rows(); ++row) {
+            for (Eigen::Index col = 0; col < input.cols(); ++col) {
+                input(c, row, col) = 0.01 * (f64)(row * (c + 1)) + 0.3 * std::sin(0.2 * (f64)col);
+            }
+        }
+    }
+    return input;
+}
+
 TEST_CASE("Image Neighbours") {
     MatX<bool> test_image(100, 100);
 
@@ -30,6 +89,11 @@ TEST_CASE("Image Neighbours") {
 
     neighbours = valid_neighbours(test_image, {50, 50});
     CHECK_EQ(neighbours.size(), 4);
+
+    // The neighbours follow the order of the stencil, with the ones outside of the image left out
+    neighbours = valid_neighbours(test_image, {0, 5});
+    std::vector<index_t> pixels(neighbours.begin(), neighbours.end());
+    CHECK(pixels == std::vector<index_t> { { 1, 5 }, { 0, 4 }, { 0, 6 } });
 }
 
 TEST_CASE("Flood") {
@@ -74,3 +138,1070 @@ TEST_CASE("connected components") {
         CHECK_EQ(components.region_map.at(2).size(), 8);
     }
 }
+
+TEST_CASE("connected regions are solved independently") {
+    MatX<f64> image(20, 20);
+    for (Eigen::Index row = 0; row < image.rows(); ++row) {
+        for (Eigen::Index col = 0; col < image.cols(); ++col) {
+            image(row, col) = (f64)(row + 2 * col);
+        }
+    }
+    MatX<f64> expected = image;
+
+    MatX<bool> invalid = rectangle_mask(20, 20, { { 2, 2, 3, 3 }, { 12, 10, 4, 5 } });
+    image = (invalid.array()).select(MatX<f64>::Zero(20, 20), image);
+
+    // A linear function is harmonic, so it should be reproduced exactly in both regions
+    fill_missing_portion_smooth_boundary(image, invalid);
+    CHECK(image.isApprox(expected, 1e-8));
+}
+
+TEST_CASE("multigrid backends") {
+    MatX<f64> image = smooth_test_image(64, 64);
+    MatX<bool> invalid = rectangle_mask(64, 64, { { 10, 20, 40, 30 } });
+    MatX<f64> expected = reference_fill(image, invalid);
+
+    for (auto backend : { SolverBackend::Multigrid, SolverBackend::MultigridConjugateGradient }) {
+        MultigridOptions multigrid { .coarsest_size = 16 };
+        MatX<f64> result = image;
+        fill_missing_portion_smooth_boundary(result, invalid, { .backend = backend, .tolerance = 1e-10, .multigrid = multigrid });
+        CHECK(result.isApprox(expected, 1e-6));
+    }
+
+    // Unequal smoothing counts would make the preconditioner nonsymmetric
+    MatX<f64> result = image;
+    MultigridOptions unequal { .pre_smoothing = 1, .post_smoothing = 3, .coarsest_size = 16 };
+    fill_missing_portion_smooth_boundary(result, invalid, { .backend = SolverBackend::MultigridConjugateGradient, .tolerance = 1e-10, .multigrid = unequal });
+    CHECK(result.isApprox(expected, 1e-6));
+
+    // A zero right-hand side is solved exactly, even after a solve that did not converge
+    StencilSystem system;
+    for (Eigen::Index col = 0; col < 30; ++col) {
+        for (Eigen::Index row = 0; row < 30; ++row) {
+            system.unknowns.push_back({ row, col });
+        }
+    }
+    system.diagonal = VecX<f64>::Constant(system.size(), 4.0);
+    Multigrid multigrid(system.assemble(), system.unknowns, { .coarsest_size = 16 });
+    multigrid.setTolerance(1e-14);
+    multigrid.setMaxIterations(1);
+    multigrid.solveWithGuess(VecX<f64>::Ones(system.size()), VecX<f64>::Zero(system.size()));
+    CHECK(multigrid.info() == Eigen::NoConvergence);
+    CHECK(multigrid.solveWithGuess(VecX<f64>::Zero(system.size()), VecX<f64>::Ones(system.size())).isZero());
+    CHECK(multigrid.info() == Eigen::Success);
+}
+
+TEST_CASE("matrix-free conjugate gradient") {
+    MatX<f64> image = smooth_test_image(48, 40, 0.2, 0.1);
+    // An irregular region that touches the border of the image, and a small separate region
+    MatX<bool> invalid = rectangle_mask(48, 40, { { 40, 30, 3, 3 } });
+    for (Eigen::Index row = 0; row < 30; ++row) {
+        invalid.block(row, 0, 1, 5 + row / 2).setConstant(true);
+    }
+    MatX<f64> expected = reference_fill(image, invalid);
+
+    MatX<f64> result = image;
+    fill_missing_portion_smooth_boundary(result, invalid, { .backend = SolverBackend::MatrixFreeConjugateGradient, .tolerance = 1e-12 });
+    CHECK(result.isApprox(expected, 1e-8));
+}
+
+TEST_CASE("matrix-free conjugate gradient falls back to the sparse matrix for slivers") {
+    // A diagonal band fills a small part of its bounding box
+    StencilSystem sliver;
+    for (Eigen::Index i = 1; i < 200; ++i) {
+        sliver.unknowns.push_back({ i, i });
+        sliver.unknowns.push_back({ i, i + 1 });
+    }
+    sliver.diagonal = VecX<f64>::Constant(sliver.size(), 4.0);
+    CHECK_FALSE(fits_matrix_free(sliver));
+
+    LinearSolver solver(sliver, { .backend = SolverBackend::MatrixFreeConjugateGradient, .tolerance = 1e-10 });
+    CHECK(solver.backend() == SolverBackend::ConjugateGradient);
+    VecX<f64> b = VecX<f64>::Ones(sliver.size());
+    VecX<f64> x = solver.solveWithGuess(b, VecX<f64>::Zero(sliver.size()));
+    CHECK(solver.info() == Eigen::Success);
+    CHECK((sliver.assemble() * x - b).norm() < 1e-8 * b.norm());
+
+    StencilSystem square;
+    for (Eigen::Index col = 0; col < 20; ++col) {
+        for (Eigen::Index row = 0; row < 20; ++row) {
+            square.unknowns.push_back({ row, col });
+        }
+    }
+    square.diagonal = VecX<f64>::Constant(square.size(), 4.0);
+    CHECK(fits_matrix_free(square));
+    CHECK(LinearSolver(square, { .backend = SolverBackend::MatrixFreeConjugateGradient }).backend() == SolverBackend::MatrixFreeConjugateGradient);
+}
+
+TEST_CASE("multi-channel laplace") {
+    MatX<bool> invalid = rectangle_mask(32, 32, { { 0, 4, 10, 12 }, { 20, 18, 8, 8 } });
+    std::vector<MatX<f64>> channels;
+    for (int c = 0; c < 3; ++c) {
+        channels.push_back(smooth_test_image(32, 32, 0.1 * (c + 1), 0.05 * c));
+    }
+
+    // Filling all the channels at once gives the same result as filling every channel on its own
+    std::vector<MatX<f64>> result = fill_missing_portion_smooth_boundary(channels, invalid, { .tolerance = 1e-12 });
+    REQUIRE_EQ(result.size(), channels.size());
+    for (size_t c = 0; c < channels.size(); ++c) {
+        CHECK(result[c].isApprox(reference_fill(channels[c], invalid), 1e-10));
+    }
+}
+
+TEST_CASE("block conjugate gradient") {
+    MatX<bool> invalid = rectangle_mask(40, 40, { { 8, 6, 20, 25 } });
+    std::vector<MatX<f64>> channels;
+    for (int c = 0; c < 4; ++c) {
+        channels.push_back(smooth_test_image(40, 40, 0.05 * (c + 2), 0.03 * (c + 1)));
+    }
+    // A repeated channel makes the block rank deficient, so it has to fall back to solving the channels separately
+    channels.push_back(channels[0]);
+
+    std::vector<MatX<f64>> expected = fill_missing_portion_smooth_boundary(channels, invalid, { .tolerance = 1e-12 });
+    std::vector<MatX<f64>> result = fill_missing_portion_smooth_boundary(channels, invalid, { .tolerance = 1e-12, .block_channels = true });
+    REQUIRE_EQ(result.size(), expected.size());
+    for (size_t c = 0; c < expected.size(); ++c) {
+        CHECK(result[c].isApprox(expected[c], 1e-8));
+    }
+
+    // The error of a column that is solved again is the error of that solve, not the error it had in the block
+    StencilSystem system;
+    for (Eigen::Index col = 0; col < 20; ++col) {
+        for (Eigen::Index row = 0; row < 20; ++row) {
+            system.unknowns.push_back({ row, col });
+        }
+    }
+    system.diagonal = VecX<f64>::Constant(system.size(), 4.0);
+    MatX<f64> B(system.size(), 3);
+    B.col(0).setOnes();
+    B.col(1) = VecX<f64>::LinSpaced(system.size(), 0.0, 1.0);
+    B.col(2) = B.col(0);
+    LinearSolver solver(system, { .tolerance = 1e-10, .block_channels = true });
+    MatX<f64> X = solver.solveWithGuess(B, MatX<f64>::Zero(B.rows(), B.cols()));
+    CHECK(solver.info() == Eigen::Success);
+    CHECK(solver.error() <= 1e-10);
+    CHECK((system.assemble() * X - B).norm() < 1e-8 * B.norm());
+}
+
+TEST_CASE("cached direct solver") {
+    MatX<f64> image = smooth_test_image(48, 48, 0.15, 0.05);
+    MatX<bool> invalid = rectangle_mask(48, 48, { { 5, 5, 20, 15 }, { 30, 30, 10, 10 } });
+    MatX<f64> expected = reference_fill(image, invalid);
+
+    clear_factorization_cache();
+    MatX<f64> result = image;
+    fill_missing_portion_smooth_boundary(result, invalid, { .backend = SolverBackend::Cholesky });
+    CHECK(result.isApprox(expected, 1e-8));
+    CHECK_EQ(factorization_cache_size(), 2);
+
+    // The same mask reuses the factorizations of both regions
+    MatX<f64> second = 2.0 * image;
+    fill_missing_portion_smooth_boundary(second, invalid, { .backend = SolverBackend::Cholesky });
+    CHECK(second.isApprox(2.0 * expected, 1e-8));
+    CHECK_EQ(factorization_cache_size(), 2);
+    std::size_t bytes = factorization_cache_bytes();
+    CHECK(bytes > 0);
+
+    // Factorizing the same system concurrently keeps a single entry, counted once
+    clear_factorization_cache();
+    StencilSystem system;
+    for (Eigen::Index col = 0; col < 15; ++col) {
+        for (Eigen::Index row = 0; row < 20; ++row) {
+            system.unknowns.push_back({ row, col });
+        }
+    }
+    system.diagonal = VecX<f64>::Constant(system.size(), 4.0);
+    CholeskySolver single(system);
+    std::size_t single_bytes = factorization_cache_bytes();
+    clear_factorization_cache();
+#pragma omp parallel for
+    for (int i = 0; i < 8; ++i) {
+        CholeskySolver concurrent(system);
+    }
+    CHECK_EQ(factorization_cache_size(), 1);
+    CHECK_EQ(factorization_cache_bytes(), single_bytes);
+
+    // Only the factorizations that fit in the memory budget are kept
+    clear_factorization_cache();
+    fill_missing_portion_smooth_boundary(result, invalid, { .backend = SolverBackend::Cholesky });
+    CHECK_EQ(factorization_cache_bytes(), bytes);
+    set_factorization_cache_capacity(bytes - 1);
+    CHECK_EQ(factorization_cache_size(), 1);
+    CHECK(factorization_cache_bytes() < bytes);
+    set_factorization_cache_capacity(0);
+    CHECK_EQ(factorization_cache_size(), 0);
+    CHECK_EQ(factorization_cache_bytes(), 0);
+    set_factorization_cache_capacity(default_factorization_cache_capacity);
+    clear_factorization_cache();
+}
+
+TEST_CASE("conjugate gradient preconditioners") {
+    MatX<f64> image = smooth_test_image(50, 50, 0.12, 0.08);
+    MatX<bool> invalid = rectangle_mask(50, 50, { { 0, 10, 30, 35 } });
+    MatX<f64> expected = reference_fill(image, invalid);
+
+    for (auto type : { Preconditioner::IncompleteCholesky, Preconditioner::SSOR, Preconditioner::BlockJacobi, Preconditioner::AdditiveSchwarz,
+             Preconditioner::SineTransform }) {
+        MatX<f64> result = image;
+        PreconditionerOptions preconditioner { .type = type, .omega = 1.5, .block_size = 64, .tile_size = 16, .overlap = 2 };
+        fill_missing_portion_smooth_boundary(result, invalid, { .tolerance = 1e-12, .preconditioner = preconditioner });
+        CHECK(result.isApprox(expected, 1e-8));
+    }
+
+    // The solve of every region is recorded with its preconditioner
+    fs::path folder = fs::temp_directory_path() / "approx_preconditioner_test";
+    fs::remove_all(folder);
+    fs::create_directories(folder);
+    {
+        MatX<f64> result = image;
+        PreconditionerOptions preconditioner { .type = Preconditioner::SSOR, .omega = 1.5 };
+        fill_missing_portion_smooth_boundary(result, invalid, { .tolerance = 1e-12, .preconditioner = preconditioner, .perf_database = folder });
+        std::vector<PerfInfo> records = PerfDataBase(folder).select_perf_info();
+        REQUIRE_EQ(records.size(), 1);
+        CHECK(records[0].method == ApproxMethod::Laplace);
+        CHECK(records[0].preconditioner == Preconditioner::SSOR);
+        CHECK(records[0].iterations > 0);
+    }
+    fs::remove_all(folder);
+}
+
+TEST_CASE("single and mixed precision") {
+    MatX<f64> image = 100.0 * smooth_test_image(60, 60, 0.1, 0.06);
+    MatX<bool> invalid = rectangle_mask(60, 60, { { 10, 15, 35, 30 } });
+    MatX<f64> expected = reference_fill(image, invalid);
+
+    // Mixed precision reaches the f64 tolerance, with the f32 iterations on the grids of the region or on the matrix
+    MatX<f64> mixed = image;
+    fill_missing_portion_smooth_boundary(mixed, invalid, { .tolerance = 1e-10, .precision = Precision::Mixed });
+    CHECK(mixed.isApprox(expected, 1e-8));
+    mixed = image;
+    fill_missing_portion_smooth_boundary(mixed, invalid, { .backend = SolverBackend::MatrixFreeConjugateGradient, .tolerance = 1e-10, .precision = Precision::Mixed });
+    CHECK(mixed.isApprox(expected, 1e-8));
+
+    // A diagonal sliver fills little of its bounding box, so its f32 iterations use the matrix
+    StencilSystem sliver;
+    for (Eigen::Index i = 0; i < 40; ++i) {
+        sliver.unknowns.push_back({ i, i });
+        sliver.unknowns.push_back({ i + 1, i });
+    }
+    sliver.diagonal = VecX<f64>::Constant(sliver.size(), 4.0);
+    CHECK_FALSE(fits_matrix_free(sliver));
+    VecX<f64> sliver_b = VecX<f64>::LinSpaced(sliver.size(), 1.0, 2.0);
+    LinearSolver sliver_solver(sliver, { .tolerance = 1e-10, .precision = Precision::Mixed });
+    VecX<f64> sliver_x = sliver_solver.solveWithGuess(sliver_b, VecX<f64>::Zero(sliver.size()));
+    CHECK(sliver_solver.info() == Eigen::Success);
+    CHECK((sliver_b - sliver.assemble() * sliver_x).norm() < 1e-9 * sliver_b.norm());
+
+    // Single precision images and solves are accurate to roughly the precision of f32
+    MatX<f32> single = image.cast<f32>();
+    fill_missing_portion_smooth_boundary(single, invalid, { .tolerance = 1e-4, .precision = Precision::Single });
+    CHECK(single.cast<f64>().isApprox(expected, 1e-4));
+
+    // A tolerance that f32 cannot reach is loosened instead of failing the region
+    MatX<f32> tight = image.cast<f32>();
+    FillResult result = fill_missing_portion_smooth_boundary(tight, invalid, { .tolerance = 1e-8, .precision = Precision::Single });
+    CHECK(result.status == FillStatus::Converged);
+    CHECK(result.error <= single_precision_tolerance);
+    CHECK(tight.cast<f64>().isApprox(expected, 1e-4));
+}
+
+TEST_CASE("red-black SOR fill") {
+    MatX<f64> image = smooth_test_image(40, 300, 0.2, 0.05);
+    // A long region spanning several column blocks that touches the border of the image, and a small separate region
+    MatX<bool> invalid = rectangle_mask(40, 300, { { 0, 10, 20, 280 }, { 30, 100, 4, 5 } });
+    MatX<f64> expected = reference_fill(image, invalid);
+
+    // The starting values do not matter, even if they are not finite
+    MatX<f64> result = image;
+    result(5, 50) = std::numeric_limits<f64>::quiet_NaN();
+    SORFillResult info = fill_missing_portion_sor(result, invalid, { .tolerance = 1e-10 });
+    CHECK(info.converged);
+    CHECK(info.error <= 1e-10);
+    CHECK(result.isApprox(expected, 1e-8));
+
+    // A single sweep is not enough
+    MatX<f64> partial = image;
+    info = fill_missing_portion_sor(partial, invalid, { .max_sweeps = 1 });
+    CHECK(!info.converged);
+    CHECK_EQ(info.sweeps, 1);
+}
+
+TEST_CASE("poisson blend at an offset") {
+    MultiChannelImage input = offset_blend_input();
+    MultiChannelImage replacement(3, 12, 10);
+    for (size_t c = 0; c < 3; ++c) {
+        // White (1 in every channel) marks the pixels that are not replaced
+        replacement[c].setConstant(1.0);
+        for (Eigen::Index row = 2; row < 10; ++row) {
+            for (Eigen::Index col = 1; col < 9; ++col) {
+                replacement(c, row, col) = 0.2 + 0.05 * (f64)(row + c * col);
+            }
+        }
+    }
+
+    // The same blend with a mask over the full image
+    int start_row = 5, start_column = 20;
+    MultiChannelImage placed = input;
+    MatX<bool> invalid = rectangle_mask(30, 40, { { start_row + 2, start_column + 1, 8, 8 } });
+    for (size_t c = 0; c < 3; ++c) {
+        placed[c].block<12, 10>(start_row, start_column) = replacement[c];
+    }
+    MultiChannelImage expected = reference_blend(input, placed, invalid);
+
+    blend_images_poisson(input, replacement, start_row, start_column);
+    for (size_t c = 0; c < 3; ++c) {
+        CHECK(input[c].isApprox(expected[c], 1e-8));
+    }
+}
+
+TEST_CASE("streaming poisson blend") {
+    Eigen::Index rows = 120, cols = 50;
+    MultiChannelImage input;
+    MultiChannelImage replacement;
+    for (size_t c = 0; c < 2; ++c) {
+        input.images.push_back(smooth_test_image(rows, cols, 0.05 * (f64)(c + 1), 0.02));
+        replacement.images.push_back((smooth_test_image(rows, cols, 0.1, 0.1 * (f64)(c + 1)).array() + 0.5).matrix());
+    }
+    // A tall hole that spans many bands, and one that touches the border of the image
+    MatX<bool> invalid = rectangle_mask(rows, cols, { { 10, 12, 90, 20 }, { 100, 44, 15, 6 } });
+    MultiChannelImage expected = reference_blend(input, replacement, invalid);
+
+    // Only rows of the images are handed out, and the output is written back one band at a time
+    MultiChannelImage output(2, rows, cols);
+    auto rows_of = [](MultiChannelImage const& image, Eigen::Index first, Eigen::Index n) {
+        MultiChannelImage values;
+        for (auto const& channel : image.images) {
+            values.images.emplace_back(channel.middleRows(first, n));
+        }
+        return values;
+    };
+    RowStreams streams {
+        .rows = rows,
+        .cols = cols,
+        .read_input = [&](Eigen::Index first, Eigen::Index n) { return rows_of(input, first, n); },
+        .read_replacement = [&](Eigen::Index first, Eigen::Index n) { return rows_of(replacement, first, n); },
+        .read_mask = [&](Eigen::Index first, Eigen::Index n) -> MatX<bool> { return invalid.middleRows(first, n); },
+        .read_output = [&](Eigen::Index first, Eigen::Index n) { return rows_of(output, first, n); },
+        .write_output = [&](Eigen::Index first, MultiChannelImage const& values) {
+            for (size_t c = 0; c < values.images.size(); ++c) {
+                output[c].middleRows(first, values.rows()) = values[c];
+            }
+        }
+    };
+
+    StreamingOptions options { .band_rows = 16, .halo_rows = 8, .coarse_factor = 4, .passes = 8, .solver = { .tolerance = 1e-12 } };
+    StreamingResult result = blend_images_poisson_streaming(streams, options);
+    CHECK_LE(result.peak_rows, 32);
+    CHECK_GT(result.coarse_unknowns, 0);
+    for (size_t c = 0; c < 2; ++c) {
+        CHECK((output[c] - expected[c]).cwiseAbs().maxCoeff() < 1e-6);
+        // The valid pixels are copied from the input
+        CHECK((invalid.array()).select(0.0, output[c] - input[c]).cwiseAbs().maxCoeff() == 0.0);
+    }
+
+    // Without a halo, the rows where the window ends are still outside of the band, so every row of the band is solved
+    auto error_of = [&]() {
+        f64 error = 0.0;
+        for (size_t c = 0; c < 2; ++c) {
+            error = std::max(error, (output[c] - expected[c]).cwiseAbs().maxCoeff());
+        }
+        return error;
+    };
+    StreamingOptions no_halo = options;
+    no_halo.halo_rows = 0;
+    no_halo.passes = 0;
+    blend_images_poisson_streaming(streams, no_halo);
+    f64 initial_error = error_of();
+    MultiChannelImage initial = output;
+    no_halo.passes = 8;
+    blend_images_poisson_streaming(streams, no_halo);
+    CHECK(error_of() < 0.5 * initial_error);
+    no_halo.band_rows = 1;
+    blend_images_poisson_streaming(streams, no_halo);
+    CHECK(error_of() < initial_error);
+    CHECK(invalid.select(output[0] - initial[0], 0.0).cwiseAbs().maxCoeff() > 0.0);
+
+    // A coarse grid that does not fit is made coarser
+    options.max_coarse_pixels = 100;
+    StreamingResult capped = blend_images_poisson_streaming(streams, options);
+    CHECK_LT(capped.coarse_unknowns, result.coarse_unknowns);
+    for (size_t c = 0; c < 2; ++c) {
+        CHECK((invalid.array()).select(0.0, output[c] - input[c]).cwiseAbs().maxCoeff() == 0.0);
+    }
+}
+
+TEST_CASE("stencil assembly") {
+    // Large enough to be assembled in parallel, with holes so not every unknown has four neighbours
+    StencilSystem system;
+    for (Eigen::Index col = 0; col < 300; ++col) {
+        for (Eigen::Index row = 0; row < 200; ++row) {
+            if ((row * 7 + col * 3) % 11 != 0) {
+                system.unknowns.push_back({ row, col });
+            }
+        }
+    }
+    system.diagonal = VecX<f64>::Constant((Eigen::Index)system.unknowns.size(), 4.0);
+
+    for (auto const& unknowns : { std::vector<index_t>(system.unknowns.begin(), system.unknowns.begin() + 100), system.unknowns }) {
+        StencilSystem part { unknowns, system.diagonal.head((Eigen::Index)unknowns.size()) };
+
+        std::map<std::pair<Eigen::Index, Eigen::Index>, Eigen::Index> numbers;
+        for (size_t i = 0; i < unknowns.size(); ++i) {
+            numbers[{ unknowns[i].row, unknowns[i].col }] = (Eigen::Index)i;
+        }
+        std::vector<triplet_t> triplets;
+        for (size_t i = 0; i < unknowns.size(); ++i) {
+            triplets.emplace_back((Eigen::Index)i, (Eigen::Index)i, 4.0);
+            for (auto [row_offset, col_offset] : stencil_offsets) {
+                auto neighbour = numbers.find({ unknowns[i].row + row_offset, unknowns[i].col + col_offset });
+                if (neighbour != numbers.end()) {
+                    triplets.emplace_back((Eigen::Index)i, neighbour->second, -1.0);
+                }
+            }
+        }
+        sparse_t expected(part.size(), part.size());
+        expected.setFromTriplets(triplets.begin(), triplets.end());
+
+        sparse_t A = part.assemble();
+        REQUIRE_EQ(A.nonZeros(), expected.nonZeros());
+        CHECK_EQ(sparse_t(A - expected).norm(), 0.0);
+        CHECK(sparse_t(row_major_view(A)).isApprox(sparse_t(expected.transpose())));
+    }
+}
+
+TEST_CASE("poisson blend keeps the guidance field") {
+    // When the input only differs from the replacement by a constant, the blend is exactly the shifted replacement
+    MultiChannelImage replacement(2, 30, 25);
+    replacement[0] = smooth_test_image(30, 25, 0.3, 0.2);
+    for (Eigen::Index row = 0; row < 30; ++row) {
+        for (Eigen::Index col = 0; col < 25; ++col) {
+            replacement(1, row, col) = 0.01 * (f64)(row * col);
+        }
+    }
+    MultiChannelImage input = replacement;
+    for (auto& image : input.images) {
+        image.array() += 2.0;
+    }
+    MultiChannelImage expected = input;
+
+    // Regions in the middle, and at the corner of the image
+    MatX<bool> invalid = rectangle_mask(30, 25, { { 10, 8, 9, 7 }, { 0, 0, 4, 6 } });
+    for (auto& image : input.images) {
+        image = invalid.select(0.0, image);
+    }
+
+    blend_images_poisson(input, replacement, invalid, { .tolerance = 1e-12 });
+    for (size_t c = 0; c < input.images.size(); ++c) {
+        CHECK(input[c].isApprox(expected[c], 1e-8));
+    }
+}
+
+TEST_CASE("unknown ordering") {
+    // A tall and thin region, where the (column-major) raster order has a large bandwidth
+    MatX<bool> invalid = rectangle_mask(120, 40, { { 5, 10, 110, 12 }, { 60, 22, 8, 15 } });
+    auto components = find_connected_components(invalid);
+    REQUIRE_EQ(components.region_map.size(), 1);
+
+    StencilSystem region { .unknowns = components.region_map.begin()->second };
+    std::sort(region.unknowns.begin(), region.unknowns.end(), [](index_t a, index_t b) {
+        return a.col != b.col ? a.col < b.col : a.row < b.row;
+    });
+    region.diagonal = VecX<f64>::Constant(region.size(), 4.0);
+    Eigen::Index raster_bandwidth = bandwidth(region.assemble());
+
+    VecX<f64> b(region.size());
+    for (Eigen::Index i = 0; i < b.size(); ++i) {
+        b[i] = std::sin(0.1 * (f64)i);
+    }
+    LinearSolver reference(region, { .tolerance = 1e-12 });
+    VecX<f64> expected = reference.solveWithGuess(b, VecX<f64>::Zero(b.size()));
+
+    for (auto ordering : { UnknownOrdering::Morton, UnknownOrdering::ReverseCuthillMcKee }) {
+        std::vector<Eigen::Index> order = unknown_order(region, ordering);
+        std::vector<Eigen::Index> sorted = order;
+        std::sort(sorted.begin(), sorted.end());
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            REQUIRE_EQ(sorted[i], (Eigen::Index)i);
+        }
+        if (ordering == UnknownOrdering::ReverseCuthillMcKee) {
+            CHECK(bandwidth(reorder(region, order).assemble()) < raster_bandwidth);
+        }
+
+        for (auto backend : { SolverBackend::ConjugateGradient, SolverBackend::MultigridConjugateGradient }) {
+            LinearSolver solver(region, { .backend = backend, .tolerance = 1e-12, .ordering = ordering });
+            VecX<f64> x = solver.solveWithGuess(b, VecX<f64>::Zero(b.size()));
+            CHECK(x.isApprox(expected, 1e-8));
+        }
+    }
+}
+
+TEST_CASE("automatic backend") {
+    DispatchThresholds thresholds { .direct_size = 500, .thin_width = 4.0 };
+    auto square = [](Eigen::Index rows, Eigen::Index cols) {
+        StencilSystem system;
+        for (Eigen::Index col = 0; col < cols; ++col) {
+            for (Eigen::Index row = 0; row < rows; ++row) {
+                system.unknowns.push_back({ row + 1, col + 1 });
+            }
+        }
+        system.diagonal = VecX<f64>::Constant(system.size(), 4.0);
+        return system;
+    };
+    CHECK_EQ(select_backend(square(20, 20), thresholds), SolverBackend::Cholesky);
+    CHECK_EQ(select_backend(square(40, 40), thresholds), SolverBackend::MultigridConjugateGradient);
+    CHECK_EQ(select_backend(square(300, 3), thresholds), SolverBackend::Cholesky);
+    // Unless the factorization of the thin region would be too large
+    CHECK_EQ(select_backend(square(300, 3), { .direct_size = 500, .thin_width = 4.0, .max_thin_fill = 1000.0 }), SolverBackend::MultigridConjugateGradient);
+
+    // A small and a large region, which are solved with different backends
+    set_dispatch_thresholds(thresholds);
+    MatX<f64> image = smooth_test_image(60, 60, 0.1, 0.02);
+    MatX<bool> invalid = rectangle_mask(60, 60, { { 5, 5, 35, 35 }, { 50, 50, 5, 5 } });
+    MatX<f64> expected = reference_fill(image, invalid);
+    MatX<f64> result = image;
+    fill_missing_portion_smooth_boundary(result, invalid, { .backend = SolverBackend::Automatic, .tolerance = 1e-12 });
+    CHECK(result.isApprox(expected, 1e-8));
+    set_dispatch_thresholds({});
+}
+
+TEST_CASE("warm start") {
+    MultiChannelImage replacement({ smooth_test_image(50, 50, 0.2, 0.15) });
+    MultiChannelImage input(1, 50, 50);
+    for (Eigen::Index row = 0; row < 50; ++row) {
+        for (Eigen::Index col = 0; col < 50; ++col) {
+            input(0, row, col) = 0.02 * (f64)(row + 2 * col);
+        }
+    }
+    MatX<bool> invalid = rectangle_mask(50, 50, { { 10, 10, 30, 25 } });
+
+    MultiChannelImage expected = input;
+    blend_images_poisson(expected, replacement, invalid, { .tolerance = 1e-10 });
+
+    // Starting from (almost) the solution gives the same result
+    MultiChannelImage warm_start = expected;
+    warm_start[0].array() += 1e-4;
+    MultiChannelImage result = input;
+    blend_images_poisson(result, replacement, invalid, warm_start, { .tolerance = 1e-10 });
+    CHECK(result[0].isApprox(expected[0], 1e-8));
+
+    // The residuals of the guesses are computed with the matrix (or the stencil) of the solver, in any order
+    StencilSystem system;
+    for (Eigen::Index col = 0; col < 12; ++col) {
+        for (Eigen::Index row = 0; row < 10; ++row) {
+            system.unknowns.push_back({ row, col });
+        }
+    }
+    system.diagonal = VecX<f64>::Constant(system.size(), 4.0);
+    MatX<f64> B = MatX<f64>::Ones(system.size(), 2);
+    MatX<f64> guesses = MatX<f64>::Zero(system.size(), 2);
+    guesses.col(1) = VecX<f64>::LinSpaced(system.size(), 0.0, 1.0);
+    sparse_t A = system.assemble();
+    f64 expected_residual = std::max((B.col(0) - A * guesses.col(0)).norm(), (B.col(1) - A * guesses.col(1)).norm()) / B.col(0).norm();
+    for (auto backend : { SolverBackend::ConjugateGradient, SolverBackend::MatrixFreeConjugateGradient, SolverBackend::MultigridConjugateGradient }) {
+        LinearSolver solver(system, { .backend = backend, .ordering = UnknownOrdering::ReverseCuthillMcKee });
+        CHECK(solver.relative_residual(B, guesses) == doctest::Approx(expected_residual));
+    }
+    LinearSolver single(system, { .precision = Precision::Single });
+    CHECK(single.relative_residual(B, guesses) == doctest::Approx(expected_residual));
+
+    // The most recent earlier result of the band is found in the database
+    fs::path folder = fs::temp_directory_path() / "approx_warm_start_test";
+    fs::remove_all(folder);
+    fs::create_directories(folder);
+    {
+        approx::DataBase db(folder);
+        db.write_approx_results("2019-05-02", "B04", ApproxMethod::Poisson);
+        int id = db.write_approx_results("2019-05-12", "B04", ApproxMethod::Poisson);
+        db.write_approx_results("2019-05-22", "B04", ApproxMethod::Poisson);
+        db.write_approx_results("2019-05-17", "B03", ApproxMethod::Poisson);
+
+        auto previous = db.select_previous_approx("2019-05-20", "B04", ApproxMethod::Poisson);
+        REQUIRE(previous.has_value());
+        CHECK_EQ(previous->date, date_time::date(2019, 5, 12));
+        CHECK_EQ(previous->id, id);
+        CHECK_EQ(approximated_band_path(folder, previous->date, "B04", id), folder / "2019-05-12" / "approximated_data" / fmt::format("B04_{}.tif", id));
+        CHECK_FALSE(db.select_previous_approx("2019-05-02", "B04", ApproxMethod::Poisson).has_value());
+        CHECK_FALSE(db.select_previous_approx("2019-05-20", "B04", ApproxMethod::Laplace).has_value());
+    }
+    fs::remove_all(folder);
+}
+
+TEST_CASE("time budget") {
+    MatX<f64> image = MatX<f64>::Zero(400, 400);
+    for (Eigen::Index col = 0; col < image.cols(); ++col) {
+        image.col(col).setConstant(std::sin(0.05 * (f64)col));
+    }
+    MatX<bool> invalid = rectangle_mask(400, 400, { { 20, 20, 360, 360 } });
+
+    MatX<f64> converged = image;
+    FillResult result = fill_missing_portion_smooth_boundary(converged, invalid, { .backend = SolverBackend::MultigridConjugateGradient, .tolerance = 1e-8 });
+    CHECK_EQ(result.status, FillStatus::Converged);
+    CHECK(result.error <= 1e-8);
+
+    // A budget that is far too small still gives a finite image
+    MatX<f64> stopped = image;
+    result = fill_missing_portion_smooth_boundary(stopped, invalid, { .backend = SolverBackend::ConjugateGradient, .tolerance = 1e-8, .time_budget = 1e-4 });
+    CHECK_EQ(result.status, FillStatus::DeadlineReached);
+    CHECK(result.error > 1e-8);
+    CHECK(stopped.allFinite());
+
+    // Stopping at the deadline does not restart conjugate gradient, so a solve that fits in the budget takes the same
+    // iterations as one without a deadline
+    StencilSystem system;
+    for (Eigen::Index col = 0; col < 60; ++col) {
+        for (Eigen::Index row = 0; row < 50; ++row) {
+            system.unknowns.push_back({ row, col });
+        }
+    }
+    system.diagonal = VecX<f64>::Constant(system.size(), 4.0);
+    VecX<f64> b = VecX<f64>::LinSpaced(system.size(), -1.0, 1.0);
+    VecX<f64> zero = VecX<f64>::Zero(system.size());
+    auto later = std::chrono::steady_clock::now() + std::chrono::hours(1);
+    for (auto backend : { SolverBackend::ConjugateGradient, SolverBackend::MatrixFreeConjugateGradient, SolverBackend::MultigridConjugateGradient }) {
+        LinearSolver unbounded(system, { .backend = backend, .tolerance = 1e-10 });
+        VecX<f64> expected = unbounded.solveWithGuess(b, zero);
+        LinearSolver bounded(system, { .backend = backend, .tolerance = 1e-10 }, later);
+        VecX<f64> x = bounded.solveWithGuess(b, zero);
+        CHECK(bounded.info() == Eigen::Success);
+        CHECK_FALSE(bounded.deadline_reached());
+        CHECK_EQ(bounded.iterations(), unbounded.iterations());
+        CHECK(x.isApprox(expected, 1e-8));
+    }
+
+    // The setup counts against the deadline: once it has passed, not even the factorization is computed
+    clear_factorization_cache();
+    LinearSolver late(system, { .backend = SolverBackend::Cholesky }, std::chrono::steady_clock::now());
+    CHECK(late.info() == Eigen::Success);
+    CHECK_EQ(factorization_cache_size(), 0);
+    VecX<f64> x = late.solveWithGuess(b, zero);
+    CHECK(late.deadline_reached());
+    CHECK_EQ(late.result().status, FillStatus::DeadlineReached);
+    CHECK(late.error() == doctest::Approx(1.0));
+    CHECK_EQ(x, zero);
+
+    MultiChannelImage input(1, 400, 400);
+    input[0] = image;
+    MultiChannelImage replacement(1, 400, 400);
+    replacement[0].setOnes();
+    result = blend_images_poisson(input, replacement, invalid, { .backend = SolverBackend::ConjugateGradient, .tolerance = 1e-8, .time_budget = 1e-4 });
+    CHECK_EQ(result.status, FillStatus::DeadlineReached);
+    CHECK(input[0].allFinite());
+}
+
+TEST_CASE("tolerance tuning") {
+    std::vector<PerfInfo> history;
+    // Calibration solves at two tolerances, so the visual error is measured up to the tolerance that is tuned to
+    for (long i = 0; i < 10; ++i) {
+        f64 tolerance = i % 2 == 0 ? 1e-3 : 1e-6;
+        history.push_back({ .region_size = 1000 + i, .tolerance = tolerance, .iterations = i % 2 == 0 ? 20 + i : 50 + i, .error = tolerance, .visual_error = 0.1 * tolerance });
+    }
+    history.push_back({ .region_size = 100000, .tolerance = 1e-6, .iterations = 400, .error = 1e-6, .visual_error = 1e-5 });
+    // Direct solves do not have a residual, and are not used
+    history.push_back({ .region_size = 100000, .tolerance = 1e-6, .error = 0.0, .backend = SolverBackend::Cholesky });
+
+    // The records of the other fill are not used
+    for (long i = 0; i < 10; ++i) {
+        f64 tolerance = i % 2 == 0 ? 1e-2 : 1e-6;
+        history.push_back({ .method = ApproxMethod::Laplace, .region_size = 1000 + i, .tolerance = tolerance, .iterations = i % 2 == 0 ? 10 + i : 50 + i, .error = tolerance, .visual_error = 1e-3 * tolerance });
+    }
+
+    auto cg = SolverBackend::ConjugateGradient;
+    auto jacobi = Preconditioner::Jacobi;
+    ToleranceTuner tuner(history, { .visual_error = 1e-4 }, ApproxMethod::Poisson);
+    CHECK(std::abs(tuner.tolerance(1010, cg, jacobi, 1e-6) - 1e-3) < 1e-12);
+    CHECK_EQ(tuner.tolerance(100000, cg, jacobi, 1e-6), 1e-6);
+    CHECK_EQ(tuner.tolerance(10, cg, jacobi, 1e-6), 1e-6);
+    // The error per residual grows as the tolerance is loosened, so the tolerance is never looser than the loosest
+    // measured solve
+    CHECK(std::abs(ToleranceTuner(history, { .visual_error = 1e-2 }, ApproxMethod::Poisson).tolerance(1010, cg, jacobi, 1e-6) - 1e-3) < 1e-12);
+    // The tuned tolerance is never tighter than the tolerance of the options
+    CHECK_EQ(tuner.tolerance(1010, cg, jacobi, 1e-2), 1e-2);
+    REQUIRE_EQ(tuner.buckets().size(), 2);
+    CHECK_EQ(tuner.buckets()[0].records, 10);
+    CHECK_EQ(tuner.buckets()[0].measured_records, 10);
+    CHECK(tuner.buckets()[0].min_size <= 1000);
+    CHECK(tuner.buckets()[0].max_size > 1009);
+    CHECK(tuner.buckets()[0].predicted_iterations(1e-6) > tuner.buckets()[0].predicted_iterations(1e-3));
+    CHECK_EQ(ToleranceTuner(history, { .visual_error = 1e-4 }, ApproxMethod::Laplace).tolerance(1010, cg, jacobi, 1e-6), 1e-2);
+
+    // The solves of another backend or preconditioner have their own buckets, and the preconditioner only matters for
+    // the ConjugateGradient backend
+    CHECK_EQ(tuner.tolerance(1010, SolverBackend::MultigridConjugateGradient, jacobi, 1e-6), 1e-6);
+    CHECK_EQ(tuner.tolerance(1010, cg, Preconditioner::SSOR, 1e-6), 1e-6);
+    std::vector<PerfInfo> multigrid = history;
+    for (auto& info : multigrid) {
+        info.backend = SolverBackend::MultigridConjugateGradient;
+        info.preconditioner = Preconditioner::SSOR;
+    }
+    ToleranceTuner multigrid_tuner(multigrid, { .visual_error = 1e-4 }, ApproxMethod::Poisson);
+    CHECK(std::abs(multigrid_tuner.tolerance(1010, SolverBackend::MultigridConjugateGradient, jacobi, 1e-6) - 1e-3) < 1e-12);
+    CHECK_EQ(multigrid_tuner.tolerance(1010, cg, jacobi, 1e-6), 1e-6);
+
+    // Warm started and quadtree solves converge differently, and are not used
+    std::vector<PerfInfo> excluded = history;
+    for (size_t i = 0; i < excluded.size(); ++i) {
+        excluded[i].warm_start = i % 2 == 0;
+        excluded[i].quadtree = i % 2 == 1;
+    }
+    CHECK(ToleranceTuner(excluded, { .visual_error = 1e-4 }, ApproxMethod::Poisson).buckets().empty());
+
+    // The iterations are fitted per solve, so the same solves of more channels give the same model
+    std::vector<PerfInfo> channels = history;
+    for (auto& info : channels) {
+        info.iterations *= 5;
+        info.solves = 5;
+    }
+    BucketFit single = tuner.buckets()[0];
+    BucketFit multiple = ToleranceTuner(channels, { .visual_error = 1e-4 }, ApproxMethod::Poisson).buckets()[0];
+    CHECK(multiple.slope == doctest::Approx(single.slope));
+    CHECK(multiple.intercept == doctest::Approx(single.intercept));
+
+    // The tolerance is not loosened if the iteration model does not predict that it saves iterations
+    std::vector<PerfInfo> flat;
+    for (long i = 0; i < 10; ++i) {
+        flat.push_back({ .region_size = 1000 + i, .tolerance = 1e-6, .iterations = 50, .error = i % 2 == 0 ? 1e-4 : 1e-8, .visual_error = 1e-7 });
+    }
+    CHECK_EQ(ToleranceTuner(flat, { .visual_error = 1e-1 }, ApproxMethod::Poisson).tolerance(1010, cg, jacobi, 1e-6), 1e-6);
+
+    // Records without a measured visual error only count for the iteration model
+    for (auto& info : history) {
+        info.visual_error = 0.0;
+    }
+    CHECK_EQ(ToleranceTuner(history, { .visual_error = 1e-4 }, ApproxMethod::Poisson).tolerance(1010, cg, jacobi, 1e-6), 1e-6);
+
+    // The solves of the blend are recorded in the database, and the next blend uses a looser tolerance
+    MultiChannelImage replacement({ smooth_test_image(60, 60, 0.2, 0.15) });
+    MultiChannelImage input(1, 60, 60);
+    for (Eigen::Index row = 0; row < 60; ++row) {
+        for (Eigen::Index col = 0; col < 60; ++col) {
+            input(0, row, col) = 0.01 * (f64)(row + col);
+        }
+    }
+    MatX<bool> invalid = rectangle_mask(60, 60, { { 5, 5, 30, 30 }, { 45, 40, 10, 12 } });
+
+    fs::path folder = fs::temp_directory_path() / "approx_tuning_test";
+    fs::remove_all(folder);
+    fs::create_directories(folder);
+    {
+        // The error per residual grows as the tolerance is loosened, so the calibration covers a range of tolerances
+        for (f64 tolerance : { 1e-3, 1e-5 }) {
+            MultiChannelImage calibration = input;
+            blend_images_poisson(calibration, replacement, invalid, { .tolerance = tolerance, .perf_database = folder, .measure_visual_error = true });
+        }
+        MultiChannelImage result = input;
+        blend_images_poisson(result, replacement, invalid, { .tolerance = 1e-8, .perf_database = folder, .measure_visual_error = true });
+        std::vector<PerfInfo> records = PerfDataBase(folder).select_perf_info();
+        REQUIRE_EQ(records.size(), 6);
+        CHECK_EQ(records[4].region_size, 900);
+        CHECK(records[4].visual_error > 0.0);
+
+        MultiChannelImage tuned = input;
+        blend_images_poisson(tuned, replacement, invalid, { .tolerance = 1e-8, .perf_database = folder, .tuning = TuningOptions { .visual_error = 1e-3, .min_records = 1 } });
+        records = PerfDataBase(folder).select_perf_info();
+        REQUIRE_EQ(records.size(), 8);
+        CHECK(records[6].tolerance > 1e-8);
+        CHECK(records[6].iterations < records[4].iterations);
+        CHECK(((tuned[0] - result[0]).norm() / std::sqrt(900.0)) < 1e-3);
+
+        // The Laplace fill is tuned from its own records
+        MatX<f64> image;
+        for (f64 tolerance : { 1e-3, 1e-5, 1e-8 }) {
+            image = input[0];
+            fill_missing_portion_smooth_boundary(image, invalid, { .tolerance = tolerance, .perf_database = folder, .measure_visual_error = true });
+        }
+        MatX<f64> tuned_image = input[0];
+        fill_missing_portion_smooth_boundary(tuned_image, invalid, { .tolerance = 1e-8, .perf_database = folder, .tuning = TuningOptions { .visual_error = 1e-3, .min_records = 1 } });
+        records = PerfDataBase(folder).select_perf_info();
+        REQUIRE_EQ(records.size(), 16);
+        CHECK_EQ(records[12].method, ApproxMethod::Laplace);
+        CHECK(records[12].visual_error > 0.0);
+        CHECK(records[14].tolerance > 1e-8);
+        CHECK(records[14].iterations < records[12].iterations);
+        CHECK(((tuned_image - image).norm() / std::sqrt(900.0)) < 1e-3);
+    }
+    fs::remove_all(folder);
+}
+
+TEST_CASE("pull-push fill") {
+    MatX<f64> image = smooth_test_image(64, 48, 0.1, 0.05);
+    MatX<bool> invalid = rectangle_mask(64, 48, { { 10, 8, 30, 25 }, { 0, 40, 6, 8 } });
+    MatX<f64> input = invalid.select(MatX<f64>::Constant(64, 48, std::nan("")), image);
+
+    // The known pixels are kept, and the filled ones are averages of the known pixels
+    MatX<f64> filled = input;
+    fill_missing_portion_pull_push(filled, invalid);
+    CHECK(filled.allFinite());
+    CHECK(((!invalid.array()).select(filled - image, 0.0)).isZero());
+    f64 lowest = (!invalid.array()).select(image, 1e9).minCoeff();
+    f64 highest = (!invalid.array()).select(image, -1e9).maxCoeff();
+    CHECK(filled.minCoeff() >= lowest - 1e-12);
+    CHECK(filled.maxCoeff() <= highest + 1e-12);
+
+    // A constant image is filled with the same constant
+    MatX<f64> constant = invalid.select(MatX<f64>::Zero(64, 48), MatX<f64>::Constant(64, 48, 3.0));
+    fill_missing_portion_pull_push(constant, invalid);
+    CHECK(constant.isApproxToConstant(3.0));
+
+    // Every channel is filled the same way
+    MultiChannelImage channels({ input, 2.0 * input });
+    fill_missing_portion_pull_push(channels, invalid);
+    CHECK(channels[1].isApprox(2.0 * filled));
+
+    // As the starting point of the solver, it gives the same fill in fewer iterations. The Laplace fill keeps the pixels
+    // on the border of the image, so only the interior region is used
+    MatX<bool> interior = invalid;
+    interior.block(0, 40, 6, 8).setConstant(false);
+    MatX<f64> expected = image;
+    FillResult from_zero = fill_missing_portion_smooth_boundary(expected, interior, { .tolerance = 1e-10 });
+    MatX<f64> result = image;
+    FillResult from_pull_push = fill_missing_portion_smooth_boundary(result, interior, { .tolerance = 1e-10, .pull_push_guess = true });
+    CHECK(result.isApprox(expected, 1e-8));
+    CHECK(from_pull_push.iterations < from_zero.iterations);
+}
+
+TEST_CASE("convolution pyramid blend") {
+    MultiChannelImage replacement(2, 80, 70);
+    MultiChannelImage input(2, 80, 70);
+    replacement[0] = smooth_test_image(80, 70, 0.3, 0.2);
+    for (Eigen::Index row = 0; row < 80; ++row) {
+        for (Eigen::Index col = 0; col < 70; ++col) {
+            replacement(1, row, col) = 0.01 * (f64)(row * col);
+            input(0, row, col) = replacement(0, row, col) + 0.5 + 0.01 * (f64)col;
+            input(1, row, col) = replacement(1, row, col) + 0.7;
+        }
+    }
+    MatX<bool> invalid = rectangle_mask(80, 70, { { 15, 10, 40, 35 }, { 60, 50, 10, 15 } });
+
+    MultiChannelImage expected = input;
+    blend_images_poisson(expected, replacement, invalid, { .backend = SolverBackend::Cholesky });
+    MultiChannelImage result = input;
+    blend_images_poisson_pyramid(result, replacement, invalid);
+
+    // The valid pixels are kept, and a constant difference between the images is interpolated exactly
+    CHECK(((!invalid.array()).select(result[0] - input[0], 0.0)).isZero());
+    CHECK(result[1].isApprox(input[1], 1e-12));
+
+    // A smooth difference is close to the exact blend
+    f64 error = invalid.select(result[0] - expected[0], 0.0).norm();
+    f64 membrane = invalid.select(expected[0] - replacement[0], 0.0).norm();
+    CHECK(error < 0.05 * membrane);
+}
+
+TEST_CASE("quadtree blend") {
+    MultiChannelImage replacement(2, 160, 150);
+    MultiChannelImage input(2, 160, 150);
+    replacement[0] = smooth_test_image(160, 150, 0.3, 0.2);
+    for (Eigen::Index row = 0; row < 160; ++row) {
+        for (Eigen::Index col = 0; col < 150; ++col) {
+            replacement(1, row, col) = 0.01 * (f64)(row * col);
+            input(0, row, col) = replacement(0, row, col) + 0.5 + 0.3 * std::sin(0.05 * (f64)(row + 2 * col));
+            input(1, row, col) = replacement(1, row, col) + 0.7;
+        }
+    }
+    MatX<bool> invalid = rectangle_mask(160, 150, { { 20, 15, 120, 110 }, { 145, 130, 10, 15 } });
+
+    // The interior of the hole is covered by a few large cells
+    auto components = find_connected_components(invalid);
+    int label = components.labels_by_size().front();
+    auto const& pixels = components.region_map.at(label);
+    Quadtree tree = build_quadtree(pixels, components.matrix, label, {});
+    CHECK(tree.nodes.size() * 5 < pixels.size());
+    CHECK(tree.interpolation.rows() == (Eigen::Index)pixels.size());
+    CHECK((tree.interpolation * VecX<f64>::Ones(tree.interpolation.cols()) - VecX<f64>::Ones(tree.interpolation.rows())).cwiseAbs().maxCoeff() < 1e-12);
+
+    MultiChannelImage expected = input;
+    blend_images_poisson(expected, replacement, invalid, { .backend = SolverBackend::Cholesky });
+    for (auto backend : { SolverBackend::Cholesky, SolverBackend::ConjugateGradient }) {
+        MultiChannelImage result = input;
+        blend_images_poisson(result, replacement, invalid, { .backend = backend, .tolerance = 1e-10, .quadtree = QuadtreeOptions {} });
+
+        // The valid pixels are kept, and a constant difference between the images is interpolated exactly
+        CHECK(((!invalid.array()).select(result[0] - input[0], 0.0)).isZero());
+        CHECK(result[1].isApprox(expected[1], 1e-8));
+
+        // A smooth difference is close to the blend of every pixel
+        f64 error = invalid.select(result[0] - expected[0], 0.0).norm();
+        f64 membrane = invalid.select(expected[0] - replacement[0], 0.0).norm();
+        CHECK(error < 0.01 * membrane);
+    }
+
+    // The conjugate gradient solve of the nodes starts from the warm start, and stops at the time budget
+    SolverOptions options = { .backend = SolverBackend::ConjugateGradient, .tolerance = 1e-10, .quadtree = QuadtreeOptions {} };
+    MultiChannelImage cold = input;
+    FillResult from_replacement = blend_images_poisson(cold, replacement, invalid, options);
+    MultiChannelImage warm = input;
+    FillResult from_warm_start = blend_images_poisson(warm, replacement, invalid, cold, options);
+    CHECK(from_warm_start.iterations < from_replacement.iterations);
+    CHECK(warm[0].isApprox(cold[0], 1e-6));
+
+    MultiChannelImage bounded = input;
+    options.time_budget = 0.0;
+    FillResult result = blend_images_poisson(bounded, replacement, invalid, options);
+    CHECK_EQ(result.status, FillStatus::DeadlineReached);
+    CHECK_EQ(result.iterations, 0);
+    CHECK(invalid.select(bounded[0] - replacement[0], 0.0).isZero());
+
+    // The automatic backend only factorizes reduced systems up to the calibrated size
+    for (long direct_size : { 0L, 40000L }) {
+        MultiChannelImage automatic = input;
+        options = { .backend = SolverBackend::Automatic, .tolerance = 1e-10, .dispatch = DispatchThresholds { .direct_size = direct_size }, .quadtree = QuadtreeOptions {} };
+        result = blend_images_poisson(automatic, replacement, invalid, options);
+        CHECK_EQ(result.iterations > 0, direct_size == 0);
+        CHECK(automatic[1].isApprox(expected[1], 1e-8));
+    }
+}
+
+TEST_CASE("additive Schwarz") {
+    MatX<f64> image = smooth_test_image(140, 130, 0.07, 0.05);
+    MatX<bool> invalid = rectangle_mask(140, 130, { { 10, 10, 120, 100 }, { 60, 100, 20, 25 } });
+
+    auto components = find_connected_components(invalid);
+    int label = components.labels_by_size().front();
+    StencilSystem system { .unknowns = components.region_map.at(label) };
+    system.diagonal.resize((Eigen::Index)system.size());
+    for (size_t i = 0; i < system.size(); ++i) {
+        system.diagonal[(Eigen::Index)i] = (f64)valid_neighbours(image, system.unknowns[i]).size();
+    }
+    sparse_t A = system.assemble();
+    VecX<f64> b = VecX<f64>::Ones(A.rows());
+
+    // The tiles that contain unknowns are the subdomains
+    Eigen::ConjugateGradient<sparse_t, Eigen::Lower | Eigen::Upper, SchwarzPreconditioner> schwarz;
+    schwarz.preconditioner().set_unknowns(system.unknowns, 32, 4);
+    schwarz.compute(A);
+    REQUIRE(schwarz.info() == Eigen::Success);
+    CHECK(schwarz.preconditioner().num_subdomains() == 4 * 4);
+    schwarz.setTolerance(1e-10);
+    VecX<f64> x = schwarz.solve(b);
+    CHECK((A * x - b).norm() < 1e-9 * b.norm());
+
+    Eigen::ConjugateGradient<sparse_t, Eigen::Lower | Eigen::Upper> jacobi(A);
+    jacobi.setTolerance(1e-10);
+    x = jacobi.solve(b);
+    CHECK(schwarz.iterations() * 4 < jacobi.iterations());
+
+    // A single tile covering the region is an exact solve
+    schwarz.preconditioner().set_unknowns(system.unknowns, 256, 4);
+    schwarz.compute(A);
+    x = schwarz.solve(b);
+    CHECK(schwarz.preconditioner().num_subdomains() == 1);
+    CHECK(schwarz.iterations() <= 1);
+
+    MatX<f64> expected = reference_fill(image, invalid);
+    MatX<f64> result = image;
+    PreconditionerOptions preconditioner { .type = Preconditioner::AdditiveSchwarz, .tile_size = 32, .overlap = 4 };
+    fill_missing_portion_smooth_boundary(result, invalid, { .tolerance = 1e-12, .preconditioner = preconditioner });
+    CHECK(result.isApprox(expected, 1e-8));
+}
+
+TEST_CASE("sine transform poisson solver") {
+    // The 5-point Laplacian of a rectangle, with zeros outside of it
+    MatX<f64> x = MatX<f64>::Random(23, 31);
+    MatX<f64> b = 4.0 * x;
+    b.topRows(22) -= x.bottomRows(22);
+    b.bottomRows(22) -= x.topRows(22);
+    b.leftCols(30) -= x.rightCols(30);
+    b.rightCols(30) -= x.leftCols(30);
+    CHECK(SineTransformSolver(23, 31).solve(b).isApprox(x, 1e-10));
+
+    // Regions of the offset blend that are not rectangles are solved with the transform as the preconditioner
+    MultiChannelImage input = offset_blend_input();
+    MultiChannelImage replacement(3, 12, 10);
+    for (size_t c = 0; c < 3; ++c) {
+        replacement[c].setConstant(1.0);
+        for (Eigen::Index row = 2; row < 10; ++row) {
+            for (Eigen::Index col = 1; col < (row < 6 ? 9 : 4); ++col) {
+                replacement(c, row, col) = 0.2 + 0.05 * (f64)(row + c * col);
+            }
+        }
+    }
+    int start_row = 5, start_column = 20;
+    MultiChannelImage placed = input;
+    MatX<bool> invalid = MatX<bool>::Constant(30, 40, false);
+    for (Eigen::Index row = 0; row < 12; ++row) {
+        for (Eigen::Index col = 0; col < 10; ++col) {
+            invalid(start_row + row, start_column + col) = replacement.valid_pixel(row, col);
+        }
+    }
+    for (size_t c = 0; c < 3; ++c) {
+        placed[c].block<12, 10>(start_row, start_column) = replacement[c];
+    }
+    MultiChannelImage expected = reference_blend(input, placed, invalid);
+
+    blend_images_poisson(input, replacement, start_row, start_column, { .tolerance = 1e-12 });
+    for (size_t c = 0; c < 3; ++c) {
+        CHECK(input[c].isApprox(expected[c], 1e-8));
+    }
+}
+
+TEST_CASE("stencil kernels") {
+    MatX<f64> image = smooth_test_image(20, 25, 0.3, 0.1);
+    // A region in the corner of the image, so the Neumann boundary leaves out some of the neighbours
+    std::vector<index_t> unknowns;
+    for (Eigen::Index col = 0; col < 10; ++col) {
+        for (Eigen::Index row = 0; row < 7 + col % 3; ++row) {
+            unknowns.push_back({ row, col });
+        }
+    }
+
+    // The kernels match the assembled matrix and the known neighbours
+    StencilKernels<f64, Boundary::Neumann> kernels(unknowns, image.rows(), image.cols());
+    StencilSystem system { .unknowns = unknowns, .diagonal = kernels.diagonal() };
+    MatX<bool> in_region = MatX<bool>::Constant(image.rows(), image.cols(), false);
+    for (size_t i = 0; i < unknowns.size(); ++i) {
+        in_region(unknowns[i].row, unknowns[i].col) = true;
+    }
+    VecX<f64> expected_b = VecX<f64>::Zero(system.size());
+    for (size_t i = 0; i < unknowns.size(); ++i) {
+        auto neighbours = valid_neighbours(image, unknowns[i]);
+        CHECK(system.diagonal[(Eigen::Index)i] == (f64)neighbours.size());
+        for (auto const& [row, col] : neighbours) {
+            expected_b[(Eigen::Index)i] += in_region(row, col) ? 0.0 : image(row, col);
+        }
+    }
+    CHECK((kernels.right_hand_side(image) - expected_b).cwiseAbs().maxCoeff() < 1e-12);
+    CHECK((kernels.values(image) - kernels.gather(kernels.scatter(kernels.values(image)))).isZero());
+
+    VecX<f64> x = VecX<f64>::Random(system.size());
+    MatX<f64> y(kernels.grid_rows(), kernels.grid_cols());
+    kernels.apply(kernels.scatter(x), y);
+    CHECK((kernels.gather(y) - system.assemble() * x).cwiseAbs().maxCoeff() < 1e-12);
+
+    // The residual of the exact solution is zero
+    VecX<f64> b = system.assemble() * x;
+    MatX<f64> r(kernels.grid_rows(), kernels.grid_cols());
+    kernels.residual(kernels.scatter(b), kernels.scatter(x), r);
+    CHECK(r.cwiseAbs().maxCoeff() < 1e-12);
+
+    // The same in single precision
+    StencilKernels<f32, Boundary::Neumann> single(unknowns, image.rows(), image.cols());
+    MatX<f32> y_single(single.grid_rows(), single.grid_cols());
+    single.apply(single.scatter(x.cast<f32>()), y_single);
+    CHECK((single.gather(y_single).cast<f64>() - kernels.gather(y)).cwiseAbs().maxCoeff() < 1e-5);
+
+    // Away from the border every neighbour exists
+    std::vector<index_t> interior = { { 5, 5 }, { 5, 6 }, { 6, 5 } };
+    StencilKernels<f64, Boundary::Interior> inside(interior, image.rows(), image.cols());
+    CHECK(inside.diagonal().isApprox(VecX<f64>::Constant(3, 4.0)));
+    StencilKernels<f64, Boundary::Neumann> corner({ { 0, 0 } }, image.rows(), image.cols());
+    CHECK(corner.diagonal()[0] == 2.0);
+    CHECK(std::abs(inside.right_hand_side(image)[0] - (image(4, 5) + image(5, 4))) < 1e-12);
+
+    // The 9-point stencil also counts the diagonal neighbours
+    StencilKernels<f64, Boundary::Interior, Connectivity::Eight> eight(interior, image.rows(), image.cols());
+    CHECK(eight.diagonal().isApprox(VecX<f64>::Constant(3, 8.0)));
+    CHECK(std::abs(eight.right_hand_side(image)[0] - (image(4, 4) + image(4, 5) + image(4, 6) + image(5, 4) + image(6, 4) + image(6, 6))) < 1e-12);
+    StencilKernels<f64, Boundary::Neumann, Connectivity::Eight> eight_corner({ { 0, 0 } }, image.rows(), image.cols());
+    CHECK(eight_corner.diagonal()[0] == 3.0);
+    MatX<f64> y_eight(eight.grid_rows(), eight.grid_cols());
+    eight.apply(eight.scatter(VecX<f64>::Ones(3)), y_eight);
+    CHECK(eight.gather(y_eight).isApprox(VecX<f64>::Constant(3, 6.0)));
+
+    // The f32 matrix-free solver reaches about the precision of f32
+    StencilConjugateGradientF32 single_solver(system);
+    single_solver.setTolerance(1e-5);
+    single_solver.setMaxIterations(1000);
+    VecX<f64> solution = single_solver.solveWithGuess(b, VecX<f64>::Zero(system.size()));
+    CHECK(single_solver.info() == Eigen::Success);
+    CHECK((solution - x).norm() < 1e-3 * x.norm());
+}